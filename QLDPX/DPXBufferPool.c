@@ -0,0 +1,144 @@
+//
+//  DPXBufferPool.c
+//  QLDPX
+//
+//  Copyright © 2019 Thomas Angarano. All rights reserved.
+//
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "DPXBufferPool.h"
+#include "DPXMetrics.h"
+
+// size classes per doubling of the buffer size, which wastes at most a fifth of a buffer
+#define kDPXSizeClassSteps 4
+
+// the number of size classes, from kDPXSmallestPooledBuffer up to 2^40 bytes.
+// Larger buffers are mapped and unmapped on their own.
+#define kDPXSizeClasses (24 * kDPXSizeClassSteps)
+
+// The buffers held by the pool are kept in a list per size class, linked
+// through their first bytes, so the pool doesn't allocate anything itself.
+typedef struct _dpxPooledBuffer {
+  struct _dpxPooledBuffer *next;
+} DPXPooledBuffer;
+
+static DPXPooledBuffer *pooledBuffers[kDPXSizeClasses];
+static size_t poolCapacity = kDPXBufferPoolCapacity;
+static DPXBufferPoolStatistics poolStatistics;
+static pthread_mutex_t poolMutex = PTHREAD_MUTEX_INITIALIZER;
+
+// returns the size of the buffers of the given size class, all multiples of 16 KB
+static size_t DPXclassSize(size_t sizeClass) {
+  const size_t doubling = (size_t)kDPXSmallestPooledBuffer << (sizeClass / kDPXSizeClassSteps);
+  return doubling / kDPXSizeClassSteps * (kDPXSizeClassSteps + sizeClass % kDPXSizeClassSteps);
+}
+
+// returns the size class of a buffer of the given size, or kDPXSizeClasses if it's
+// too large for any, and in classSize the size of the buffers mapped for it
+static size_t DPXsizeClass(size_t size, size_t *classSize) {
+  for (size_t sizeClass = 0; sizeClass < kDPXSizeClasses; sizeClass++) {
+    if (DPXclassSize(sizeClass) >= size) {
+      *classSize = DPXclassSize(sizeClass);
+      return sizeClass;
+    }
+  }
+
+  const size_t pageSize = (size_t)getpagesize();
+  *classSize = (size + pageSize - 1) / pageSize * pageSize;
+  return kDPXSizeClasses;
+}
+
+// unmaps buffers held by the pool, largest first, until they fit into its capacity.
+// The pool has to be locked.
+static void DPXtrimPool(void) {
+  for (size_t sizeClass = kDPXSizeClasses; (sizeClass > 0) && (poolStatistics.pooledBytes > poolCapacity); sizeClass--) {
+    while ((poolStatistics.pooledBytes > poolCapacity) && pooledBuffers[sizeClass - 1]) {
+      DPXPooledBuffer *buffer = pooledBuffers[sizeClass - 1];
+      pooledBuffers[sizeClass - 1] = buffer->next;
+      poolStatistics.pooledBytes -= DPXclassSize(sizeClass - 1);
+      poolStatistics.unmappings++;
+      munmap(buffer, DPXclassSize(sizeClass - 1));
+    }
+  }
+}
+
+void *DPXallocateBuffer(size_t size, bool zeroed) {
+  DPXmetricsCount(DPXCounterBytesAllocated, size);
+  if (size < kDPXSmallestPooledBuffer) {
+    const size_t bytes = (size > 0) ? size : 1;
+    return zeroed ? calloc(1, bytes) : malloc(bytes);
+  }
+
+  size_t classSize;
+  const size_t sizeClass = DPXsizeClass(size, &classSize);
+
+  DPXPooledBuffer *buffer = NULL;
+  pthread_mutex_lock(&poolMutex);
+  if ((sizeClass < kDPXSizeClasses) && pooledBuffers[sizeClass]) {
+    buffer = pooledBuffers[sizeClass];
+    pooledBuffers[sizeClass] = buffer->next;
+    poolStatistics.pooledBytes -= classSize;
+    poolStatistics.reuses++;
+  } else {
+    poolStatistics.mappings++;
+  }
+  pthread_mutex_unlock(&poolMutex);
+
+  if (buffer) {
+    if (zeroed) {
+      memset(buffer, 0, size);
+    }
+    return buffer;
+  }
+
+  // freshly mapped pages read as zeros anyway
+  void *bytes = mmap(NULL, classSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+  return (bytes == MAP_FAILED) ? NULL : bytes;
+}
+
+void DPXreleaseBuffer(void *buffer, size_t size) {
+  if (!buffer) {
+    return;
+  }
+  if (size < kDPXSmallestPooledBuffer) {
+    free(buffer);
+    return;
+  }
+
+  size_t classSize;
+  const size_t sizeClass = DPXsizeClass(size, &classSize);
+
+  pthread_mutex_lock(&poolMutex);
+  const bool pooled = (sizeClass < kDPXSizeClasses) && (poolStatistics.pooledBytes + classSize <= poolCapacity);
+  if (pooled) {
+    DPXPooledBuffer *pooledBuffer = buffer;
+    pooledBuffer->next = pooledBuffers[sizeClass];
+    pooledBuffers[sizeClass] = pooledBuffer;
+    poolStatistics.pooledBytes += classSize;
+  } else {
+    poolStatistics.unmappings++;
+  }
+  pthread_mutex_unlock(&poolMutex);
+
+  if (!pooled) {
+    munmap(buffer, classSize);
+  }
+}
+
+void DPXsetBufferPoolCapacity(size_t capacity) {
+  pthread_mutex_lock(&poolMutex);
+  poolCapacity = capacity;
+  DPXtrimPool();
+  pthread_mutex_unlock(&poolMutex);
+}
+
+void DPXbufferPoolGetStatistics(DPXBufferPoolStatistics *statistics) {
+  pthread_mutex_lock(&poolMutex);
+  *statistics = poolStatistics;
+  pthread_mutex_unlock(&poolMutex);
+}
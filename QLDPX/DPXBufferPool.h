@@ -0,0 +1,58 @@
+//
+//  DPXBufferPool.h
+//  QLDPX
+//
+//  Copyright © 2019 Thomas Angarano. All rights reserved.
+//
+
+#ifndef QLDPX_DPXBUFFERPOOL_H_
+#define QLDPX_DPXBUFFERPOOL_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Image buffer pool
+//
+// Buffers of kDPXSmallestPooledBuffer bytes and more are mapped in size classes,
+// four per doubling, and kept in a pool of up to kDPXBufferPoolCapacity bytes
+// when released, so later decodes reuse their pages. Smaller ones use malloc.
+// All functions are thread-safe.
+
+// the smallest buffer taken from the pool, smaller ones are allocated with malloc
+#define kDPXSmallestPooledBuffer (64 * 1024)
+
+// the default number of bytes the buffers held by the pool may add up to
+#define kDPXBufferPoolCapacity (256 * 1024 * 1024)
+
+typedef struct _dpxBufferPoolStatistics {
+  uint64_t reuses;       // buffers taken from the pool
+  uint64_t mappings;     // buffers mapped because the pool held none of their size class
+  uint64_t unmappings;   // released buffers unmapped because the pool was full or had no size class for them
+  uint64_t pooledBytes;  // bytes of the buffers currently held by the pool
+} DPXBufferPoolStatistics;
+
+// void *DPXallocateBuffer(size_t, bool)
+// allocates a buffer of at least size bytes, page-aligned unless it is smaller
+// than kDPXSmallestPooledBuffer. If zeroed is false, the contents of a buffer
+// taken from the pool are left as they are, so the caller has to write every
+// byte it reads.
+// returns the buffer, to be released with DPXreleaseBuffer, or NULL if there
+// wasn't enough memory
+void *DPXallocateBuffer(size_t size, bool zeroed);
+
+// void DPXreleaseBuffer(void *, size_t)
+// returns a buffer allocated by DPXallocateBuffer with the given size to the
+// pool, or frees it. Does nothing if buffer is NULL.
+void DPXreleaseBuffer(void *buffer, size_t size);
+
+// void DPXsetBufferPoolCapacity(size_t)
+// sets the number of bytes the buffers held by the pool may add up to.
+// Buffers beyond the new capacity are unmapped right away; 0 turns pooling off.
+void DPXsetBufferPoolCapacity(size_t capacity);
+
+// void DPXbufferPoolGetStatistics(DPXBufferPoolStatistics *)
+// copies the pool's counters, counted since the process started
+void DPXbufferPoolGetStatistics(DPXBufferPoolStatistics *statistics);
+
+#endif  // QLDPX_DPXBUFFERPOOL_H_
@@ -0,0 +1,1158 @@
+//
+//  DPXDecoder.c
+//  QLDPX
+//
+//  Created by Thomas Angarano on 12/01/2019.
+//  Copyright © 2019 Thomas Angarano. All rights reserved.
+//
+
+#include <fcntl.h>
+#include <limits.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "DPXDecoder.h"
+#include "DPXDecoderPrivate.h"
+#include "DPXBufferPool.h"
+#include "DPXMetrics.h"
+#include "DPXUnpack.h"
+#include "DPXWorkers.h"
+
+struct _dpxCancellation {
+  bool cancelled;
+  uint32_t references;
+};
+
+// returns true if magic is the magic number of a DPX (or Cineon) file
+static bool DPXisMagic(uint32_t magic) {
+  return (magic == 0x53445058) || (magic == 0x58504453) || (magic == 0x802A5FD7); // 0x802A5FD7 is for Cineon (.cin)
+}
+
+// takes the identity of a file from its status
+static void DPXidentityOfStatus(const struct stat *fileStatus, DPXFileIdentity *identity) {
+  identity->device = fileStatus->st_dev;
+  identity->inode = fileStatus->st_ino;
+  identity->size = fileStatus->st_size;
+#ifdef __APPLE__
+  identity->modificationTime = fileStatus->st_mtimespec;
+#else
+  identity->modificationTime = fileStatus->st_mtim;
+#endif
+}
+
+// opens the file at the given path and checks its magic number with a single small read
+// returns the open file descriptor, or -1 if the file can't be read or is not a DPX file
+static int openDPXFile(const char *path) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return -1;
+  }
+
+  uint32_t magic = 0;
+  if ((pread(fd, &magic, sizeof(magic), 0) != sizeof(magic)) || !DPXisMagic(magic)) {
+    // not a DPX (or Cineon) file
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+bool isDPXFileAtPath(const char *path) {
+  int fd = openDPXFile(path);
+  if (fd < 0) {
+    return false;
+  }
+
+  close(fd);
+  return true;
+}
+
+static void DPXswap16(uint16_t *field) {
+  *field = __builtin_bswap16(*field);
+}
+
+void DPXswap32(void *field) {
+  uint32_t value;
+  memcpy(&value, field, sizeof(value));
+  value = __builtin_bswap32(value);
+  memcpy(field, &value, sizeof(value));
+}
+
+void DPXswapHeader(DPXImageHeader *fileHeader) {
+  FileInformation *fileInformation = &fileHeader->fileInformationHeader;
+  DPXswap32(&fileInformation->magic_num);
+  DPXswap32(&fileInformation->offset);
+  DPXswap32(&fileInformation->file_size);
+  DPXswap32(&fileInformation->ditto_key);
+  DPXswap32(&fileInformation->gen_hdr_size);
+  DPXswap32(&fileInformation->ind_hdr_size);
+  DPXswap32(&fileInformation->user_data_size);
+  DPXswap32(&fileInformation->key);
+
+  ImageInformation *imageInformation = &fileHeader->imageInformationHeader;
+  DPXswap16(&imageInformation->orientation);
+  DPXswap16(&imageInformation->element_number);
+  DPXswap32(&imageInformation->pixels_per_line);
+  DPXswap32(&imageInformation->lines_per_image_ele);
+  for (size_t i = 0; i < 8; i++) {
+    struct _image_element *element = &imageInformation->image_element[i];
+    DPXswap32(&element->data_sign);
+    DPXswap32(&element->ref_low_data);
+    DPXswap32(&element->ref_low_quantity);
+    DPXswap32(&element->ref_high_data);
+    DPXswap32(&element->ref_high_quantity);
+    DPXswap16(&element->packing);
+    DPXswap16(&element->encoding);
+    DPXswap32(&element->data_offset);
+    DPXswap32(&element->eol_padding);
+    DPXswap32(&element->eo_image_padding);
+  }
+
+  ImageOrientation *orientation = &fileHeader->imageOrientationHeader;
+  DPXswap32(&orientation->x_offset);
+  DPXswap32(&orientation->y_offset);
+  DPXswap32(&orientation->x_center);
+  DPXswap32(&orientation->y_center);
+  DPXswap32(&orientation->x_orig_size);
+  DPXswap32(&orientation->y_orig_size);
+  for (size_t i = 0; i < 4; i++) {
+    DPXswap16(&orientation->border[i]);
+  }
+  DPXswap32(&orientation->pixel_aspect[0]);
+  DPXswap32(&orientation->pixel_aspect[1]);
+
+  MotionPictureFilm *film = &fileHeader->mpfHeader;
+  DPXswap32(&film->frame_position);
+  DPXswap32(&film->sequence_len);
+  DPXswap32(&film->held_count);
+  DPXswap32(&film->frame_rate);
+  DPXswap32(&film->shutter_angle);
+
+  TelevisionHeader *television = &fileHeader->tvHeader;
+  DPXswap32(&television->time_code);
+  DPXswap32(&television->userBits);
+  DPXswap32(&television->hor_sample_rate);
+  DPXswap32(&television->ver_sample_rate);
+  DPXswap32(&television->frame_rate);
+  DPXswap32(&television->time_offset);
+  DPXswap32(&television->gamma);
+  DPXswap32(&television->black_level);
+  DPXswap32(&television->black_gain);
+  DPXswap32(&television->break_point);
+  DPXswap32(&television->white_level);
+  DPXswap32(&television->integration_times);
+}
+
+// returns the number of bytes holding the pixels of one line of an element.
+// Lines always start on a 32-bit boundary, so this includes the padding of the last word,
+// but not the end-of-line padding given in the header.
+static size_t DPXlineLength(uint8_t bitSize, uint16_t packing, size_t components, size_t width) {
+  const size_t componentsPerLine = width * components;
+
+  size_t words = 0;
+  if (bitSize == 10 && packing != 0) {
+    words = (componentsPerLine + 2) / 3;    // 3 10-bit components per 32-bit word
+  } else if (bitSize == 12 && packing != 0) {
+    words = (componentsPerLine + 1) / 2;    // 2 12-bit components per 32-bit word
+  } else {
+    words = (componentsPerLine * bitSize + 31) / 32;
+  }
+
+  return words * 4;
+}
+
+// fills in the layout of image_element[index] of a header in host byte order
+static void DPXparseElement(const DPXImageFile *file, size_t index, DPXElement *element) {
+  const struct _image_element *entry = &file->header.imageInformationHeader.image_element[index];
+
+  element->descriptor = entry->descriptor;
+  element->bitSize = entry->bit_size;
+  element->packing = entry->packing;
+  element->log = (entry->bit_size == 10) && ((entry->transfer == 1) || (entry->transfer == 3));
+
+  element->components = 3;
+  if (entry->descriptor >= 1 && entry->descriptor <= 8) {
+    element->components = 1;
+  } else if (entry->descriptor == 51 || entry->descriptor == 52) {
+    element->components = 4;
+  }
+
+  // an undefined offset means the data of the first element follows the header
+  element->dataOffset = entry->data_offset;
+  if ((entry->data_offset == 0xFFFFFFFF) && (index == 0)) {
+    element->dataOffset = file->header.fileInformationHeader.offset;
+  }
+
+  element->lineLength = DPXlineLength(entry->bit_size, entry->packing, element->components, file->width);
+  element->stride = element->lineLength + ((entry->eol_padding == 0xFFFFFFFF) ? 0 : entry->eol_padding);  // 0xFFFFFFFF is undefined
+
+  // lines cut off by the end of the file are left out, so the data of every line
+  // up to element->lines is inside the mapping
+  element->lines = 0;
+  if ((element->lineLength > 0) && (element->dataOffset < file->length) && (file->length - element->dataOffset >= element->lineLength)) {
+    element->lines = MIN(file->elementHeight, (file->length - element->dataOffset - element->lineLength) / element->stride + 1);
+  }
+}
+
+// returns the index of the first element with the given descriptor, or file->elementCount if there is none
+static size_t DPXfindElement(const DPXImageFile *file, uint8_t descriptor) {
+  size_t index = 0;
+  while ((index < file->elementCount) && (file->elements[index].descriptor != descriptor)) {
+    index++;
+  }
+  return index;
+}
+
+// builds the tables the 10-bit elements of images with log elements are converted
+// with, the log table from the reference values of the first log element
+static void DPXbuildTables(DPXImageFile *file) {
+  for (size_t i = 0; i < file->elementCount; i++) {
+    if (file->elements[i].log) {
+      const struct _image_element *entry = &file->header.imageInformationHeader.image_element[i];
+      DPXbuildLogTable(entry->ref_low_data, entry->ref_high_data, file->logTable);
+      DPXbuildLinearTable(file->linearTable);
+      file->logElements = true;
+      return;
+    }
+  }
+}
+
+// looks up the kernels of the given element, with the image's tone mapping or
+// table as their context
+// returns false if the element's layout is not supported
+static bool DPXfindElementKernels(const DPXImageFile *file, const DPXElement *element, DPXLineKernels *kernels) {
+  if (file->logElements && (element->bitSize == 10)) {
+    if (!DPXfindTableLineKernels(element->packing, element->descriptor, file->swapped, kernels)) {
+      return false;
+    }
+    kernels->context = element->log ? file->logTable : file->linearTable;
+    return true;
+  }
+  if (!DPXfindLineKernels(element->bitSize, element->packing, element->descriptor, file->swapped, kernels)) {
+    return false;
+  }
+  if (element->bitSize == 32) {
+    kernels->context = &file->toneMapping;
+  }
+  return true;
+}
+
+// works out how the elements make up the image: R, G, B (and A) or RGB and matte
+// elements are planes of one image, two other elements of the same layout are a
+// stereo pair, left eye on top. Both views are decoded with the kernels of
+// image_element[0], so log elements of a pair need the same reference values for
+// their tables to match. Anything else leaves image_element[0] on its own.
+static void DPXcomposeElements(DPXImageFile *file) {
+  file->views = 1;
+  file->planeCount = 1;
+  file->planes[0] = 0;
+  if (file->elementCount < 2) {
+    return;
+  }
+
+  size_t planes[4] = { DPXfindElement(file, 1), DPXfindElement(file, 2), DPXfindElement(file, 3), DPXfindElement(file, 4) };
+  size_t planeCount = (planes[3] < file->elementCount) ? 4 : 3;
+  if ((planes[0] == file->elementCount) || (planes[1] == file->elementCount) || (planes[2] == file->elementCount)) {
+    planes[0] = DPXfindElement(file, 50);
+    planes[1] = planes[3];
+    planeCount = 2;
+  }
+
+  bool planar = true;
+  size_t components = 0;
+  for (size_t plane = 0; plane < planeCount; plane++) {
+    const DPXElement *element = &file->elements[MIN(planes[plane], 7)];
+    DPXLineKernels *kernels = &file->planeKernels[plane];
+    planar = planar && (planes[plane] < file->elementCount) &&
+             DPXfindElementKernels(file, element, kernels) && kernels->accumulateLine &&
+             (kernels->precision == file->planeKernels[0].precision);
+    components += planar ? kernels->components : 0;
+  }
+
+  if (planar && (components <= 4)) {
+    file->planeCount = planeCount;
+    memcpy(file->planes, planes, sizeof(planes));
+    return;
+  }
+
+  const DPXElement *left = &file->elements[0];
+  const DPXElement *right = &file->elements[1];
+  const struct _image_element *leftEntry = &file->header.imageInformationHeader.image_element[0];
+  const struct _image_element *rightEntry = &file->header.imageInformationHeader.image_element[1];
+  const bool sameTable = (left->log == right->log) &&
+                         (!left->log || ((leftEntry->ref_low_data == rightEntry->ref_low_data) && (leftEntry->ref_high_data == rightEntry->ref_high_data)));
+  if ((left->descriptor == right->descriptor) && (left->bitSize == right->bitSize) && (left->packing == right->packing) && sameTable) {
+    file->views = kDPXMaxViews;
+  }
+}
+
+DPXCancellation DPXcreateCancellation(void) {
+  DPXCancellation cancellation = calloc(1, sizeof(struct _dpxCancellation));
+  if (cancellation) {
+    cancellation->references = 1;
+  }
+  return cancellation;
+}
+
+DPXCancellation DPXretainCancellation(DPXCancellation cancellation) {
+  if (cancellation) {
+    __atomic_add_fetch(&cancellation->references, 1, __ATOMIC_RELAXED);
+  }
+  return cancellation;
+}
+
+void releaseDPXCancellation(DPXCancellation cancellation) {
+  if (cancellation && (__atomic_sub_fetch(&cancellation->references, 1, __ATOMIC_ACQ_REL) == 0)) {
+    free(cancellation);
+  }
+}
+
+void DPXcancel(DPXCancellation cancellation) {
+  if (cancellation) {
+    __atomic_store_n(&cancellation->cancelled, true, __ATOMIC_RELAXED);
+  }
+}
+
+bool DPXisCancelled(DPXCancellation cancellation) {
+  return cancellation && __atomic_load_n(&cancellation->cancelled, __ATOMIC_RELAXED);
+}
+
+DPXImage readDPXImageAtPath(const char *path, DPXCancellation cancellation) {
+  if (DPXisCancelled(cancellation)) {
+    return NULL;
+  }
+
+  const uint64_t start = DPXmetricsNow();
+  int fd = openDPXFile(path);
+  if (fd < 0) {
+    return NULL;
+  }
+
+  struct stat fileStatus;
+  if ((fstat(fd, &fileStatus) != 0) || (fileStatus.st_size < (off_t)sizeof(DPXImageHeader))) {
+    // Not a dpx file: file is too small
+    close(fd);
+    return NULL;
+  }
+
+  DPXImageFile *file = calloc(1, sizeof(DPXImageFile));
+  if (!file) {
+    close(fd);
+    return NULL;
+  }
+
+  // read only the header now, the image data is mapped below and paged in on demand
+  if (pread(fd, &file->header, sizeof(DPXImageHeader), 0) != sizeof(DPXImageHeader)) {
+    close(fd);
+    free(file);
+    return NULL;
+  }
+
+  // everything the accessors and decoders need is taken from the header here, once
+  file->swapped = (file->header.fileInformationHeader.magic_num == 0x58504453);
+  if (file->swapped) {
+    DPXswapHeader(&file->header);
+  }
+  file->header.fileInformationHeader.creator[sizeof(file->header.fileInformationHeader.creator) - 1] = '\0';
+  file->width = file->header.imageInformationHeader.pixels_per_line;
+  file->elementHeight = file->header.imageInformationHeader.lines_per_image_ele;
+  file->length = (size_t)fileStatus.st_size;
+  DPXidentityOfStatus(&fileStatus, &file->identity);
+  file->elementCount = MIN(MAX(file->header.imageInformationHeader.element_number, 1), 8);
+  for (size_t i = 0; i < file->elementCount; i++) {
+    DPXparseElement(file, i, &file->elements[i]);
+  }
+  DPXbuildTables(file);
+  DPXcomposeElements(file);
+  file->height = file->elementHeight * file->views;
+
+  void *bytes = mmap(NULL, (size_t)fileStatus.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  if (bytes == MAP_FAILED) {
+    close(fd);
+    free(file);
+    return NULL;
+  }
+
+  file->fd = fd;
+  file->bytes = bytes;
+  file->references = 1;
+  file->cancellation = DPXretainCancellation(cancellation);
+
+  if (start) {
+    file->path = strdup(path);
+    DPXmetricsCount(DPXCounterImages, 1);
+    DPXmetricsCount(DPXCounterBytesRead, sizeof(uint32_t) + sizeof(DPXImageHeader));
+    DPXmetricsRecordStage(DPXStageOpen, start, file->path);
+  }
+
+  return file;
+}
+
+void releaseDPXImage(DPXImage image) {
+  if (!image) {
+    return;
+  }
+
+  // CGImages created without a copy of the pixels keep the mapping until they are released
+  DPXImageFile *file = (DPXImageFile *)image;
+  if (__atomic_sub_fetch(&file->references, 1, __ATOMIC_ACQ_REL) != 0) {
+    return;
+  }
+  munmap((void *)file->bytes, file->length);
+  close(file->fd);
+  releaseDPXCancellation(file->cancellation);
+  free(file->path);
+  free(file);
+}
+
+const char* DPXcreator(const DPXImage image) {
+  if (!image) {
+    return "DPXImage: not a valid image";
+  }
+
+  return ((const DPXImageFile *)image)->header.fileInformationHeader.creator;
+}
+
+size_t DPXwidth(const DPXImage image) {
+  return image ? ((const DPXImageFile *)image)->width : 0;
+}
+
+size_t DPXheight(const DPXImage image) {
+  return image ? ((const DPXImageFile *)image)->height : 0;
+}
+
+bool DPXisByteSwapped(const DPXImage image) {
+  return image && ((const DPXImageFile *)image)->swapped;
+}
+
+void DPXgetFileIdentity(const DPXImage image, DPXFileIdentity *identity) {
+  if (image) {
+    *identity = ((const DPXImageFile *)image)->identity;
+  } else {
+    memset(identity, 0, sizeof(DPXFileIdentity));
+  }
+}
+
+bool DPXfileIdentityAtPath(const char *path, DPXFileIdentity *identity) {
+  struct stat fileStatus;
+  if (stat(path, &fileStatus) != 0) {
+    return false;
+  }
+
+  DPXidentityOfStatus(&fileStatus, identity);
+  return true;
+}
+
+bool DPXisSameFile(const DPXFileIdentity *a, const DPXFileIdentity *b) {
+  return (a->device == b->device) && (a->inode == b->inode) && (a->size == b->size) &&
+         (a->modificationTime.tv_sec == b->modificationTime.tv_sec) && (a->modificationTime.tv_nsec == b->modificationTime.tv_nsec);
+}
+
+void DPXsetToneMapping(DPXImage image, DPXToneMapping toneMapping) {
+  if (!image) {
+    return;
+  }
+
+  ((DPXImageFile *)image)->toneMapping = toneMapping;
+}
+
+static size_t DPXgcd(size_t a, size_t b) {
+  while (b != 0) {
+    const size_t remainder = a % b;
+    a = b;
+    b = remainder;
+  }
+  return a;
+}
+
+void DPXmakeRegion(const DPXElement *element, size_t x, size_t y, size_t width, size_t height, DPXRegion *region) {
+  // the number of pixels after which pixels and words start together again: filled
+  // 10 and 12-bit words hold 3 or 2 components, all other data is a stream of bits
+  size_t period = 32 / DPXgcd(element->components * element->bitSize, 32);
+  if ((element->bitSize == 10 || element->bitSize == 12) && element->packing != 0) {
+    const size_t componentsPerWord = (element->bitSize == 10) ? 3 : 2;
+    period = componentsPerWord / DPXgcd(element->components, componentsPerWord);
+  }
+
+  const size_t first = x / period * period;
+  region->x = x;
+  region->y = y;
+  region->width = width;
+  region->height = height;
+  region->skip = x - first;
+  region->offset = DPXlineLength(element->bitSize, element->packing, element->components, first);
+  region->length = DPXlineLength(element->bitSize, element->packing, element->components, x + width) - region->offset;
+}
+
+// the largest gap between two requested lines that is read through instead of
+// issuing a separate read
+#define kDPXMaxReadGap (16 * 1024)
+
+// reads the given lines (ascending, duplicates allowed) of an element with as few
+// reads as possible and points linePointers into the returned buffer, which the
+// caller has to release with DPXreleaseBuffer. Lines past the end of the file are zeros.
+// returns NULL if there wasn't enough memory or the image's cancellation was cancelled
+static uint8_t *DPXreadLines(const DPXImageFile *file, size_t offset, size_t stride, size_t length, const size_t *lines, size_t count, const uint8_t **linePointers, size_t *bufferSize) {
+
+  // first pass: coalesce neighbouring lines into runs and sum up the size of the buffer
+  *bufferSize = 0;
+  for (size_t i = 0; i < count; ) {
+    size_t runEnd = lines[i] * stride + length;
+    size_t j = i + 1;
+    while (j < count && lines[j] * stride <= runEnd + kDPXMaxReadGap) {
+      runEnd = lines[j] * stride + length;
+      j++;
+    }
+    *bufferSize += runEnd - lines[i] * stride;
+    i = j;
+  }
+
+  // every byte is either read or zeroed below
+  const uint64_t start = DPXmetricsNow();
+  uint8_t *buffer = DPXallocateBuffer(*bufferSize, false);
+  if (!buffer) {
+    return NULL;
+  }
+
+  // second pass: read every run with a single pread
+  uint8_t *runBuffer = buffer;
+  for (size_t i = 0; i < count; ) {
+    if (DPXisCancelled(file->cancellation)) {
+      DPXreleaseBuffer(buffer, *bufferSize);
+      return NULL;
+    }
+
+    const size_t runStart = lines[i] * stride;
+    size_t runEnd = runStart + length;
+    size_t j = i + 1;
+    while (j < count && lines[j] * stride <= runEnd + kDPXMaxReadGap) {
+      runEnd = lines[j] * stride + length;
+      j++;
+    }
+
+    size_t done = 0;
+    while (done < runEnd - runStart) {
+      const ssize_t bytesRead = pread(file->fd, runBuffer + done, runEnd - runStart - done, (off_t)(offset + runStart + done));
+      if (bytesRead <= 0) {
+        break;
+      }
+      done += (size_t)bytesRead;
+    }
+    memset(runBuffer + done, 0, runEnd - runStart - done);
+    DPXmetricsCount(DPXCounterBytesRead, done);
+
+    for (size_t k = i; k < j; k++) {
+      linePointers[k] = runBuffer + (lines[k] * stride - runStart);
+    }
+
+    runBuffer += runEnd - runStart;
+    i = j;
+  }
+
+  DPXmetricsRecordStage(DPXStageRead, start, file->path);
+  return buffer;
+}
+
+// Large images are decoded in bands of lines spread over the workers with DPXapply.
+// Each band writes only its own lines, and checks the cancellation before every line.
+
+// the number of lines decoded by one band of a full size image
+#define kDPXBandLines 64
+
+// the number of lines of a thumbnail created by one band
+#define kDPXThumbnailBandLines 8
+
+// the lines of a region of the image that lie in one of its views
+typedef struct _dpxViewPart {
+  size_t view;
+  size_t firstLine;   // the part's first line in the elements of the view
+  size_t regionLine;  // the part's first line in the region
+  size_t height;
+} DPXViewPart;
+
+// splits the lines y up to y + height of the image at the boundaries between its views
+// returns the number of parts, at most kDPXMaxViews
+static size_t DPXviewParts(const DPXImageFile *file, size_t y, size_t height, DPXViewPart *parts) {
+  size_t partCount = 0;
+  for (size_t view = 0; (view < file->views) && (view < kDPXMaxViews); view++) {
+    const size_t first = MAX(y, view * file->elementHeight);
+    const size_t end = MIN(y + height, (view + 1) * file->elementHeight);
+    if (first < end) {
+      parts[partCount].view = view;
+      parts[partCount].firstLine = first - view * file->elementHeight;
+      parts[partCount].regionLine = first - y;
+      parts[partCount].height = end - first;
+      partCount++;
+    }
+  }
+  return partCount;
+}
+
+// returns the element holding the given plane of a view
+static const DPXElement *DPXplaneElement(const DPXImageFile *file, size_t view, size_t plane) {
+  return &file->elements[(file->planeCount > 1) ? file->planes[plane] : view];
+}
+
+// returns the kernels unpacking the given plane, kernels being those of the image, see DPXfindImageKernels
+static const DPXLineKernels *DPXplaneKernels(const DPXImageFile *file, const DPXLineKernels *kernels, size_t plane) {
+  return (file->planeCount > 1) ? &file->planeKernels[plane] : kernels;
+}
+
+// returns the number of sums needed to unpack a line of width pixels of any of the planes
+static size_t DPXplaneSumsLength(const DPXPlaneSource *planes, size_t planeCount, size_t width) {
+  size_t length = 0;
+  for (size_t plane = 0; plane < planeCount; plane++) {
+    length = MAX(length, (planes[plane].skip + width) * planes[plane].kernels->components + 1);
+  }
+  return length;
+}
+
+// unpacks count lines of every plane at full precision, starting with line first, and
+// interleaves their sums into sums, which get width pixels of all planes' components.
+// planeSums needs DPXplaneSumsLength entries.
+static void DPXaccumulatePlanes(const DPXPlaneSource *planes, size_t planeCount, size_t first, size_t count, size_t width, size_t components, uint32_t *planeSums, uint32_t *sums) {
+  size_t firstComponent = 0;
+  for (size_t plane = 0; plane < planeCount; plane++) {
+    const DPXPlaneSource *source = &planes[plane];
+    const size_t planeComponents = source->kernels->components;
+    const size_t sourceWidth = source->skip + width;
+
+    memset(planeSums, 0, (sourceWidth * planeComponents + 1) * sizeof(uint32_t));
+    for (size_t line = first; line < first + count; line++) {
+      const uint8_t *sourceLine = source->linePointers ? source->linePointers[line] : source->source + line * source->stride;
+      source->kernels->accumulateLine(sourceLine, planeSums, sourceWidth, source->kernels->context);
+    }
+
+    const uint32_t *planeSum = planeSums + source->skip * planeComponents;
+    for (size_t x = 0; x < width; x++) {
+      for (size_t component = 0; component < planeComponents; component++) {
+        sums[x * components + firstComponent + component] = planeSum[x * planeComponents + component];
+      }
+    }
+    firstComponent += planeComponents;
+  }
+}
+
+typedef struct _dpxDecodeBands {
+  const DPXLineKernels *kernels;
+  DPXComponentFormat format;
+  bool convert;           // true if no line kernel produces the format, see DPXlineKernelProduces
+  size_t firstLine;       // the line of the image source and target start at, which picks the rows of the dither pattern
+  const uint8_t *source;  // first unpacked pixel of line firstLine of the element
+  size_t stride;          // distance between source lines in bytes
+  uint8_t *target;
+  size_t bytesPerRow;
+  size_t skip;            // pixels unpacked in front of the first target pixel, see DPXRegion
+  size_t width;           // pixels of a target line
+  size_t height;
+  const DPXPlaneSource *planes;  // the planes of a planar image, interleaved in place of source, or NULL
+  size_t planeCount;
+  DPXCancellation cancellation;
+  bool failed;            // set if a band couldn't allocate its line of values
+} DPXDecodeBands;
+
+// decodes the lines first up to lastLine of a planar image, whose planes are
+// unpacked and interleaved into one line of values converted to the target
+static void DPXdecodePlanarLines(DPXDecodeBands *bands, size_t first, size_t lastLine) {
+  const size_t components = bands->kernels->components;
+  uint32_t *values = malloc((bands->width * components + 1) * sizeof(uint32_t));
+  uint32_t *planeValues = malloc(DPXplaneSumsLength(bands->planes, bands->planeCount, bands->width) * sizeof(uint32_t));
+  if (!values || !planeValues) {
+    __atomic_store_n(&bands->failed, true, __ATOMIC_RELAXED);
+    free(values);
+    free(planeValues);
+    return;
+  }
+
+  for (size_t y = first; (y < lastLine) && !DPXisCancelled(bands->cancellation); y++) {
+    DPXaccumulatePlanes(bands->planes, bands->planeCount, y, 1, bands->width, components, planeValues, values);
+    DPXconvertLine(values, bands->width, components, bands->kernels->precision, bands->format, bands->firstLine + y, bands->target + y * bands->bytesPerRow);
+  }
+
+  free(values);
+  free(planeValues);
+}
+
+static void DPXdecodeBand(void *context, size_t band) {
+  DPXDecodeBands *bands = context;
+  const size_t lastLine = MIN((band + 1) * kDPXBandLines, bands->height);
+  const size_t components = bands->kernels->components;
+
+  if (bands->planes) {
+    DPXdecodePlanarLines(bands, band * kDPXBandLines, lastLine);
+    return;
+  }
+
+  const DPXLineKernel line = DPXformatLineKernel(bands->kernels, bands->format);
+  if (!bands->convert && (bands->skip == 0)) {
+    for (size_t y = band * kDPXBandLines; (y < lastLine) && !DPXisCancelled(bands->cancellation); y++) {
+      line(bands->source + y * bands->stride, bands->target + y * bands->bytesPerRow, bands->width, bands->kernels->context);
+    }
+    return;
+  }
+
+  // lines starting inside a word are unpacked from the word's first pixel and cut,
+  // other formats are converted from the components unpacked at full precision
+  const size_t sourceWidth = bands->skip + bands->width;
+  const size_t pixelBytes = components * (((bands->format == DPXComponentFormat8) || (bands->format == DPXComponentFormat8Dithered)) ? 1 : 2);
+  const size_t valuesLength = bands->convert ? (sourceWidth * components + 1) * sizeof(uint32_t) : sourceWidth * pixelBytes;
+  void *values = malloc(valuesLength);
+  if (!values) {
+    __atomic_store_n(&bands->failed, true, __ATOMIC_RELAXED);
+    return;
+  }
+
+  for (size_t y = band * kDPXBandLines; (y < lastLine) && !DPXisCancelled(bands->cancellation); y++) {
+    uint8_t *target = bands->target + y * bands->bytesPerRow;
+    if (bands->convert) {
+      memset(values, 0, valuesLength);
+      bands->kernels->accumulateLine(bands->source + y * bands->stride, values, sourceWidth, bands->kernels->context);
+      DPXconvertLine((const uint32_t *)values + bands->skip * components, bands->width, components, bands->kernels->precision, bands->format, bands->firstLine + y, target);
+    } else {
+      line(bands->source + y * bands->stride, values, sourceWidth, bands->kernels->context);
+      memcpy(target, (const uint8_t *)values + bands->skip * pixelBytes, bands->width * pixelBytes);
+    }
+  }
+
+  free(values);
+}
+
+// the bands of the parts of a region in different views, which are all handed to the workers
+// at once so the elements of the views are unpacked side by side
+typedef struct _dpxViewBands {
+  DPXDecodeBands parts[kDPXMaxViews];
+  size_t firstBands[kDPXMaxViews + 1];  // the index of the first band of each part, followed by the number of bands
+} DPXViewBands;
+
+static void DPXdecodeViewBand(void *context, size_t band) {
+  DPXViewBands *viewBands = context;
+  size_t part = 0;
+  while (band >= viewBands->firstBands[part + 1]) {
+    part++;
+  }
+  DPXdecodeBand(&viewBands->parts[part], band - viewBands->firstBands[part]);
+}
+
+typedef struct _dpxReduceBands {
+  const DPXLineKernels *kernels;
+  DPXComponentFormat format;
+  bool swap;
+  const DPXPlaneSource *planes;      // the source lines averaged for all thumbnail lines, in order, of every plane
+  size_t planeCount;
+  const size_t *firstTaps;           // index of the first source line of each thumbnail line, thumbheight + 1 entries
+  const size_t *columnStarts;
+  size_t width;
+  size_t thumbwidth;
+  size_t thumbheight;
+  uint8_t *target;
+  size_t bytesPerRow;
+  DPXCancellation cancellation;
+  bool failed;                       // set if a band couldn't allocate its sums
+} DPXReduceBands;
+
+static void DPXreduceBand(void *context, size_t band) {
+  DPXReduceBands *bands = context;
+  const size_t components = bands->kernels->components;
+  const size_t sumsLength = (bands->width * components + 1) * sizeof(uint32_t);
+  const size_t lastLine = MIN((band + 1) * kDPXThumbnailBandLines, bands->thumbheight);
+  const bool planar = (bands->planeCount > 1);
+
+  // the planes of planar images are summed up separately and interleaved
+  uint32_t *sums = calloc(1, sumsLength);
+  uint32_t *planeSums = planar ? malloc(DPXplaneSumsLength(bands->planes, bands->planeCount, bands->width) * sizeof(uint32_t)) : NULL;
+  if (!sums || (planar && !planeSums)) {
+    __atomic_store_n(&bands->failed, true, __ATOMIC_RELAXED);
+    free(sums);
+    free(planeSums);
+    return;
+  }
+
+  for (size_t y = band * kDPXThumbnailBandLines; (y < lastLine) && !DPXisCancelled(bands->cancellation); y++) {
+    const size_t taps = bands->firstTaps[y + 1] - bands->firstTaps[y];
+    if (planar) {
+      DPXaccumulatePlanes(bands->planes, bands->planeCount, bands->firstTaps[y], taps, bands->width, components, planeSums, sums);
+    } else {
+      memset(sums, 0, sumsLength);
+      for (size_t tap = bands->firstTaps[y]; tap < bands->firstTaps[y + 1]; tap++) {
+        bands->kernels->accumulateLine(bands->planes[0].linePointers[tap], sums, bands->width, bands->kernels->context);
+      }
+    }
+
+    DPXreduceLine(bands->kernels, sums, bands->columnStarts, bands->thumbwidth, taps, bands->format, y, bands->swap, bands->target + y * bands->bytesPerRow);
+  }
+
+  free(sums);
+  free(planeSums);
+}
+
+size_t DPXpickThumbnailLines(size_t height, size_t thumbheight, size_t *sourceLines, size_t *firstTaps) {
+  size_t lineCount = 0;
+  for (size_t y = 0; y < thumbheight; y++) {
+    const size_t firstLine = y * height / thumbheight;
+    const size_t lines = (y + 1) * height / thumbheight - firstLine;
+    const size_t taps = MIN(lines, kDPXThumbnailTaps);
+
+    firstTaps[y] = lineCount;
+    for (size_t tap = 0; tap < taps; tap++) {
+      sourceLines[lineCount++] = firstLine + (2 * tap + 1) * lines / (2 * taps);
+    }
+  }
+  firstTaps[thumbheight] = lineCount;
+
+  return lineCount;
+}
+
+bool DPXreduceThumbnailLines(const DPXLineKernels *kernels, const DPXPlaneSource *planes, size_t planeCount, DPXComponentFormat format, bool swap, DPXCancellation cancellation, const size_t *firstTaps, size_t width, size_t thumbwidth, size_t thumbheight, uint8_t *data, size_t bytesPerRow) {
+  size_t *columnStarts = malloc((thumbwidth + 1) * sizeof(size_t));
+  if (!columnStarts) {
+    return false;
+  }
+
+  // the skip pixels of a single plane are left out of its columns, planes are interleaved without them
+  const size_t skip = (planeCount == 1) ? planes[0].skip : 0;
+  for (size_t x = 0; x <= thumbwidth; x++) {
+    columnStarts[x] = skip + x * width / thumbwidth;
+  }
+
+  DPXReduceBands bands = { kernels, format, swap, planes, planeCount, firstTaps, columnStarts, skip + width, thumbwidth, thumbheight, data, bytesPerRow, cancellation, false };
+  DPXapply((thumbheight + kDPXThumbnailBandLines - 1) / kDPXThumbnailBandLines, &bands, DPXreduceBand);
+
+  free(columnStarts);
+
+  return !bands.failed && !DPXisCancelled(cancellation);
+}
+
+// points linePointers at the given lines of the region of an element, in the mapping
+// if every line is needed and inside the file, otherwise in a buffer read with DPXreadLines
+// returns false if the lines couldn't be read, see DPXreadLines
+static bool DPXgetSourceLines(const DPXImageFile *file, const DPXElement *element, const DPXRegion *region, const size_t *lines, size_t count, const uint8_t **linePointers, uint8_t **buffer, size_t *bufferSize) {
+  *buffer = NULL;
+  *bufferSize = 0;
+  if ((count >= region->height) && ((count == 0) || (lines[count - 1] < element->lines))) {
+    // every line is needed anyway, so copying them out of the file gains nothing
+    posix_madvise((void *)file->bytes, file->length, POSIX_MADV_SEQUENTIAL);
+    for (size_t i = 0; i < count; i++) {
+      linePointers[i] = file->bytes + element->dataOffset + lines[i] * element->stride + region->offset;
+    }
+    return true;
+  }
+
+  *buffer = DPXreadLines(file, element->dataOffset + region->offset, element->stride, region->length, lines, count, linePointers, bufferSize);
+  return *buffer != NULL;
+}
+
+bool DPXreduceImage(const DPXImageFile *file, const DPXLineKernels *kernels, DPXComponentFormat format, const DPXRegion *region, size_t thumbwidth, size_t thumbheight, uint8_t *data, size_t bytesPerRow) {
+  const size_t tapCount = thumbheight * kDPXThumbnailTaps;
+  size_t *sourceLines = malloc(tapCount * sizeof(size_t));
+  size_t *firstTaps = malloc((thumbheight + 1) * sizeof(size_t));
+  const uint8_t **sourceLinePointers = malloc(file->planeCount * tapCount * sizeof(uint8_t *));
+  if (!sourceLines || !firstTaps || !sourceLinePointers) {
+    free(sourceLines);
+    free(firstTaps);
+    free(sourceLinePointers);
+    return false;
+  }
+
+  const size_t lineCount = DPXpickThumbnailLines(region->height, thumbheight, sourceLines, firstTaps);
+  for (size_t i = 0; i < lineCount; i++) {
+    sourceLines[i] += region->y;
+  }
+
+  DPXViewPart parts[kDPXMaxViews];
+  const size_t partCount = DPXviewParts(file, region->y, region->height, parts);
+  DPXPlaneSource planes[4];
+  uint8_t *sourceBuffers[kDPXMaxViews * 4] = { NULL };
+  size_t sourceBufferSizes[kDPXMaxViews * 4] = { 0 };
+  bool haveLines = true;
+  for (size_t part = 0, first = 0; part < partCount; part++) {
+    // the part's lines are the next ones picked, counted from the start of its view
+    const size_t viewStart = parts[part].view * file->elementHeight;
+    size_t end = first;
+    while ((end < lineCount) && (sourceLines[end] < viewStart + file->elementHeight)) {
+      sourceLines[end++] -= viewStart;
+    }
+
+    for (size_t plane = 0; plane < file->planeCount; plane++) {
+      const DPXElement *element = DPXplaneElement(file, parts[part].view, plane);
+      DPXRegion planeRegion;
+      DPXmakeRegion(element, region->x, parts[part].firstLine, region->width, parts[part].height, &planeRegion);
+
+      DPXPlaneSource source = { DPXplaneKernels(file, kernels, plane), NULL, 0, sourceLinePointers + plane * tapCount, planeRegion.skip };
+      planes[plane] = source;
+      haveLines = haveLines && DPXgetSourceLines(file, element, &planeRegion, sourceLines + first, end - first, source.linePointers + first, &sourceBuffers[part * 4 + plane], &sourceBufferSizes[part * 4 + plane]);
+    }
+    first = end;
+  }
+
+  // only 16-bit data is reduced in the file's byte order, planar images and tone mapped
+  // float data are in the host's like they are decoded, see DPXpixelFormat
+  const bool swap = file->swapped && (file->elements[0].bitSize == 16) && (file->planeCount == 1);
+  const bool reduced = haveLines && DPXreduceThumbnailLines(kernels, planes, file->planeCount, format, swap, file->cancellation, firstTaps, region->width, thumbwidth, thumbheight, data, bytesPerRow);
+
+  for (size_t i = 0; i < kDPXMaxViews * 4; i++) {
+    DPXreleaseBuffer(sourceBuffers[i], sourceBufferSizes[i]);
+  }
+  free(sourceLines);
+  free(firstTaps);
+  free(sourceLinePointers);
+
+  return reduced;
+}
+
+void DPXthumbnailDimensions(size_t width, size_t height, double maxWidth, double maxHeight, size_t *thumbwidth, size_t *thumbheight) {
+  if (width <= maxWidth && height <= maxHeight) {
+    *thumbwidth = width;
+    *thumbheight = height;
+    return;
+  }
+
+  const double scale = fmax((double)width / (maxWidth - 1.0), (double)height / (maxHeight - 1.0));
+
+  *thumbwidth = (size_t)(width / scale) + 1;
+  *thumbheight = (size_t)(height / scale) + 1;
+}
+
+DPXPixelFormat DPXpixelFormat(const DPXImageFile *file, const DPXLineKernels *kernels, DPXComponentFormat format) {
+  const DPXElement *element = &file->elements[0];
+  DPXPixelFormat pixelFormat = { 8, 0, false, false, DPXAlphaNone };
+
+  if ((format == DPXComponentFormat16) || (format == DPXComponentFormatHalf)) {
+    // 16-bit data stays in the file's byte order, everything else (and planar images) is converted to the host's,
+    // float data by the tone mapping
+    const bool fileByteOrder = (format == DPXComponentFormat16) && (element->bitSize == 16) && (file->planeCount == 1);
+    pixelFormat.bitsPerComponent = 16;
+    pixelFormat.bigEndian = (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__) != (fileByteOrder && file->swapped);
+    pixelFormat.floatComponents = (format == DPXComponentFormatHalf);
+  }
+
+  size_t components = kernels ? kernels->components : element->components;
+  if (!kernels && (components == 4) && ((element->bitSize == 10) || (element->bitSize == 12))) {
+    // alpha is dropped
+    components = 3;
+  } else if ((components == 4) && ((element->descriptor == 51) || (file->planeCount > 1))) {
+    pixelFormat.alpha = DPXAlphaLast;
+  } else if ((components == 4) && (element->descriptor == 52)) {
+    pixelFormat.alpha = DPXAlphaFirst;
+  }
+
+  pixelFormat.bitsPerPixel = components * pixelFormat.bitsPerComponent;
+  return pixelFormat;
+}
+
+bool DPXlineKernelProduces(const DPXLineKernels *kernels, DPXComponentFormat format) {
+  switch (kernels->precision) {
+    case 8:
+      return (format == DPXComponentFormat8) || (format == DPXComponentFormat8Dithered);
+    case 16:
+      return (format == DPXComponentFormat16) || ((format == DPXComponentFormat8) && kernels->line8);
+    default:
+      return format == DPXComponentFormat8;
+  }
+}
+
+DPXLineKernel DPXformatLineKernel(const DPXLineKernels *kernels, DPXComponentFormat format) {
+  return ((format == DPXComponentFormat8) && kernels->line8) ? kernels->line8 : kernels->line;
+}
+
+bool DPXfindImageKernels(const DPXImageFile *file, bool scaled, DPXLineKernels *kernels) {
+  if (file->planeCount > 1) {
+    uint8_t components = 0;
+    for (size_t plane = 0; plane < file->planeCount; plane++) {
+      components += file->planeKernels[plane].components;
+    }
+
+    const DPXLineKernels planarKernels = { NULL, NULL, components, file->planeKernels[0].precision, NULL };
+    *kernels = planarKernels;
+    return true;
+  }
+
+  const DPXElement *element = &file->elements[0];
+  return DPXfindElementKernels(file, element, kernels) && kernels->accumulateLine && (scaled || kernels->line);
+}
+
+bool DPXdecodeRegion(const DPXImageFile *file, const DPXLineKernels *kernels, DPXComponentFormat format, const DPXRegion *region, uint8_t *target, size_t bytesPerRow) {
+  const bool planar = (file->planeCount > 1);
+  const bool convert = planar || !DPXlineKernelProduces(kernels, format);
+  const size_t componentBytes = ((format == DPXComponentFormat8) || (format == DPXComponentFormat8Dithered)) ? 1 : 2;
+  const size_t lineBytes = region->width * kernels->components * componentBytes;
+
+  DPXViewPart parts[kDPXMaxViews];
+  DPXPlaneSource planes[kDPXMaxViews][4];
+  DPXViewBands viewBands;
+  viewBands.firstBands[0] = 0;
+  const size_t partCount = DPXviewParts(file, region->y, region->height, parts);
+  if (partCount > kDPXMaxViews) {
+    return false;
+  }
+  for (size_t part = 0; part < partCount; part++) {
+    // the part ends with the first line missing from any of its planes
+    size_t lines = parts[part].height;
+    for (size_t plane = 0; plane < file->planeCount; plane++) {
+      const DPXElement *element = DPXplaneElement(file, parts[part].view, plane);
+      DPXRegion planeRegion;
+      DPXmakeRegion(element, region->x, parts[part].firstLine, region->width, parts[part].height, &planeRegion);
+      lines = (planeRegion.y < element->lines) ? MIN(lines, element->lines - planeRegion.y) : 0;
+
+      const DPXPlaneSource source = { DPXplaneKernels(file, kernels, plane), file->bytes + element->dataOffset + planeRegion.y * element->stride + planeRegion.offset, element->stride, NULL, planeRegion.skip };
+      planes[part][plane] = source;
+    }
+
+    uint8_t *partTarget = target + parts[part].regionLine * bytesPerRow;
+    for (size_t y = lines; y < parts[part].height; y++) {
+      memset(partTarget + y * bytesPerRow, 0, lineBytes);
+    }
+
+    const DPXPlaneSource *source = &planes[part][0];
+    DPXDecodeBands bands = { kernels, format, convert, region->y + parts[part].regionLine, source->source, source->stride, partTarget, bytesPerRow, source->skip, region->width, lines, planar ? planes[part] : NULL, file->planeCount, file->cancellation, false };
+    viewBands.parts[part] = bands;
+    viewBands.firstBands[part + 1] = viewBands.firstBands[part] + (lines + kDPXBandLines - 1) / kDPXBandLines;
+  }
+  DPXapply(viewBands.firstBands[partCount], &viewBands, DPXdecodeViewBand);
+
+  bool failed = DPXisCancelled(file->cancellation);
+  for (size_t part = 0; part < partCount; part++) {
+    failed = failed || viewBands.parts[part].failed;
+  }
+  return !failed;
+}
+
+void DPXrecordPath(const DPXImageFile *file, DPXDecodePath path, uint64_t start) {
+  const DPXElement *element = &file->elements[0];
+  DPXmetricsRecordPath(path, element->bitSize, element->packing, element->descriptor, start, file->path);
+}
+
+bool DPXgetLineFormat(const DPXImage image, DPXComponentFormat format, size_t *bitsPerComponent, size_t *bitsPerPixel) {
+  if (!image) {
+    return false;
+  }
+
+  const DPXImageFile *file = (const DPXImageFile *)image;
+  DPXLineKernels kernels;
+  if (!DPXfindImageKernels(file, false, &kernels)) {
+    return false;
+  }
+
+  const DPXPixelFormat pixelFormat = DPXpixelFormat(file, &kernels, format);
+  *bitsPerComponent = pixelFormat.bitsPerComponent;
+  *bitsPerPixel = pixelFormat.bitsPerPixel;
+  return true;
+}
+
+bool DPXdecodeLines(const DPXImage image, size_t firstLine, size_t count, DPXComponentFormat format, void *target, size_t bytesPerRow) {
+  if (!image) {
+    return false;
+  }
+
+  const DPXImageFile *file = (const DPXImageFile *)image;
+  if ((firstLine > file->height) || (count > file->height - firstLine)) {
+    return false;
+  }
+
+  DPXLineKernels kernels;
+  if (!DPXfindImageKernels(file, false, &kernels)) {
+    return false;
+  }
+
+  const DPXPixelFormat pixelFormat = DPXpixelFormat(file, &kernels, format);
+  const size_t lineBytes = pixelFormat.bitsPerPixel / 8 * file->width;
+  if (bytesPerRow < lineBytes) {
+    return false;
+  }
+
+  DPXRegion region;
+  DPXmakeRegion(&file->elements[0], 0, firstLine, file->width, count, &region);
+  const uint64_t start = DPXmetricsNow();
+  if (!DPXdecodeRegion(file, &kernels, format, &region, target, bytesPerRow)) {
+    return false;
+  }
+  DPXmetricsRecordStage(DPXStageDecode, start, file->path);
+
+  // the pages holding only the decoded lines are dropped from the process, so
+  // decoding a frame window by window keeps about one window of it resident.
+  // The file stays in the page cache, so reading the lines again is cheap.
+  const size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+  DPXViewPart parts[kDPXMaxViews];
+  const size_t partCount = DPXviewParts(file, firstLine, count, parts);
+  for (size_t part = 0; part < partCount; part++) {
+    for (size_t plane = 0; plane < file->planeCount; plane++) {
+      const DPXElement *element = DPXplaneElement(file, parts[part].view, plane);
+      const size_t decodedEnd = MIN(parts[part].firstLine + parts[part].height, element->lines);
+      const size_t pagesStart = (element->dataOffset + parts[part].firstLine * element->stride + pageSize - 1) / pageSize * pageSize;
+      const size_t pagesEnd = MIN(element->dataOffset + decodedEnd * element->stride, file->length) / pageSize * pageSize;
+      if ((parts[part].firstLine < decodedEnd) && (pagesStart < pagesEnd)) {
+        madvise((void *)(file->bytes + pagesStart), pagesEnd - pagesStart, MADV_DONTNEED);
+      }
+    }
+  }
+
+  return true;
+}
+
+bool DPXdecodeThumbnail(const DPXImage image, size_t thumbwidth, size_t thumbheight, DPXComponentFormat format, void *target, size_t bytesPerRow) {
+  if (!image) {
+    return false;
+  }
+
+  const DPXImageFile *file = (const DPXImageFile *)image;
+  if ((thumbwidth == 0) || (thumbheight == 0) || (thumbwidth > file->width) || (thumbheight > file->height)) {
+    return false;
+  }
+
+  DPXLineKernels kernels;
+  if (!DPXfindImageKernels(file, true, &kernels)) {
+    return false;
+  }
+
+  const DPXPixelFormat pixelFormat = DPXpixelFormat(file, &kernels, format);
+  if (bytesPerRow < pixelFormat.bitsPerPixel / 8 * thumbwidth) {
+    return false;
+  }
+
+  DPXRegion region;
+  DPXmakeRegion(&file->elements[0], 0, 0, file->width, file->height, &region);
+  const uint64_t start = DPXmetricsNow();
+  if (!DPXreduceImage(file, &kernels, format, &region, thumbwidth, thumbheight, target, bytesPerRow)) {
+    return false;
+  }
+  DPXmetricsRecordStage(DPXStageScale, start, file->path);
+
+  return true;
+}
+
+bool DPXdecodeProgressively(const DPXImage image, size_t coarseWidth, size_t coarseHeight, DPXComponentFormat format, void *target, size_t bytesPerRow,
+                            DPXProgressiveCallback callback, void *info) {
+  size_t bitsPerComponent, bitsPerPixel;
+  if (!image || !callback || !DPXgetLineFormat(image, format, &bitsPerComponent, &bitsPerPixel)) {
+    return false;
+  }
+
+  // the thumbnail only reads a few lines per line of it, so it is ready long before the full size image
+  const DPXImageFile *file = (const DPXImageFile *)image;
+  if ((file->width > coarseWidth) || (file->height > coarseHeight)) {
+    size_t thumbwidth, thumbheight;
+    DPXthumbnailDimensions(file->width, file->height, coarseWidth, coarseHeight, &thumbwidth, &thumbheight);
+    const DPXProgressiveStage coarse = { malloc(bitsPerPixel / 8 * thumbwidth * thumbheight), thumbwidth, thumbheight, bitsPerPixel / 8 * thumbwidth, false };
+    if (!coarse.pixels) {
+      return false;
+    }
+    if (!DPXisCancelled(file->cancellation) &&
+        DPXdecodeThumbnail(image, coarse.width, coarse.height, format, (void *)coarse.pixels, coarse.bytesPerRow) &&
+        !DPXisCancelled(file->cancellation)) {
+      callback(&coarse, info);
+    }
+    free((void *)coarse.pixels);
+  }
+
+  if (DPXisCancelled(file->cancellation) || !DPXdecodeLines(image, 0, file->height, format, target, bytesPerRow) || DPXisCancelled(file->cancellation)) {
+    return false;
+  }
+
+  const DPXProgressiveStage full = { target, file->width, file->height, bytesPerRow, true };
+  callback(&full, info);
+  return true;
+}
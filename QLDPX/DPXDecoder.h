@@ -0,0 +1,189 @@
+//
+//  DPXDecoder.h
+//  QLDPX
+//
+//  Copyright © 2019 Thomas Angarano. All rights reserved.
+//
+
+#ifndef QLDPX_DPXDECODER_H_
+#define QLDPX_DPXDECODER_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include "DPXUnpack.h"
+
+// Decoder
+//
+// The part of the decoder that doesn't need CoreGraphics, so it also builds on
+// Linux. DPXImage.h creates CGImages with it.
+
+typedef const void * DPXImage;
+
+// A cancellation lets another thread stop the decoding of an image, see
+// readDPXImageAtPath. It is reference counted, so the thread
+// cancelling and the image can each keep it for as long as they need it.
+typedef struct _dpxCancellation *DPXCancellation;
+
+// The device, inode, size and modification time of a file, which change when
+// the file is replaced or written to. The caches key their entries on it.
+typedef struct _dpxFileIdentity {
+  dev_t device;
+  ino_t inode;
+  off_t size;
+  struct timespec modificationTime;
+} DPXFileIdentity;
+
+// bool isDPXFileAtPath(const char *)
+// checks the magic number of the file at the given path.
+// Only the first four bytes of the file are read, so this is cheap enough
+// to be called for every file regardless of its extension.
+// returns true if the file is a DPX (or Cineon) file
+bool isDPXFileAtPath(const char *path);
+
+// DPXImage readDPXImageAtPath(const char *, DPXCancellation)
+// reads a DPX image from the given path, keeping a reference to the given
+// cancellation (which may be NULL). The image data is memory-mapped.
+// The caller takes ownership of the returned image and has to release it
+// with releaseDPXImage when it is no longer needed.
+// returns NULL if the file couldn't be read, is not a DPX file or the
+// cancellation is already cancelled
+DPXImage readDPXImageAtPath(const char *path, DPXCancellation cancellation);
+
+// void releaseDPXImage(DPXImage)
+// release a DPX image and free its memory.
+// The DPXImage and pointers derived from it (e.g. with *DPXcreator)
+// must not be used after calling this function.
+void releaseDPXImage(DPXImage);
+
+// DPXCancellation DPXcreateCancellation(void)
+// create a cancellation that hasn't been cancelled.
+// The caller takes ownership of the returned cancellation and has to release
+// it with releaseDPXCancellation when it is no longer needed.
+// returns NULL if there wasn't enough memory
+DPXCancellation DPXcreateCancellation(void);
+
+// DPXCancellation DPXretainCancellation(DPXCancellation)
+// adds a reference to the cancellation, to be released with releaseDPXCancellation
+// returns the cancellation
+DPXCancellation DPXretainCancellation(DPXCancellation);
+
+// void releaseDPXCancellation(DPXCancellation)
+// release a reference to the cancellation and free it with the last one
+void releaseDPXCancellation(DPXCancellation);
+
+// void DPXcancel(DPXCancellation)
+// cancels the decoding of the images read with the cancellation.
+// It can be called from any thread and returns without waiting for them.
+void DPXcancel(DPXCancellation);
+
+// bool DPXisCancelled(DPXCancellation)
+// returns true if the cancellation has been cancelled, false if it hasn't or is NULL
+bool DPXisCancelled(DPXCancellation);
+
+// const char *DPXcreator(DPXImage)
+// returns a pointer to the "creator" field (stored as a 0-terminated C string)
+// in the DPX header. The pointer will be valid until the DPXImage has been
+// released with releaseDPXImage.
+const char *DPXcreator(DPXImage);
+
+// size_t DPXwidth(DPXImage)
+// returns the width of the image in pixels
+size_t DPXwidth(DPXImage);
+
+// size_t DPXheight(DPXImage)
+// returns the height of the image in pixels. Stereo pairs stored in two image
+// elements are decoded with the left eye above the right one, so they are
+// twice the height of an element.
+size_t DPXheight(DPXImage);
+
+// bool DPXisByteSwapped(DPXImage)
+// returns true if the byte order of the file differs from the host's.
+// 16-bit integer images created from 16-bit image data keep the file's byte
+// order, all other 16-bit images are in the host's byte order.
+bool DPXisByteSwapped(DPXImage);
+
+// void DPXgetFileIdentity(DPXImage, DPXFileIdentity *)
+// gets the identity of the image's file as it was when the image was read.
+// It is taken from the open file rather than the path, so it belongs to the
+// data that is decoded even if the file is replaced in the meantime.
+void DPXgetFileIdentity(DPXImage, DPXFileIdentity *identity);
+
+// bool DPXfileIdentityAtPath(const char *, DPXFileIdentity *)
+// gets the identity of the file at the given path in its current state
+// returns false if the file doesn't exist
+bool DPXfileIdentityAtPath(const char *path, DPXFileIdentity *identity);
+
+// bool DPXisSameFile(const DPXFileIdentity *, const DPXFileIdentity *)
+// returns true if both identities are those of the same file in the same state
+bool DPXisSameFile(const DPXFileIdentity *a, const DPXFileIdentity *b);
+
+// void DPXsetToneMapping(DPXImage, DPXToneMapping)
+// sets the exposure and tone curve 32-bit float image data is converted to
+// integer components with, see DPXToneMapping. Images are opened with an
+// exposure of 0 and DPXToneCurveLinear. It has to be set before the image
+// is decoded, and doesn't affect images of other bit sizes.
+void DPXsetToneMapping(DPXImage, DPXToneMapping toneMapping);
+
+// bool DPXgetLineFormat(DPXImage, DPXComponentFormat, size_t *, size_t *)
+// gets the bits per component and bits per pixel of the lines DPXdecodeLines
+// and DPXdecodeThumbnail decode with the given format
+// returns false if the layout of the image isn't supported
+bool DPXgetLineFormat(DPXImage, DPXComponentFormat format, size_t *bitsPerComponent, size_t *bitsPerPixel);
+
+// bool DPXdecodeLines(DPXImage, size_t, size_t, DPXComponentFormat, void *, size_t)
+// decodes count lines of the image, starting at firstLine, to target with
+// components of the given format, see DPXgetLineFormat. The lines are
+// bytesPerRow apart in target, which needs room for all of them.
+// Only the source data of these lines is read, and dropped again afterwards.
+// returns false if the lines are outside the image, the layout of the
+// image isn't supported, bytesPerRow is too small for a line or the image's
+// cancellation was cancelled
+bool DPXdecodeLines(DPXImage, size_t firstLine, size_t count, DPXComponentFormat format, void *target, size_t bytesPerRow);
+
+// void DPXthumbnailDimensions(size_t, size_t, double, double, size_t *, size_t *)
+// computes the size of the thumbnail of an image of width x height pixels
+// that fits into maxWidth x maxHeight, keeping the image's aspect ratio.
+// Images that fit keep their size.
+void DPXthumbnailDimensions(size_t width, size_t height, double maxWidth, double maxHeight, size_t *thumbwidth, size_t *thumbheight);
+
+// bool DPXdecodeThumbnail(DPXImage, size_t, size_t, DPXComponentFormat, void *, size_t)
+// scales the image down to thumbwidth x thumbheight pixels, at most the size
+// of the image, with components of the given format, see DPXgetLineFormat,
+// into target, bytesPerRow apart, averaging a few evenly spaced lines.
+// returns false if the layout of the image isn't supported, there wasn't enough
+// memory or the image's cancellation was cancelled
+bool DPXdecodeThumbnail(DPXImage, size_t thumbwidth, size_t thumbheight, DPXComponentFormat format, void *target, size_t bytesPerRow);
+
+// A stage of DPXdecodeProgressively: width x height pixels with components of
+// the format it was given, bytesPerRow apart. The last stage is the full size
+// image and final.
+typedef struct _dpxProgressiveStage {
+  const void *pixels;
+  size_t width;
+  size_t height;
+  size_t bytesPerRow;
+  bool final;
+} DPXProgressiveStage;
+
+// void (*DPXProgressiveCallback)(const DPXProgressiveStage *, void *)
+// receives the stages of DPXdecodeProgressively on the decoding thread.
+// The pixels of the coarse stage are only valid during the call.
+typedef void (*DPXProgressiveCallback)(const DPXProgressiveStage *stage, void *info);
+
+// bool DPXdecodeProgressively(DPXImage, size_t, size_t, DPXComponentFormat, void *, size_t, DPXProgressiveCallback, void *)
+// decodes the image coarse to fine with components of the given format,
+// passing every stage to callback together with info: first a thumbnail that
+// fits into coarseWidth x coarseHeight, read sparsely like DPXdecodeThumbnail,
+// then the full size image, decoded with DPXdecodeLines to target, bytesPerRow
+// apart. Images that fit into the coarse size only have the full size stage.
+// The image's cancellation is checked before every stage, and stages decoded
+// after it was cancelled aren't passed on.
+// returns false if the full size image couldn't be decoded, see DPXdecodeLines,
+// or there wasn't enough memory for the coarse stage
+bool DPXdecodeProgressively(DPXImage, size_t coarseWidth, size_t coarseHeight, DPXComponentFormat format, void *target, size_t bytesPerRow,
+                            DPXProgressiveCallback callback, void *info);
+
+#endif  // QLDPX_DPXDECODER_H_
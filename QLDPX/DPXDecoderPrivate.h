@@ -0,0 +1,290 @@
+//
+//  DPXDecoderPrivate.h
+//  QLDPX
+//
+//  DPX header structs modified from http://www.cineon.com/ff_draft.php
+//  Copyright © 2019 Thomas Angarano. All rights reserved.
+//
+
+#ifndef QLDPX_DPXDECODERPRIVATE_H_
+#define QLDPX_DPXDECODERPRIVATE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "DPXDecoder.h"
+#include "DPXMetrics.h"
+#include "DPXUnpack.h"
+
+// The image behind a DPXImage and the parts of the decoder DPXImage.c builds
+// its CGImages on. Only the decoder's own files include this header.
+
+#define MAX(X, Y) (((X) > (Y)) ? (X) : (Y))
+#define MIN(X, Y) (((X) < (Y)) ? (X) : (Y))
+
+typedef struct file_information
+{
+  uint32_t magic_num;      // magic number 0x53445058 (SDPX) or 0x58504453 (XPDS)
+  uint32_t offset;         // offset to image data in bytes
+  char vers[8];            // which header format version is being used (v1.0)
+  uint32_t file_size;      // file size in bytes
+  uint32_t ditto_key;      // read time short cut - 0 = same, 1 = new
+  uint32_t gen_hdr_size;   // generic header length in bytes
+  uint32_t ind_hdr_size;   // industry header length in bytes
+  uint32_t user_data_size; // user-defined data length in bytes
+  char file_name[100];     // image file name
+  char create_time[24];    // file creation date "yyyy:mm:dd:hh:mm:ss:LTZ"
+  char creator[100];       // file creator's name
+  char project[200];       // project name
+  char copyright[200];     // right to use or copyright info
+  uint32_t key;            // encryption ( FFFFFFFF = unencrypted )
+  char Reserved[104];      // reserved field TBD (need to pad)
+} FileInformation;
+
+typedef struct _image_information
+{
+  uint16_t orientation;         // image orientation */
+  uint16_t element_number;      // number of image elements */
+  uint32_t pixels_per_line;     // or x value */
+  uint32_t lines_per_image_ele; // or y value, per element */
+  struct _image_element
+  {
+    uint32_t data_sign;        // data sign (0 = unsigned, 1 = signed ) Note: "Core set images are unsigned"
+    uint32_t ref_low_data;     // reference low data code value
+    int ref_low_quantity;      // reference low quantity represented
+    uint32_t ref_high_data;    // reference high data code value
+    int ref_high_quantity;     // reference high quantity represented
+    uint8_t descriptor;        // descriptor for image element
+    uint8_t transfer;          // transfer characteristics for element
+    uint8_t colorimetric;      // colormetric specification for element
+    uint8_t bit_size;          // bit size for element
+    uint16_t packing;          // packing for element
+    uint16_t encoding;         // encoding for element
+    uint32_t data_offset;      // offset to data of element
+    uint32_t eol_padding;      // end of line padding used in element
+    uint32_t eo_image_padding; // end of image padding used in element
+    char description[32];      // description of element
+  } image_element[8];          // NOTE THERE ARE EIGHT OF THESE
+
+  uint8_t reserved[52];        // reserved for future use (padding)
+} ImageInformation;
+
+typedef struct _image_orientation
+{
+  uint32_t x_offset;        // X offset
+  uint32_t y_offset;        // Y offset
+  int x_center;             // X center
+  int y_center;             // Y center
+  uint32_t x_orig_size;     // X original size
+  uint32_t y_orig_size;     // Y original size
+  char file_name[100];      // source image file name
+  char creation_time[24];   // source image creation date and time
+  char input_dev[32];       // input device name
+  char input_serial[32];    // input device serial number
+  uint16_t border[4];       // border validity (XL, XR, YT, YB)
+  uint32_t pixel_aspect[2]; // pixel aspect ratio (H:V)
+  uint8_t reserved[28];     // reserved for future use (padding)
+} ImageOrientation;
+
+typedef struct _motion_picture_film_header
+{
+  char film_mfg_id[2];     // film manufacturer ID code (2 digits from film edge code)
+  char film_type[2];       // file type (2 digits from film edge code)
+  char offset[2];          // offset in perfs (2 digits from film edge code)
+  char prefix[6];          // prefix (6 digits from film edge code)
+  char count[4];           // count (4 digits from film edge code)
+  char format[32];         // format (i.e. academy)
+  uint32_t frame_position; // frame position in sequence
+  uint32_t sequence_len;   // sequence length in frames
+  uint32_t held_count;     // held count (1 = default)
+  int frame_rate;          // frame rate of original in frames/sec
+  int shutter_angle;       // shutter angle of camera in degrees
+  char frame_id[32];       // frame identification (i.e. keyframe)
+  char slate_info[100];    // slate information
+  uint8_t reserved[56];    // reserved for future use (padding)
+} MotionPictureFilm;
+
+typedef struct _television_header
+{
+  uint32_t time_code;     // SMPTE time code
+  uint32_t userBits;      // SMPTE user bits
+  uint8_t interlace;      // interlace ( 0 = noninterlaced, 1 = 2:1 interlace
+  uint8_t field_num;      // field number
+  uint8_t video_signal;   // video signal standard
+  uint8_t unused;         // used for byte alignment only
+  int hor_sample_rate;    // horizontal sampling rate in Hz
+  int ver_sample_rate;    // vertical sampling rate in Hz
+  int frame_rate;         // temporal sampling rate or frame rate in Hz
+  int time_offset;        // time offset from sync to first pixel
+  int gamma;              // gamma value
+  int black_level;        // black level code value
+  int black_gain;         // black gain
+  int break_point;        // breakpoint
+  int white_level;        // reference white level code value
+  int integration_times;  // integration time(s)
+  uint8_t reserved[76];   // reserved for future use (padding)
+} TelevisionHeader;
+
+typedef struct _dpxImageHeader {
+  FileInformation fileInformationHeader;
+  ImageInformation imageInformationHeader;
+  ImageOrientation imageOrientationHeader;
+  MotionPictureFilm mpfHeader;
+  TelevisionHeader tvHeader;
+} DPXImageHeader;
+
+// the layout of an image element, taken from its header entry once when the image
+// is opened and checked against the size of the file
+typedef struct _dpxElement {
+  uint8_t descriptor;
+  uint8_t bitSize;
+  uint16_t packing;
+  size_t components;  // components per pixel
+  size_t dataOffset;  // offset of the element's first line in the file
+  size_t lineLength;  // bytes holding the pixels of one line, see DPXlineLength
+  size_t stride;      // distance in bytes between the starts of two consecutive lines
+  size_t lines;       // number of lines that are completely inside the file, at most the element height
+  bool log;           // 10-bit printing density (transfer 1) or logarithmic (3) data, converted with the image's logTable
+} DPXElement;
+
+// the most views an image has, those of a stereo pair
+#define kDPXMaxViews 2
+
+typedef struct _dpxImageFile {
+  DPXImageHeader header;  // copy of the file's header, read in one go and converted to host byte order when the image is opened
+  bool swapped;           // true if the byte order of the file differs from the host's
+  size_t width;
+  size_t height;          // height of the decoded image, with all views stacked
+  size_t elementHeight;   // lines of every element
+  size_t elementCount;    // number of valid entries in elements
+  DPXElement elements[8];
+  size_t views;           // elements stacked on top of each other, kDPXMaxViews for a stereo pair and 1 otherwise, see DPXcomposeElements
+  size_t planeCount;      // elements whose components are interleaved into each pixel, 1 unless they are stored separately
+  size_t planes[4];       // the indices of those elements, in the order of their components
+  DPXLineKernels planeKernels[4];  // their kernels, only looked up for images of more than one plane
+  int fd;                 // file descriptor, kept open for the lifetime of the image
+  const uint8_t *bytes;   // read-only mapping of the whole file; pages are faulted in on first access
+  size_t length;          // length of the file (and the mapping) in bytes
+  DPXFileIdentity identity;  // the file's identity, taken from fd when the image was read
+  uint32_t references;    // the caller's reference plus one for every CGImage referencing the mapping
+  DPXCancellation cancellation;  // checked by the decoders between bands of lines, may be NULL
+  DPXToneMapping toneMapping;    // the context of the kernels of 32-bit float elements, see DPXfindElementKernels
+  bool logElements;              // true if any element is log data, so all 10-bit elements are converted with table kernels
+  uint16_t logTable[kDPXTableSize];    // the context of the kernels of log elements, see DPXbuildLogTable
+  uint16_t linearTable[kDPXTableSize]; // the context of the kernels of the other 10-bit elements of images with log elements
+  char *path;                    // the file's path the metrics are recorded for, NULL unless they are on
+} DPXImageFile;
+
+// a rectangle of an element, in pixels from its top left corner.
+// The line kernels can only start unpacking at a pixel whose data starts a
+// 32-bit word, so lines are unpacked from the last such pixel at or before x.
+typedef struct _dpxRegion {
+  size_t x;
+  size_t y;
+  size_t width;
+  size_t height;
+  size_t skip;    // the number of pixels unpacked in front of x
+  size_t offset;  // offset of the first unpacked pixel from the start of a line in bytes
+  size_t length;  // bytes of a line holding the pixels from x - skip up to x + width
+} DPXRegion;
+
+// the source lines of a plane of the image, a region of one of its elements
+typedef struct _dpxPlaneSource {
+  const DPXLineKernels *kernels;
+  const uint8_t *source;        // first unpacked pixel of the region's first line, when decoding at full size
+  size_t stride;                // distance between source lines in bytes
+  const uint8_t **linePointers; // the source lines, in place of source and stride when scaling
+  size_t skip;                  // pixels unpacked in front of the region's first pixel, see DPXRegion
+} DPXPlaneSource;
+
+typedef enum _dpxAlpha {
+  DPXAlphaNone,
+  DPXAlphaLast,   // the last component of every pixel is alpha
+  DPXAlphaFirst   // the first component of every pixel is alpha
+} DPXAlpha;
+
+// the pixel format the image is decoded to
+typedef struct _dpxPixelFormat {
+  size_t bitsPerComponent;
+  size_t bitsPerPixel;
+  bool bigEndian;        // the byte order of 16-bit components
+  bool floatComponents;  // half float components
+  DPXAlpha alpha;
+} DPXPixelFormat;
+
+// the largest number of source lines averaged for each line of a thumbnail
+#define kDPXThumbnailTaps 4
+
+// void DPXswap32(void *)
+// swaps the byte order of the 32-bit field, which doesn't have to be aligned
+void DPXswap32(void *field);
+
+// void DPXswapHeader(DPXImageHeader *)
+// converts all numeric fields of a header written in the opposite byte order to the host's
+void DPXswapHeader(DPXImageHeader *fileHeader);
+
+// void DPXmakeRegion(const DPXElement *, size_t, size_t, size_t, size_t, DPXRegion *)
+// fills in the region of the element covering the given rectangle, which has to be inside it
+void DPXmakeRegion(const DPXElement *element, size_t x, size_t y, size_t width, size_t height, DPXRegion *region);
+
+// bool DPXfindImageKernels(const DPXImageFile *, bool, DPXLineKernels *)
+// looks up the kernels the image is decoded with: those of image_element[0], which
+// the elements of all views share, or for planar images kernels without functions,
+// giving the components and precision of the interleaved pixels, as the planes are
+// unpacked with their own kernels.
+// returns false if the image can't be decoded at full size, or scaled if scaled is true
+bool DPXfindImageKernels(const DPXImageFile *file, bool scaled, DPXLineKernels *kernels);
+
+// DPXPixelFormat DPXpixelFormat(const DPXImageFile *, const DPXLineKernels *, DPXComponentFormat)
+// returns the pixel format of the image decoded to components of the given format
+// with the given kernels (see DPXfindImageKernels), or NULL kernels if its layout
+// isn't supported
+DPXPixelFormat DPXpixelFormat(const DPXImageFile *file, const DPXLineKernels *kernels, DPXComponentFormat format);
+
+// bool DPXlineKernelProduces(const DPXLineKernels *, DPXComponentFormat)
+// returns true if the line kernel converts to components of the given format
+// itself: 8-bit data to either 8-bit format, 10 and 12-bit data to truncated
+// 8-bit components, 16-bit data to 16-bit components and table kernels to both,
+// see DPXformatLineKernel
+bool DPXlineKernelProduces(const DPXLineKernels *kernels, DPXComponentFormat format);
+
+// DPXLineKernel DPXformatLineKernel(const DPXLineKernels *, DPXComponentFormat)
+// returns the line kernel producing the given format, line8 for 8-bit components
+// of kernels that have one and line otherwise
+DPXLineKernel DPXformatLineKernel(const DPXLineKernels *kernels, DPXComponentFormat format);
+
+// bool DPXdecodeRegion(const DPXImageFile *, const DPXLineKernels *, DPXComponentFormat, const DPXRegion *, uint8_t *, size_t)
+// decodes the region of the image to target, bytesPerRow apart, with the given kernels.
+// The parts of the region in different views are decoded from their own elements,
+// with the bands of all of them handed to the workers together.
+// Lines missing from the end of the file come out black.
+// returns false if there wasn't enough memory or the image's cancellation was cancelled
+bool DPXdecodeRegion(const DPXImageFile *file, const DPXLineKernels *kernels, DPXComponentFormat format, const DPXRegion *region, uint8_t *target, size_t bytesPerRow);
+
+// bool DPXreduceImage(const DPXImageFile *, const DPXLineKernels *, DPXComponentFormat, const DPXRegion *, size_t, size_t, uint8_t *, size_t)
+// scales a region of the image down to thumbwidth x thumbheight pixels of the given format
+// with the given kernels, averaging up to kDPXThumbnailTaps evenly spaced lines per pixel
+// returns false if the source lines couldn't be read or the image's cancellation was cancelled
+bool DPXreduceImage(const DPXImageFile *file, const DPXLineKernels *kernels, DPXComponentFormat format, const DPXRegion *region, size_t thumbwidth, size_t thumbheight, uint8_t *data, size_t bytesPerRow);
+
+// size_t DPXpickThumbnailLines(size_t, size_t, size_t *, size_t *)
+// picks the source lines averaged for each line of a thumbnail: thumbnail line y is the
+// average of sourceLines[firstTaps[y]] up to (excluding) sourceLines[firstTaps[y + 1]].
+// sourceLines needs thumbheight * kDPXThumbnailTaps entries, firstTaps thumbheight + 1.
+// returns the number of source lines, which are in ascending order
+size_t DPXpickThumbnailLines(size_t height, size_t thumbheight, size_t *sourceLines, size_t *firstTaps);
+
+// bool DPXreduceThumbnailLines(const DPXLineKernels *, const DPXPlaneSource *, size_t, DPXComponentFormat, bool, DPXCancellation, const size_t *, size_t, size_t, size_t, uint8_t *, size_t)
+// averages the source lines picked by DPXpickThumbnailLines of every plane, width pixels
+// long after the planes' skip pixels, into the thumbnail lines of the given format with
+// the given kernels. Single planes are averaged with kernels, planar images are
+// interleaved from their planes, see DPXfindImageKernels.
+// returns false if there wasn't enough memory or the cancellation was cancelled
+bool DPXreduceThumbnailLines(const DPXLineKernels *kernels, const DPXPlaneSource *planes, size_t planeCount, DPXComponentFormat format, bool swap, DPXCancellation cancellation, const size_t *firstTaps, size_t width, size_t thumbwidth, size_t thumbheight, uint8_t *data, size_t bytesPerRow);
+
+// void DPXrecordPath(const DPXImageFile *, DPXDecodePath, uint64_t)
+// records the image created from the file along the given path, see DPXmetricsRecordPath
+void DPXrecordPath(const DPXImageFile *file, DPXDecodePath path, uint64_t start);
+
+#endif  // QLDPX_DPXDECODERPRIVATE_H_
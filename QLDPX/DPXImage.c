@@ -7,360 +7,474 @@
 //  Copyright © 2019 Thomas Angarano. All rights reserved.
 //
 
+#include <copyfile.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <CoreFoundation/CoreFoundation.h>
 
 #include "DPXImage.h"
-
-#define MAX(X, Y) (((X) > (Y)) ? (X) : (Y))
-#define MIN(X, Y) (((X) < (Y)) ? (X) : (Y))
-
-typedef struct file_information
-{
-  UInt32 magic_num;      // magic number 0x53445058 (SDPX) or 0x58504453 (XPDS)
-  UInt32 offset;         // offset to image data in bytes
-  char vers[8];          // which header format version is being used (v1.0)
-  UInt32 file_size;      // file size in bytes
-  UInt32 ditto_key;      // read time short cut - 0 = same, 1 = new
-  UInt32 gen_hdr_size;   // generic header length in bytes
-  UInt32 ind_hdr_size;   // industry header length in bytes
-  UInt32 user_data_size; // user-defined data length in bytes
-  char file_name[100];   // image file name
-  char create_time[24];  // file creation date "yyyy:mm:dd:hh:mm:ss:LTZ"
-  char creator[100];     // file creator's name
-  char project[200];     // project name
-  char copyright[200];   // right to use or copyright info
-  UInt32 key;            // encryption ( FFFFFFFF = unencrypted )
-  char Reserved[104];    // reserved field TBD (need to pad)
-} FileInformation;
-
-typedef struct _image_information
-{
-  UInt16 orientation;         // image orientation */
-  UInt16 element_number;      // number of image elements */
-  UInt32 pixels_per_line;     // or x value */
-  UInt32 lines_per_image_ele; // or y value, per element */
-  struct _image_element
-  {
-    UInt32 data_sign;          // data sign (0 = unsigned, 1 = signed ) Note: "Core set images are unsigned"
-    UInt32 ref_low_data;       // reference low data code value
-    int ref_low_quantity;      // reference low quantity represented
-    UInt32 ref_high_data;      // reference high data code value
-    int ref_high_quantity;     // reference high quantity represented
-    UInt8 descriptor;          // descriptor for image element
-    UInt8 transfer;            // transfer characteristics for element
-    UInt8 colorimetric;        // colormetric specification for element
-    UInt8 bit_size;            // bit size for element
-    UInt16 packing;            // packing for element
-    UInt16 encoding;           // encoding for element
-    UInt32 data_offset;        // offset to data of element
-    UInt32 eol_padding;        // end of line padding used in element
-    UInt32 eo_image_padding;   // end of image padding used in element
-    char description[32];      // description of element
-  } image_element[8];          // NOTE THERE ARE EIGHT OF THESE
-
-  UInt8 reserved[52];          // reserved for future use (padding)
-} ImageInformation;
-
-typedef struct _image_orientation
-{
-  UInt32 x_offset;         // X offset
-  UInt32 y_offset;         // Y offset
-  int x_center;            // X center
-  int y_center;            // Y center
-  UInt32 x_orig_size;      // X original size
-  UInt32 y_orig_size;      // Y original size
-  char file_name[100];     // source image file name
-  char creation_time[24];  // source image creation date and time
-  char input_dev[32];      // input device name
-  char input_serial[32];   // input device serial number
-  UInt16 border[4];        // border validity (XL, XR, YT, YB)
-  UInt32 pixel_aspect[2];  // pixel aspect ratio (H:V)
-  UInt8 reserved[28];      // reserved for future use (padding)
-} ImageOrientation;
-
-typedef struct _motion_picture_film_header
-{
-  char film_mfg_id[2];    // film manufacturer ID code (2 digits from film edge code)
-  char film_type[2];      // file type (2 digits from film edge code)
-  char offset[2];         // offset in perfs (2 digits from film edge code)
-  char prefix[6];         // prefix (6 digits from film edge code)
-  char count[4];          // count (4 digits from film edge code)
-  char format[32];        // format (i.e. academy)
-  UInt32 frame_position;  // frame position in sequence
-  UInt32 sequence_len;    // sequence length in frames
-  UInt32 held_count;      // held count (1 = default)
-  int frame_rate;         // frame rate of original in frames/sec
-  int shutter_angle;      // shutter angle of camera in degrees
-  char frame_id[32];      // frame identification (i.e. keyframe)
-  char slate_info[100];   // slate information
-  UInt8 reserved[56];     // reserved for future use (padding)
-} MotionPictureFilm;
-
-typedef struct _television_header
-{
-  UInt32 time_code;       // SMPTE time code
-  UInt32 userBits;        // SMPTE user bits
-  UInt8 interlace;        // interlace ( 0 = noninterlaced, 1 = 2:1 interlace
-  UInt8 field_num;        // field number
-  UInt8 video_signal;     // video signal standard
-  UInt8 unused;           // used for byte alignment only
-  int hor_sample_rate;    // horizontal sampling rate in Hz
-  int ver_sample_rate;    // vertical sampling rate in Hz
-  int frame_rate;         // temporal sampling rate or frame rate in Hz
-  int time_offset;        // time offset from sync to first pixel
-  int gamma;              // gamma value
-  int black_level;        // black level code value
-  int black_gain;         // black gain
-  int break_point;        // breakpoint
-  int white_level;        // reference white level code value
-  int integration_times;  // integration time(s)
-  UInt8 reserved[76];     // reserved for future use (padding)
-} TelevisionHeader;
-
-typedef struct _dpxImageHeader {
-  FileInformation fileInformationHeader;
-  ImageInformation imageInformationHeader;
-  ImageOrientation imageOrientationHeader;
-  MotionPictureFilm mpfHeader;
-  TelevisionHeader tvHeader;
-} DPXImageHeader;
+#include "DPXBufferPool.h"
+#include "DPXDecoderPrivate.h"
+#include "DPXMetrics.h"
+#include "DPXUnpack.h"
 
 
+// releases the buffer of a decoded image, allocated by DPXallocateBuffer with
+// the size of the data provider, back to the buffer pool
 void freeDPXDataProviderMemory(void *info, const void *data, size_t size) {
-  free((void *)data);
+  DPXreleaseBuffer((void *)data, size);
+}
+
+
+bool isDPXFile(CFURLRef url) {
+  char path[PATH_MAX];
+  return CFURLGetFileSystemRepresentation(url, true, (UInt8 *)path, sizeof(path)) && isDPXFileAtPath(path);
 }
 
+
 DPXImage readDPXImage(CFURLRef url) {
-  
-  CFDataRef dpxFileData;
-  CFDictionaryRef dpxFileProperties;
-  CFArrayRef propertyRequest = CFArrayCreate(kCFAllocatorDefault, NULL, 0, NULL);
-  SInt32 errorCode = 0;
-  
-  if (!CFURLCreateDataAndPropertiesFromResource(kCFAllocatorDefault, url, &dpxFileData, &dpxFileProperties, propertyRequest, &errorCode)) {
-    CFRelease(propertyRequest);
+  return readDPXImageWithCancellation(url, NULL);
+}
+
+DPXImage readDPXImageWithCancellation(CFURLRef url, DPXCancellation cancellation) {
+  char path[PATH_MAX];
+  if (!CFURLGetFileSystemRepresentation(url, true, (UInt8 *)path, sizeof(path))) {
     return NULL;
   }
-  
-  if (CFDataGetLength(dpxFileData) < sizeof(DPXImageHeader)) {
-    // Not a dpx file: file is too small
-    CFRelease(dpxFileData);
-    CFRelease(dpxFileProperties);
-    CFRelease(propertyRequest);
-    return NULL;
+  return readDPXImageAtPath(path, cancellation);
+}
+
+
+CGSize DPXsize(const DPXImage image) {
+  if (!image) {
+    return CGSizeZero;
   }
-  
-  // release the objects we don't need anymore
-  CFRelease(dpxFileProperties);
-  CFRelease(propertyRequest);
-  
-  const DPXImageHeader *fileHeader = (const DPXImageHeader *)CFDataGetBytePtr(dpxFileData);
 
-  if ((fileHeader->fileInformationHeader.magic_num != 0x53445058) && (fileHeader->fileInformationHeader.magic_num != 0x58504453) && (fileHeader->fileInformationHeader.magic_num != 0x802A5FD7)) { // 0x802A5FD7 is for Cineon (.cin)
-    // not a DPX (or Cineon) file
-    CFRelease(dpxFileData);
+  const DPXImageFile *file = (const DPXImageFile *)image;
+  return CGSizeMake(file->width, file->height);
+}
 
-    return NULL;
+
+// luma images get a gray colour space, everything else RGB
+static CGColorSpaceRef DPXcreateColourSpace(size_t bitsPerComponent, size_t bitsPerPixel) {
+  return (bitsPerPixel == bitsPerComponent) ? CGColorSpaceCreateDeviceGray() : CGColorSpaceCreateDeviceRGB();
+}
+
+// returns the CGBitmapInfo of lines of the pixel format
+static CGBitmapInfo DPXbitmapInfo(const DPXPixelFormat *pixelFormat) {
+  CGBitmapInfo bitmapInfo = (pixelFormat->alpha == DPXAlphaLast) ? kCGImageAlphaLast : ((pixelFormat->alpha == DPXAlphaFirst) ? kCGImageAlphaFirst : kCGImageAlphaNone);
+  if (pixelFormat->bitsPerComponent == 16) {
+    bitmapInfo |= pixelFormat->bigEndian ? kCGBitmapByteOrder16Big : kCGBitmapByteOrder16Little;
   }
+  if (pixelFormat->floatComponents) {
+    bitmapInfo |= kCGBitmapFloatComponents;
+  }
+  return bitmapInfo;
+}
 
-  return dpxFileData;
+// returns true if the region of the image can be handed to CoreGraphics as it is
+// in the file: 8 or 16-bit data of a single element the kernels would only copy,
+// in either byte order, with every line of the region inside the file
+static bool DPXcanReferenceFile(const DPXImageFile *file, const DPXLineKernels *kernels, DPXComponentFormat format, const DPXRegion *region) {
+  const DPXElement *element = &file->elements[0];
+  if ((file->views > 1) || (file->planeCount > 1) || (element->packing != 0) || (element->bitSize != kernels->precision) || (kernels->components != element->components)) {
+    return false;
+  }
+
+  // packed 10 and 12-bit data has kernels of its own precision too, but always needs unpacking
+  if ((element->bitSize != 8) && (element->bitSize != 16)) {
+    return false;
+  }
+
+  return DPXlineKernelProduces(kernels, format) && (region->y + region->height <= element->lines);
 }
 
-void releaseDPXImage(DPXImage image) {
-  CFRelease(image);
+static void releaseDPXDataProviderImage(void *info, const void *data, size_t size) {
+  releaseDPXImage(info);
 }
 
-DPXImage DPXisValid(const DPXImage image) {
-  if (!image) {
+// returns a CGImage whose pixels are the region of image_element[0] in the file's
+// mapping, which the image keeps alive, see DPXcanReferenceFile.
+// returns NULL if the file has been truncated, as reading the missing pages would
+// raise SIGBUS. A file truncated after this check still does.
+static CGImageRef DPXcreateCGImageReferencingFile(const DPXImageFile *file, const DPXPixelFormat *pixelFormat, const DPXRegion *region) {
+  const DPXElement *element = &file->elements[0];
+  const size_t bytesPerPixel = pixelFormat->bitsPerPixel / 8;
+  const size_t offset = element->dataOffset + region->y * element->stride + region->x * bytesPerPixel;
+  const size_t length = (region->height - 1) * element->stride + region->width * bytesPerPixel;
+  struct stat fileStatus;
+  if ((fstat(file->fd, &fileStatus) != 0) || ((size_t)fileStatus.st_size < offset + length)) {
     return NULL;
   }
+  const UInt8 *data = file->bytes + offset;
 
-  const DPXImageHeader *fileHeader = (const DPXImageHeader *)CFDataGetBytePtr(image);
-  if ((fileHeader->fileInformationHeader.magic_num != 0x53445058) && (fileHeader->fileInformationHeader.magic_num != 0x58504453) && (fileHeader->fileInformationHeader.magic_num != 0x802A5FD7)) { // 0x802A5FD7 is for Cineon (.cin)
-    // not a DPX (or Cineon) file
+  __atomic_add_fetch(&((DPXImageFile *)file)->references, 1, __ATOMIC_RELAXED);
+  CGDataProviderRef imageDataProvider = CGDataProviderCreateWithData((void *)file, data, length, &releaseDPXDataProviderImage);
+  if (imageDataProvider == NULL) {
+    releaseDPXImage(file);
     return NULL;
   }
-  
-  return image;
+
+  CGColorSpaceRef colourSpace = DPXcreateColourSpace(pixelFormat->bitsPerComponent, pixelFormat->bitsPerPixel);
+  CGImageRef cgImage = CGImageCreate(region->width, region->height, pixelFormat->bitsPerComponent, pixelFormat->bitsPerPixel, element->stride, colourSpace, DPXbitmapInfo(pixelFormat), imageDataProvider, NULL, false, kCGRenderingIntentDefault);
+
+  CGColorSpaceRelease(colourSpace);
+  CGDataProviderRelease(imageDataProvider);
+
+  return cgImage;
 }
 
-const char* DPXcreator(const DPXImage image) {
-  if (!DPXisValid(image)) {
-    return "DPXImage: not a valid image";
+
+// returns a CGImage of the region of the image scaled down to width x height pixels
+// returns NULL if there wasn't enough memory or the image's cancellation was cancelled
+static CGImageRef DPXcreateCGImageOfRegion(const DPXImageFile *file, const DPXRegion *region, size_t width, size_t height, DPXComponentFormat format) {
+  if (DPXisCancelled(file->cancellation)) {
+    return NULL;
   }
-  
-  const DPXImageHeader *fileHeader = (const DPXImageHeader *)CFDataGetBytePtr(image);
 
-  return fileHeader->fileInformationHeader.creator;
-}
+  const uint64_t start = DPXmetricsNow();
+  const bool scaled = (width < region->width) || (height < region->height);
+
+  DPXLineKernels kernels;
+  const bool supported = DPXfindImageKernels(file, scaled, &kernels);
+
+  const DPXPixelFormat pixelFormat = DPXpixelFormat(file, supported ? &kernels : NULL, format);
+  const size_t bytesPerRow = pixelFormat.bitsPerPixel / 8 * width;
 
-size_t DPXwidth(const DPXImage image) {
-  if (!DPXisValid(image)) {
-    return 0;
+  // lines that would only be copied aren't decoded at all
+  if (supported && !scaled && DPXcanReferenceFile(file, &kernels, format, region)) {
+    CGImageRef cgImage = DPXcreateCGImageReferencingFile(file, &pixelFormat, region);
+    if (cgImage) {
+      DPXrecordPath(file, DPXPathReference, start);
+    }
+    return cgImage;
   }
-  
-  const DPXImageHeader *fileHeader = (const DPXImageHeader *)CFDataGetBytePtr(image);
-  UInt32 width = fileHeader->imageInformationHeader.pixels_per_line;
-  if (fileHeader->fileInformationHeader.magic_num == 0x58504453) {
-    width = CFSwapInt32(width);
+
+  // the decoders write every byte, only images without a kernel are left black
+  if ((bytesPerRow > 0) && (height > SIZE_MAX / bytesPerRow)) {
+    return NULL;
+  }
+  UInt8 *data = DPXallocateBuffer(height * bytesPerRow, !supported);
+  if (!data) {
+    return NULL;
   }
 
-  return width;
-}
+  bool failed = false;
+  const uint64_t decodeStart = DPXmetricsNow();
+  if (supported && scaled) {
+    failed = !DPXreduceImage(file, &kernels, format, region, width, height, data, bytesPerRow);
+    DPXmetricsRecordStage(DPXStageScale, decodeStart, file->path);
+  } else if (supported) {
+    // the region is about to be read front to back
+    posix_madvise((void *)file->bytes, file->length, POSIX_MADV_SEQUENTIAL);
+    failed = !DPXdecodeRegion(file, &kernels, format, region, data, bytesPerRow);
+    DPXmetricsRecordStage(DPXStageDecode, decodeStart, file->path);
+  }
+  if (failed) {
+    DPXreleaseBuffer(data, bytesPerRow * height);
+    return NULL;
+  }
 
-size_t DPXheight(const DPXImage image) {
-  if (!DPXisValid(image)) {
-    return 0;
+  const uint64_t createStart = DPXmetricsNow();
+  CGDataProviderRef imageDataProvider = CGDataProviderCreateWithData(NULL, data, bytesPerRow * height, &freeDPXDataProviderMemory);
+  if (imageDataProvider == NULL) {
+    DPXreleaseBuffer(data, bytesPerRow * height);
+    return NULL;
   }
-  
-  const DPXImageHeader *fileHeader = (const DPXImageHeader *)CFDataGetBytePtr(image);
-  UInt32 height = fileHeader->imageInformationHeader.lines_per_image_ele;
-  if (fileHeader->fileInformationHeader.magic_num == 0x58504453) {
-    height = CFSwapInt32(height);
+
+  CGColorSpaceRef colourSpace = DPXcreateColourSpace(pixelFormat.bitsPerComponent, pixelFormat.bitsPerPixel);
+  CGImageRef cgImage = CGImageCreate(width, height, pixelFormat.bitsPerComponent, pixelFormat.bitsPerPixel, bytesPerRow, colourSpace, DPXbitmapInfo(&pixelFormat), imageDataProvider, NULL, false, kCGRenderingIntentDefault);
+
+  CGColorSpaceRelease(colourSpace);
+  CGDataProviderRelease(imageDataProvider);
+
+  if (cgImage) {
+    DPXmetricsRecordStage(DPXStageCreateImage, createStart, file->path);
+    DPXrecordPath(file, !supported ? DPXPathUnsupported : (scaled ? DPXPathScale : DPXPathDecode), start);
   }
-  return height;
+  return cgImage;
 }
 
-CGSize DPXsize(const DPXImage image) {
-  return CGSizeMake(DPXwidth(image), DPXheight(image));
+// return a CGImage containing the image
+CGImageRef createCGImageFromDPX(const DPXImage image, DPXComponentFormat format) {
+  if (!image) {
+    return NULL;
+  }
+
+  const DPXImageFile *file = (const DPXImageFile *)image;
+  if (file->width == 0 || file->height == 0) {
+    return NULL;
+  }
+
+  DPXRegion region;
+  DPXmakeRegion(&file->elements[0], 0, 0, file->width, file->height, &region);
+  return DPXcreateCGImageOfRegion(file, &region, file->width, file->height, format);
 }
 
-// return a CGImage containing the image
-CGImageRef createCGImageFromDPX(const DPXImage image) {
-  if (!DPXisValid(image)) {
+CGImageRef createCGImageWithRectFromDPX(const DPXImage image, CGRect rect, CGFloat scale, DPXComponentFormat format) {
+  if (!image) {
     return NULL;
   }
 
-  const DPXImageHeader *fileHeader = (const DPXImageHeader *)CFDataGetBytePtr(image);
+  // the rectangle is cut to whole pixels inside the image
+  const DPXImageFile *file = (const DPXImageFile *)image;
+  rect = CGRectIntersection(CGRectIntegral(rect), CGRectMake(0, 0, file->width, file->height));
+  if (CGRectIsEmpty(rect) || !(scale > 0)) {
+    return NULL;
+  }
 
-  size_t width = DPXwidth(image);
-  size_t height = DPXheight(image);
+  DPXRegion region;
+  DPXmakeRegion(&file->elements[0], (size_t)rect.origin.x, (size_t)rect.origin.y, (size_t)rect.size.width, (size_t)rect.size.height, &region);
 
-  const UInt8 bitSize = fileHeader->imageInformationHeader.image_element[0].bit_size;
-  size_t bitsPerComponent = 8;
-  CGBitmapInfo  bitmapInfo = kCGBitmapByteOrderDefault;
-  if (bitSize == 16) {
-    bitsPerComponent = 16;
-    if (fileHeader->fileInformationHeader.magic_num == 0x58504453) {
-      bitmapInfo = kCGBitmapByteOrder16Little;
-    } else {
-      bitmapInfo = kCGBitmapByteOrder16Big;
-    }
+  // images are only ever scaled down, CoreGraphics scales up when drawing
+  const size_t width = (scale < 1) ? MAX((size_t)lround(region.width * scale), 1) : region.width;
+  const size_t height = (scale < 1) ? MAX((size_t)lround(region.height * scale), 1) : region.height;
+  return DPXcreateCGImageOfRegion(file, &region, width, height, format);
+}
+
+typedef struct _dpxCGImageStages {
+  const DPXImageFile *file;
+  DPXPixelFormat pixelFormat;
+  DPXCGImageStageCallback callback;
+  void *info;
+  UInt8 *data;  // the full size image, until its data provider takes it over
+  size_t length;
+  bool final;   // true once the full size image was passed on
+} DPXCGImageStages;
+
+// creates the CGImage of a stage of DPXdecodeProgressively and passes it on
+static void DPXpassCGImageStage(const DPXProgressiveStage *stage, void *info) {
+  DPXCGImageStages *stages = info;
+  const uint64_t createStart = DPXmetricsNow();
+
+  // the pixels of the coarse stage are freed after the call, so they are copied
+  const size_t length = stage->bytesPerRow * stage->height;
+  UInt8 *data = stage->final ? stages->data : DPXallocateBuffer(length, false);
+  if (!data) {
+    return;
   }
-  if (bitSize == 32) {
-    // 32 bits means float
-    bitsPerComponent = 32;
-    if (fileHeader->fileInformationHeader.magic_num == 0x58504453) {
-      bitmapInfo = kCGBitmapByteOrder32Little | kCGBitmapFloatComponents;
-    } else {
-      bitmapInfo = kCGBitmapByteOrder32Big | kCGBitmapFloatComponents;
-    }
- }
-
-  const UInt8 descriptor = fileHeader->imageInformationHeader.image_element[0].descriptor;
-  size_t components = 3;
-  if (descriptor >= 1 && descriptor <= 8) {
-    components = 1;
-  } else if ((bitSize != 10) && (bitSize != 12)) {
-      if (descriptor == 51) {
-      components = 4;
-      bitmapInfo |= kCGImageAlphaLast;
-    } else if (descriptor == 52) {
-      components = 4;
-      bitmapInfo |= kCGImageAlphaFirst;
+  if (!stage->final) {
+    memcpy(data, stage->pixels, length);
+  }
+
+  CGDataProviderRef imageDataProvider = CGDataProviderCreateWithData(NULL, data, length, &freeDPXDataProviderMemory);
+  if (imageDataProvider == NULL) {
+    if (!stage->final) {
+      DPXreleaseBuffer(data, length);
     }
+    return;
+  }
+  stages->data = stage->final ? NULL : stages->data;
+
+  const DPXPixelFormat *pixelFormat = &stages->pixelFormat;
+  CGColorSpaceRef colourSpace = DPXcreateColourSpace(pixelFormat->bitsPerComponent, pixelFormat->bitsPerPixel);
+  CGImageRef cgImage = CGImageCreate(stage->width, stage->height, pixelFormat->bitsPerComponent, pixelFormat->bitsPerPixel, stage->bytesPerRow, colourSpace, DPXbitmapInfo(pixelFormat), imageDataProvider, NULL, false, kCGRenderingIntentDefault);
+
+  CGColorSpaceRelease(colourSpace);
+  CGDataProviderRelease(imageDataProvider);
+
+  if (cgImage) {
+    DPXmetricsRecordStage(DPXStageCreateImage, createStart, stages->file->path);
+    stages->callback(cgImage, stage->final, stages->info);
+    stages->final = stage->final;
+    CGImageRelease(cgImage);
   }
-  
-  size_t bitsPerPixel = components * bitsPerComponent;
-  size_t bytesPerRow = bitsPerPixel / 8 * width;
-  CGColorSpaceRef colourSpace = CGColorSpaceCreateDeviceRGB();
+}
 
-  UInt32 padding = fileHeader->imageInformationHeader.image_element[0].eol_padding;
-  if (fileHeader->fileInformationHeader.magic_num == 0x58504453) {
-    padding = CFSwapInt32(padding);
+bool decodeCGImagesProgressivelyFromDPX(const DPXImage image, CGSize coarseSize, DPXComponentFormat format, DPXCGImageStageCallback callback, void *info) {
+  if (!image || !callback) {
+    return false;
   }
-  
-  UInt16 packing = fileHeader->imageInformationHeader.image_element[0].packing;
-  if (fileHeader->fileInformationHeader.magic_num == 0x58504453) {
-    packing = CFSwapInt16(packing);
+
+  const DPXImageFile *file = (const DPXImageFile *)image;
+  DPXLineKernels kernels;
+  if ((file->width == 0) || (file->height == 0) || !DPXfindImageKernels(file, false, &kernels)) {
+    return false;
   }
 
-  UInt8 *data = calloc(height, bytesPerRow);
+  const uint64_t start = DPXmetricsNow();
+  DPXCGImageStages stages = { file, DPXpixelFormat(file, &kernels, format), callback, info, NULL, 0, false };
+  const size_t bytesPerRow = stages.pixelFormat.bitsPerPixel / 8 * file->width;
+  if (file->height > SIZE_MAX / bytesPerRow) {
+    return false;
+  }
+  stages.length = bytesPerRow * file->height;
+  stages.data = DPXallocateBuffer(stages.length, false);
+  if (!stages.data) {
+    return false;
+  }
 
-  const UInt32 *sourceData = (const UInt32 *)CFDataGetBytePtr(image);
-  UInt32 offset = fileHeader->imageInformationHeader.image_element[0].data_offset;
-  if (fileHeader->fileInformationHeader.magic_num == 0x58504453) {
-    offset = CFSwapInt32(offset);
+  DPXdecodeProgressively(image, (size_t)coarseSize.width, (size_t)coarseSize.height, format, stages.data, bytesPerRow, DPXpassCGImageStage, &stages);
+  if (stages.data) {
+    DPXreleaseBuffer(stages.data, stages.length);
+  }
+  if (stages.final) {
+    DPXrecordPath(file, DPXPathDecode, start);
+  }
+  return stages.final;
+}
+
+bool DPXgetPixelFormat(const DPXImage image, DPXComponentFormat format, size_t *bitsPerComponent, size_t *bitsPerPixel, CGBitmapInfo *bitmapInfo) {
+  if (!image) {
+    return false;
   }
-  sourceData +=  offset / 4;
 
-  // extract image_element[0];
-  if (bitSize == 8 || bitSize == 16) {
-    memcpy(data, sourceData, height * bytesPerRow);
+  const DPXImageFile *file = (const DPXImageFile *)image;
+  DPXLineKernels kernels;
+  if (!DPXfindImageKernels(file, false, &kernels)) {
+    return false;
   }
-  if (bitSize == 10) {
-    for (size_t y = 0; y < height; y++) {
-      for (size_t x = 0; x < width; x++) {
-        if (packing == 1) { // 10-bit components filled
-          if (descriptor == 50) {  // RGB source image
 
-            UInt32 sourcePixel = sourceData[(y * width + x)];
-            if (fileHeader->fileInformationHeader.magic_num == 0x58504453) {
-              sourcePixel = CFSwapInt32(sourcePixel);
-            }
-            data[(y * width + x) * 3 + 0] = sourcePixel >> 24;
-            data[(y * width + x) * 3 + 1] = sourcePixel >> 14;
-            data[(y * width + x) * 3 + 2] = sourcePixel >> 4;
+  const DPXPixelFormat pixelFormat = DPXpixelFormat(file, &kernels, format);
+  *bitsPerComponent = pixelFormat.bitsPerComponent;
+  *bitsPerPixel = pixelFormat.bitsPerPixel;
+  *bitmapInfo = DPXbitmapInfo(&pixelFormat);
+  return true;
+}
 
-          } else if (descriptor == 51) {   // RGBA
 
-            const size_t targetIndex = (y * width + x) * 3;
+// Proxies
+//
+// DPXwriteProxy embeds a thumbnail, the proxy, into the file's user-defined data:
+// a DPXProxyHeader in the file's byte order followed by the unpadded pixels.
+// A proxy is only used if its checksum matches and the image data it was
+// created from is unchanged.
+
+#define kDPXProxyUserID "QLDPX proxy"
+#define kDPXProxyMagic 0x50585044  // "DPXP"
+#define kDPXProxyVersion 2  // version 1 proxies don't know the image data they were created from
+
+// the number and length of the samples of the image data, see DPXimageDataChecksum
+#define kDPXProxySamples 16
+#define kDPXProxySampleLength 4096
+
+typedef struct _dpxProxyHeader {
+  char userID[32];      // user identification of the user-defined data, kDPXProxyUserID
+  UInt32 magic;
+  UInt32 version;
+  UInt32 width;
+  UInt32 height;
+  UInt32 bitsPerPixel;  // 8, 24 or 32 bits of 8-bit components
+  UInt32 bitmapInfo;    // CGBitmapInfo of the pixels
+  UInt32 format;        // the DPXComponentFormat the proxy was created with
+  UInt32 checksum;      // see DPXproxyChecksum
+  UInt32 imageOffset;   // the offset of the image data the proxy was created from
+  UInt32 imageLength;   // its length up to the end of the file
+  UInt32 imageChecksum; // see DPXimageDataChecksum
+} DPXProxyHeader;
+
+// returns the 32-bit FNV-1a hash of the proxy's pixels
+static UInt32 DPXproxyChecksum(const UInt8 *pixels, size_t length) {
+  UInt32 hash = 2166136261u;
+  for (size_t i = 0; i < length; i++) {
+    hash = (hash ^ pixels[i]) * 16777619u;
+  }
+  return hash;
+}
 
-            // calculate the index of this pixel's R component in the source data
-            const size_t componentBaseIndex = (y * width + x) * 4;  // 4 components per source pixel
+// returns the offset of the user-defined data, which follows the generic and industry headers
+static size_t DPXuserDataOffset(const DPXImageFile *file) {
+  const FileInformation *fileInformation = &file->header.fileInformationHeader;
+  const size_t headerSize = (size_t)fileInformation->gen_hdr_size + fileInformation->ind_hdr_size;
+  if ((fileInformation->gen_hdr_size == 0xFFFFFFFF) || (fileInformation->ind_hdr_size == 0xFFFFFFFF) || (headerSize < sizeof(DPXImageHeader))) {
+    return sizeof(DPXImageHeader);
+  }
+  return headerSize;
+}
 
-            for (size_t component = 0; component < 3; component++) {
+// returns the size of the user-defined data, 0 if there is none
+static size_t DPXuserDataSize(const DPXImageFile *file) {
+  const UInt32 userDataSize = file->header.fileInformationHeader.user_data_size;
+  return (userDataSize == 0xFFFFFFFF) ? 0 : userDataSize;
+}
 
-              const size_t sourceIndex = (componentBaseIndex + component) / 3;  // 1 32bit source pixel holds 3 10bit components
-              const size_t shift = 24 - ((componentBaseIndex + component) % 3) * 10;
+// returns the offset of the image data, which starts at the first element
+static size_t DPXimageDataOffset(const DPXImageFile *file) {
+  size_t imageOffset = file->header.fileInformationHeader.offset;
+  for (size_t i = 0; i < file->elementCount; i++) {
+    imageOffset = MIN(imageOffset, file->elements[i].dataOffset);
+  }
+  return imageOffset;
+}
 
-              UInt32 sourceWord = sourceData[sourceIndex];
-              if (fileHeader->fileInformationHeader.magic_num == 0x58504453) {
-                sourceWord = CFSwapInt32(sourceWord);
-              }
+// returns the checksum of kDPXProxySamples samples spread evenly over the image data
+// from imageOffset to the end of the file, see DPXproxyChecksum
+static UInt32 DPXimageDataChecksum(const DPXImageFile *file, size_t imageOffset) {
+  const size_t length = file->length - imageOffset;
+  const size_t sampleLength = MIN(length, (size_t)kDPXProxySampleLength);
+  UInt32 hash = 0;
+  for (size_t sample = 0; sample < kDPXProxySamples; sample++) {
+    const size_t offset = (length - sampleLength) / (kDPXProxySamples - 1) * sample;
+    hash = hash * 31 + DPXproxyChecksum(file->bytes + imageOffset + offset, sampleLength);
+  }
+  return hash;
+}
 
-              data[targetIndex + component] = sourceWord >> shift;
-            }
-          }
-        }
-      }
-    }
+// returns true if the file's user-defined data was written by DPXwriteProxy, of any version
+static bool DPXhasProxyUserData(const DPXImageFile *file) {
+  const size_t offset = DPXuserDataOffset(file);
+  return (DPXuserDataSize(file) >= sizeof(kDPXProxyUserID)) && (offset + sizeof(kDPXProxyUserID) <= file->length) &&
+         (strncmp((const char *)file->bytes + offset, kDPXProxyUserID, sizeof(kDPXProxyUserID)) == 0);
+}
+
+// returns the proxy's header in host byte order if the file's user-defined data
+// starts with one, see DPXwriteProxy, with pixels that are inside the file, created
+// from the image data the file holds
+static bool DPXreadProxyHeader(const DPXImageFile *file, DPXProxyHeader *proxyHeader) {
+  const size_t offset = DPXuserDataOffset(file);
+  const size_t userDataSize = DPXuserDataSize(file);
+  if ((file->header.fileInformationHeader.magic_num != 0x53445058) || (userDataSize < sizeof(DPXProxyHeader)) || (offset + userDataSize > file->length)) {
+    return false;
   }
-  if (bitSize == 12) {
-    if (packing == 1) {
-      const size_t length = width * height * 3 / 2; // (3 words per 2 pixels)
-      size_t dataIndex = 0;
-      
-      for (size_t i = 0; i < length; i++) {
-        UInt32 sourceWord = sourceData[i];
-        if (fileHeader->fileInformationHeader.magic_num == 0x58504453) {
-          sourceWord = CFSwapInt32(sourceWord);
-        }
-
-        data[dataIndex++] = sourceWord  >> 24;
-        data[dataIndex++] = sourceWord >> 8;
-      }
+
+  memcpy(proxyHeader, file->bytes + offset, sizeof(DPXProxyHeader));
+  if (strncmp(proxyHeader->userID, kDPXProxyUserID, sizeof(proxyHeader->userID)) != 0) {
+    return false;
+  }
+  if (file->swapped) {
+    for (UInt32 *field = &proxyHeader->magic; field <= &proxyHeader->imageChecksum; field++) {
+      DPXswap32(field);
     }
   }
 
-  CGDataProviderRef imageDataProvider = CGDataProviderCreateWithData(NULL, data, bytesPerRow * height, &freeDPXDataProviderMemory);
+  const UInt32 bitsPerPixel = proxyHeader->bitsPerPixel;
+  const size_t imageOffset = DPXimageDataOffset(file);
+  return (proxyHeader->magic == kDPXProxyMagic) && (proxyHeader->version == kDPXProxyVersion) &&
+         ((bitsPerPixel == 8) || (bitsPerPixel == 24) || (bitsPerPixel == 32)) &&
+         ((size_t)proxyHeader->width * proxyHeader->height * (bitsPerPixel / 8) <= userDataSize - sizeof(DPXProxyHeader)) &&
+         (proxyHeader->imageOffset == imageOffset) && (imageOffset < file->length) && (proxyHeader->imageLength == file->length - imageOffset) &&
+         (proxyHeader->imageChecksum == DPXimageDataChecksum(file, imageOffset));
+}
+
+// returns the proxy embedded in the file as a CGImage referencing the mapping if it was
+// created with the given format and has at least width x height pixels, or NULL
+static CGImageRef DPXcreateProxyCGImage(const DPXImageFile *file, DPXComponentFormat format, size_t width, size_t height) {
+  DPXProxyHeader proxyHeader;
+  if (!DPXreadProxyHeader(file, &proxyHeader) || (proxyHeader.format != format) || (proxyHeader.width < width) || (proxyHeader.height < height)) {
+    return NULL;
+  }
+
+  const size_t bytesPerRow = proxyHeader.width * (proxyHeader.bitsPerPixel / 8);
+  const UInt8 *pixels = file->bytes + DPXuserDataOffset(file) + sizeof(DPXProxyHeader);
+  if (DPXproxyChecksum(pixels, bytesPerRow * proxyHeader.height) != proxyHeader.checksum) {
+    return NULL;
+  }
+
+  __atomic_add_fetch(&((DPXImageFile *)file)->references, 1, __ATOMIC_RELAXED);
+  CGDataProviderRef imageDataProvider = CGDataProviderCreateWithData((void *)file, pixels, bytesPerRow * proxyHeader.height, &releaseDPXDataProviderImage);
   if (imageDataProvider == NULL) {
-    CGColorSpaceRelease(colourSpace);
+    releaseDPXImage(file);
     return NULL;
   }
 
-  CGImageRef cgImage = CGImageCreate(width, height, bitsPerComponent, bitsPerPixel, bytesPerRow, colourSpace, bitmapInfo, imageDataProvider, NULL, false, kCGRenderingIntentDefault);
+  CGColorSpaceRef colourSpace = DPXcreateColourSpace(8, proxyHeader.bitsPerPixel);
+  CGImageRef cgImage = CGImageCreate(proxyHeader.width, proxyHeader.height, 8, proxyHeader.bitsPerPixel, bytesPerRow, colourSpace, proxyHeader.bitmapInfo, imageDataProvider, NULL, false, kCGRenderingIntentDefault);
 
   CGColorSpaceRelease(colourSpace);
   CGDataProviderRelease(imageDataProvider);
@@ -368,185 +482,296 @@ CGImageRef createCGImageFromDPX(const DPXImage image) {
   return cgImage;
 }
 
+CGSize DPXthumbnailSize(CGSize imageSize, CGSize size) {
+  size_t thumbwidth, thumbheight;
+  DPXthumbnailDimensions((size_t)imageSize.width, (size_t)imageSize.height, size.width, size.height, &thumbwidth, &thumbheight);
+
+  return CGSizeMake(thumbwidth, thumbheight);
+}
+
+static CGImageRef DPXcreateThumbnailOfRendition(CGImageRef rendition, CGSize imageSize, CGSize size, uint64_t start);
+
 // return a CGImage with a specified size containing the image
-// caution: this is meant to be used to create thumbnails and uses a very simple scaling algorithm
-CGImageRef createThumbnailCGImageWithSizeFromDPX(const DPXImage image, CGSize size) {
-  if (!DPXisValid(image)) {
+// the image is scaled down with an area average, see DPXreduceImage
+CGImageRef createThumbnailCGImageWithSizeFromDPX(const DPXImage image, CGSize size, DPXComponentFormat format) {
+  if (!image) {
     return NULL;
   }
-  
-  const DPXImageHeader *fileHeader = (const DPXImageHeader *)CFDataGetBytePtr(image);
-  
-  size_t width = DPXwidth(image);
-  size_t height = DPXheight(image);
-  
-  if (width <= size.width && height <= size.height) return createCGImageFromDPX(image);
-  
-  CGFloat scale = fmax((CGFloat)width / (size.width - 1.0f), (CGFloat)height / (size.height - 1.0f));
-
-  size_t thumbwidth = (size_t)(width / scale) + 1;
-  size_t thumbheight = (size_t)(height / scale) + 1;
-
-  // a simple 'close neighbour' scaling should be fine for thumbnails
-  
-  const UInt8 bitSize = fileHeader->imageInformationHeader.image_element[0].bit_size;
-  size_t bitsPerComponent = 8;
-  CGBitmapInfo  bitmapInfo = kCGBitmapByteOrderDefault;
-  if (bitSize == 16) {
-    bitsPerComponent = 16;
-    if (fileHeader->fileInformationHeader.magic_num == 0x58504453) {
-      bitmapInfo = kCGBitmapByteOrder16Little;
-    } else {
-      bitmapInfo = kCGBitmapByteOrder16Big;
+
+  const DPXImageFile *file = (const DPXImageFile *)image;
+  if (file->width <= size.width && file->height <= size.height) return createCGImageFromDPX(image, format);
+
+  size_t thumbwidth, thumbheight;
+  DPXthumbnailDimensions(file->width, file->height, size.width, size.height, &thumbwidth, &thumbheight);
+
+  // an embedded proxy large enough for the thumbnail saves decoding the image
+  const uint64_t start = DPXmetricsNow();
+  CGImageRef proxy = DPXcreateProxyCGImage(file, format, thumbwidth, thumbheight);
+  if (proxy) {
+    CGImageRef thumbnail = DPXcreateThumbnailOfRendition(proxy, CGSizeMake(file->width, file->height), size, 0);
+    CGImageRelease(proxy);
+    if (thumbnail) {
+      DPXrecordPath(file, DPXPathProxy, start);
+      return thumbnail;
     }
   }
-  if (bitSize == 32) {
-    // 32 bits means float
-    bitsPerComponent = 32;
-    if (fileHeader->fileInformationHeader.magic_num == 0x58504453) {
-      bitmapInfo = kCGBitmapByteOrder32Little;
-    } else {
-      bitmapInfo = kCGBitmapByteOrder32Big;
-    }
+
+  DPXRegion region;
+  DPXmakeRegion(&file->elements[0], 0, 0, file->width, file->height, &region);
+  return DPXcreateCGImageOfRegion(file, &region, thumbwidth, thumbheight, format);
+}
+
+CGImageRef createThumbnailCGImageWithSizeFromRendition(CGImageRef rendition, CGSize imageSize, CGSize size) {
+  return DPXcreateThumbnailOfRendition(rendition, imageSize, size, DPXmetricsNow());
+}
+
+// reduces the rendition like createThumbnailCGImageWithSizeFromRendition, which
+// is recorded in the metrics as the rendition path started at start unless it's 0
+static CGImageRef DPXcreateThumbnailOfRendition(CGImageRef rendition, CGSize imageSize, CGSize size, uint64_t start) {
+  if (rendition == NULL) {
+    return NULL;
   }
-  
-  const UInt8 descriptor = fileHeader->imageInformationHeader.image_element[0].descriptor;
-  size_t components = 3;
-  if (descriptor >= 1 && descriptor <= 8) {
-    components = 1;
-  } else if ((bitSize != 10) && (bitSize != 12)) {
-    if (descriptor == 51) {
-      components = 4;
-      bitmapInfo |= kCGImageAlphaLast;
-    } else if (descriptor == 52) {
-      components = 4;
-      bitmapInfo |= kCGImageAlphaFirst;
-    }
+
+  const size_t width = CGImageGetWidth(rendition);
+  const size_t height = CGImageGetHeight(rendition);
+
+  size_t thumbwidth, thumbheight;
+  DPXthumbnailDimensions((size_t)imageSize.width, (size_t)imageSize.height, size.width, size.height, &thumbwidth, &thumbheight);
+  if ((thumbwidth == width) && (thumbheight == height)) {
+    return CGImageRetain(rendition);
+  }
+  if ((thumbwidth > width) || (thumbheight > height)) {
+    return NULL;
   }
 
-  
-  size_t bitsPerPixel = components * bitsPerComponent;
-  size_t bytesPerRow = bitsPerPixel / 8 * thumbwidth;
-  CGColorSpaceRef colourSpace = CGColorSpaceCreateDeviceRGB();
-  
-  UInt32 padding = fileHeader->imageInformationHeader.image_element[0].eol_padding;
-  if (fileHeader->fileInformationHeader.magic_num == 0x58504453) {
-    padding = CFSwapInt32(padding);
+  // renditions hold 8 or 16-bit integer components, so they are reduced with the kernels
+  // of an 8 or 16-bit DPX image with the same components to the same format;
+  // half float renditions aren't reduced
+  const CGBitmapInfo bitmapInfo = CGImageGetBitmapInfo(rendition);
+  const size_t bitsPerComponent = CGImageGetBitsPerComponent(rendition);
+  const size_t bitsPerPixel = CGImageGetBitsPerPixel(rendition);
+  const size_t components = bitsPerPixel / bitsPerComponent;
+  const UInt8 descriptor = (components == 1) ? 6 : ((components == 4) ? 51 : 50);
+  const DPXComponentFormat format = (bitsPerComponent == 16) ? DPXComponentFormat16 : DPXComponentFormat8;
+  const bool bigEndian = (bitmapInfo & kCGBitmapByteOrderMask) == kCGBitmapByteOrder16Big;
+  const bool byteSwapped = (bitsPerComponent == 16) && (bigEndian != (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__));
+
+  DPXLineKernels kernels;
+  if (((bitsPerComponent != 8) && (bitsPerComponent != 16)) || (bitmapInfo & kCGBitmapFloatComponents) || !DPXfindLineKernels((UInt8)bitsPerComponent, 0, descriptor, byteSwapped, &kernels) || !kernels.accumulateLine || (kernels.components != components)) {
+    return NULL;
   }
-  
-  UInt16 packing = fileHeader->imageInformationHeader.image_element[0].packing;
-  if (fileHeader->fileInformationHeader.magic_num == 0x58504453) {
-    packing = CFSwapInt16(packing);
+
+  CFDataRef pixels = CGDataProviderCopyData(CGImageGetDataProvider(rendition));
+  if (pixels == NULL) {
+    return NULL;
   }
-  
-  UInt8 *data = calloc(thumbheight, bytesPerRow);
-  
-  const UInt32 *sourceData = (const UInt32 *)CFDataGetBytePtr(image);
-  UInt32 offset = fileHeader->imageInformationHeader.image_element[0].data_offset;
-  if (fileHeader->fileInformationHeader.magic_num == 0x58504453) {
-    offset = CFSwapInt32(offset);
+
+  const size_t sourceBytesPerRow = CGImageGetBytesPerRow(rendition);
+  const size_t bytesPerRow = bitsPerPixel / 8 * thumbwidth;
+  // every byte of the thumbnail is written by the reduction
+  UInt8 *data = DPXallocateBuffer(thumbheight * bytesPerRow, false);
+  size_t *sourceLines = malloc(thumbheight * kDPXThumbnailTaps * sizeof(size_t));
+  size_t *firstTaps = malloc((thumbheight + 1) * sizeof(size_t));
+  const UInt8 **sourceLinePointers = malloc(thumbheight * kDPXThumbnailTaps * sizeof(UInt8 *));
+
+  bool reduced = false;
+  if (data && sourceLines && firstTaps && sourceLinePointers && ((size_t)CFDataGetLength(pixels) >= sourceBytesPerRow * height)) {
+    const size_t lineCount = DPXpickThumbnailLines(height, thumbheight, sourceLines, firstTaps);
+    for (size_t i = 0; i < lineCount; i++) {
+      sourceLinePointers[i] = CFDataGetBytePtr(pixels) + sourceLines[i] * sourceBytesPerRow;
+    }
+
+    const DPXPlaneSource plane = { &kernels, NULL, 0, sourceLinePointers, 0 };
+    const uint64_t scaleStart = DPXmetricsNow();
+    reduced = DPXreduceThumbnailLines(&kernels, &plane, 1, format, byteSwapped, NULL, firstTaps, width, thumbwidth, thumbheight, data, bytesPerRow);
+    DPXmetricsRecordStage(DPXStageScale, scaleStart, NULL);
   }
-  sourceData +=  offset / 4;
 
-  // extract image_element[0];
-  if (bitSize == 8 || bitSize == 16) {
+  free(sourceLines);
+  free(firstTaps);
+  free(sourceLinePointers);
+  CFRelease(pixels);
 
-    for (size_t y = 0; y < thumbheight; y++) {
-      for (size_t x = 0; x < thumbwidth; x++) {
+  if (!reduced) {
+    DPXreleaseBuffer(data, bytesPerRow * thumbheight);
+    return NULL;
+  }
 
-        const size_t targetIndex = (y * thumbwidth + x) * components;
-        const size_t sourceIndex = (MIN((size_t)(y * scale), height - 1) * width + MIN((size_t)(x * scale), width - 1)) * components;
+  const uint64_t createStart = DPXmetricsNow();
+  CGDataProviderRef imageDataProvider = CGDataProviderCreateWithData(NULL, data, bytesPerRow * thumbheight, &freeDPXDataProviderMemory);
+  if (imageDataProvider == NULL) {
+    DPXreleaseBuffer(data, bytesPerRow * thumbheight);
+    return NULL;
+  }
 
-        for (size_t component = 0; component < components; component++) {
-          if (bitSize == 8) {
+  CGColorSpaceRef colourSpace = DPXcreateColourSpace(bitsPerComponent, bitsPerPixel);
+  CGImageRef cgImage = CGImageCreate(thumbwidth, thumbheight, bitsPerComponent, bitsPerPixel, bytesPerRow, colourSpace, bitmapInfo, imageDataProvider, NULL, false, kCGRenderingIntentDefault);
 
-            const UInt8 *sourceData8 = (const UInt8 *)sourceData;
-            data[targetIndex + component] = sourceData8[sourceIndex + component];
+  CGColorSpaceRelease(colourSpace);
+  CGDataProviderRelease(imageDataProvider);
 
-          } else if (bitSize == 16) {
+  if (cgImage) {
+    DPXmetricsRecordStage(DPXStageCreateImage, createStart, NULL);
+    DPXmetricsRecordPath(DPXPathRendition, (UInt8)bitsPerComponent, 0, descriptor, start, NULL);
+  }
+  return cgImage;
+}
 
-            UInt16 *data16 = (UInt16 *)data;
-            const UInt16 *sourceData16 = (const UInt16 *)sourceData;
-            data16[targetIndex + component] = sourceData16[sourceIndex + component];
-          }
-        }
-      }
+// writes length bytes to fd, returns false if not all of them could be written
+static bool DPXwriteAll(int fd, const void *bytes, size_t length) {
+  while (length > 0) {
+    const ssize_t written = write(fd, bytes, length);
+    if (written <= 0) {
+      return false;
     }
+    bytes = (const UInt8 *)bytes + written;
+    length -= (size_t)written;
   }
-  if (bitSize == 10) {
+  return true;
+}
 
-    for (size_t y = 0; y < thumbheight; y++) {
-      for (size_t x = 0; x < thumbwidth; x++) {
-        if (packing == 1) { // 10-bit components filled
-          if (descriptor == 50) {
+// the alignment of the image data of files that have to be rewritten to make room for a proxy
+#define kDPXProxyImageAlignment 4096
 
-            UInt32 sourcePixel = sourceData[MIN((size_t)(y * scale), height - 1) * width + MIN((size_t)(x * scale), width - 1)];
+bool DPXwriteProxy(CFURLRef url, CGSize size, DPXComponentFormat format) {
+  if ((format != DPXComponentFormat8) && (format != DPXComponentFormat8Dithered)) {
+    return false;
+  }
 
-            if (fileHeader->fileInformationHeader.magic_num == 0x58504453) {
-              sourcePixel = CFSwapInt32(sourcePixel);
-            }
+  char path[PATH_MAX];
+  if (!CFURLGetFileSystemRepresentation(url, true, (UInt8 *)path, sizeof(path))) {
+    return false;
+  }
 
-            data[(y * thumbwidth + x) * 3 + 0] = sourcePixel >> 24;
-            data[(y * thumbwidth + x) * 3 + 1] = sourcePixel >> 14;
-            data[(y * thumbwidth + x) * 3 + 2] = sourcePixel >> 4;
+  DPXImage image = readDPXImage(url);
+  if (!image) {
+    return false;
+  }
 
-          } else if (descriptor == 51) { // RGBA
-            const size_t targetIndex = (y * thumbwidth + x) * 3;  // 3 components in the target image
+  // Cineon headers have a different layout, and user-defined data written by other software is kept
+  const DPXImageFile *file = (const DPXImageFile *)image;
+  DPXProxyHeader proxyHeader;
+  const size_t userDataOffset = DPXuserDataOffset(file);
+  if ((file->header.fileInformationHeader.magic_num != 0x53445058) || (file->width == 0) || (file->height == 0) ||
+      ((DPXuserDataSize(file) > 0) && !DPXhasProxyUserData(file))) {
+    releaseDPXImage(image);
+    return false;
+  }
 
-            // calculate the index of this pixel's R component in the source data
-            const size_t componentBaseIndex = (MIN((size_t)(y * scale), height - 1) * width + MIN((size_t)(x * scale), width - 1)) * 4;  // 4 components per source pixel
+  // the proxy has to fit in front of the image data
+  const size_t imageOffset = DPXimageDataOffset(file);
+  if ((imageOffset < userDataOffset) || (imageOffset >= file->length)) {
+    releaseDPXImage(image);
+    return false;
+  }
 
-            for (size_t component = 0; component < 3; component++) {
-              const size_t sourceIndex = (componentBaseIndex + component) / 3;  // 1 32bit source pixel holds 3 10bit components
-              const size_t shift = 24 - ((componentBaseIndex + component) % 3) * 10;
+  // the proxy is created from the image data, not from an older proxy
+  size_t thumbwidth, thumbheight;
+  DPXthumbnailDimensions(file->width, file->height, size.width, size.height, &thumbwidth, &thumbheight);
+  DPXRegion region;
+  DPXmakeRegion(&file->elements[0], 0, 0, file->width, file->height, &region);
+  CGImageRef thumbnail = DPXcreateCGImageOfRegion(file, &region, thumbwidth, thumbheight, format);
+  CFDataRef pixels = thumbnail ? CGDataProviderCopyData(CGImageGetDataProvider(thumbnail)) : NULL;
+
+  const size_t bitsPerPixel = thumbnail ? CGImageGetBitsPerPixel(thumbnail) : 0;
+  const size_t bytesPerRow = thumbwidth * (bitsPerPixel / 8);
+  const size_t userDataSize = sizeof(DPXProxyHeader) + bytesPerRow * thumbheight;
+  UInt8 *userData = pixels ? calloc(1, userDataSize) : NULL;
+  if (!userData || (CGImageGetBitsPerComponent(thumbnail) != 8) || ((size_t)CFDataGetLength(pixels) < CGImageGetBytesPerRow(thumbnail) * (thumbheight - 1) + bytesPerRow)) {
+    free(userData);
+    if (pixels) {
+      CFRelease(pixels);
+    }
+    CGImageRelease(thumbnail);
+    releaseDPXImage(image);
+    return false;
+  }
 
-              UInt32 sourceWord = sourceData[sourceIndex];
-              if (fileHeader->fileInformationHeader.magic_num == 0x58504453) {
-                sourceWord = CFSwapInt32(sourceWord);
-              }
+  for (size_t y = 0; y < thumbheight; y++) {
+    memcpy(userData + sizeof(DPXProxyHeader) + y * bytesPerRow, CFDataGetBytePtr(pixels) + y * CGImageGetBytesPerRow(thumbnail), bytesPerRow);
+  }
 
-              data[targetIndex + component] = sourceWord >> shift;
-            }
-          }
-        }
-      }
+  // files with room for the proxy in front of the image data are updated in place,
+  // the others are rewritten with the image data moved back, and replace the original
+  const bool inPlace = (userDataOffset + userDataSize <= imageOffset);
+  const size_t newImageOffset = inPlace ? imageOffset : (userDataOffset + userDataSize + kDPXProxyImageAlignment - 1) / kDPXProxyImageAlignment * kDPXProxyImageAlignment;
+  const size_t shift = newImageOffset - imageOffset;
+
+  memset(&proxyHeader, 0, sizeof(proxyHeader));
+  strncpy(proxyHeader.userID, kDPXProxyUserID, sizeof(proxyHeader.userID));
+  proxyHeader.magic = kDPXProxyMagic;
+  proxyHeader.version = kDPXProxyVersion;
+  proxyHeader.width = (UInt32)thumbwidth;
+  proxyHeader.height = (UInt32)thumbheight;
+  proxyHeader.bitsPerPixel = (UInt32)bitsPerPixel;
+  proxyHeader.bitmapInfo = CGImageGetBitmapInfo(thumbnail);
+  proxyHeader.format = format;
+  proxyHeader.checksum = DPXproxyChecksum(userData + sizeof(DPXProxyHeader), bytesPerRow * thumbheight);
+  proxyHeader.imageOffset = (UInt32)newImageOffset;
+  proxyHeader.imageLength = (UInt32)(file->length - imageOffset);
+  proxyHeader.imageChecksum = DPXimageDataChecksum(file, imageOffset);
+  if (file->swapped) {
+    for (UInt32 *field = &proxyHeader.magic; field <= &proxyHeader.imageChecksum; field++) {
+      DPXswap32(field);
     }
   }
-  if (bitSize == 12) {
-    if (packing == 1) {
-      for (size_t y = 0; y < thumbheight; y++) {
-        for (size_t x = 0; x < thumbwidth; x++) {
-          const size_t targetIndex = (y * thumbwidth + x) * 3;
-
-          // calculate the index of this pixel's R component in the source data
-          const size_t componentBaseIndex = (MIN((size_t)(y * scale), height - 1) * width + MIN((size_t)(x * scale), width - 1)) * 3;
-          
-          for (size_t component = 0; component < 3; component++) {
-            const size_t sourceIndex = (componentBaseIndex + component) / 2;  // 1 32bit source word holds 2 12bit components
-            const size_t shift = ((componentBaseIndex + component) % 2 == 0) ? 24 : 8;
-
-            UInt32 sourceWord = sourceData[sourceIndex];
-            if (fileHeader->fileInformationHeader.magic_num == 0x58504453) {
-              sourceWord = CFSwapInt32(sourceWord);
-            }
-
-            data[targetIndex + component] = sourceWord >> shift;
-          }
-        }
+  memcpy(userData, &proxyHeader, sizeof(proxyHeader));
+  CFRelease(pixels);
+  CGImageRelease(thumbnail);
+
+  DPXImageHeader header;
+  memcpy(&header, file->bytes, sizeof(header));
+  if (file->swapped) {
+    DPXswapHeader(&header);
+  }
+  header.fileInformationHeader.user_data_size = (UInt32)userDataSize;
+  if (!inPlace) {
+    header.fileInformationHeader.offset += (UInt32)shift;
+    header.fileInformationHeader.file_size = (UInt32)(file->length + shift);
+    for (size_t i = 0; i < 8; i++) {
+      UInt32 *dataOffset = &header.imageInformationHeader.image_element[i].data_offset;
+      if ((*dataOffset != 0xFFFFFFFF) && (*dataOffset >= imageOffset)) {
+        *dataOffset += (UInt32)shift;
       }
     }
   }
-  
-  CGDataProviderRef imageDataProvider = CGDataProviderCreateWithData(NULL, data, bytesPerRow * thumbheight, &freeDPXDataProviderMemory);
-  if (imageDataProvider == NULL) {
-    CGColorSpaceRelease(colourSpace);
-    return NULL;
+  if (file->swapped) {
+    DPXswapHeader(&header);
   }
-  
-  CGImageRef cgImage = CGImageCreate(thumbwidth, thumbheight, bitsPerComponent, bitsPerPixel, bytesPerRow, colourSpace, bitmapInfo, imageDataProvider, NULL, false, kCGRenderingIntentDefault);
-  
-  CGColorSpaceRelease(colourSpace);
-  CGDataProviderRelease(imageDataProvider);
-  
-  return cgImage;
+
+  bool written = false;
+  if (inPlace) {
+    const int fd = open(path, O_WRONLY);
+    if (fd >= 0) {
+      written = (pwrite(fd, userData, userDataSize, (off_t)userDataOffset) == (ssize_t)userDataSize) &&
+                (pwrite(fd, &header, sizeof(header), 0) == (ssize_t)sizeof(header));
+      written = (close(fd) == 0) && written;
+    }
+  } else {
+    char temporaryPath[PATH_MAX];
+    int fd = -1;
+    if (snprintf(temporaryPath, sizeof(temporaryPath), "%s.XXXXXX", path) < (int)sizeof(temporaryPath)) {
+      fd = mkstemp(temporaryPath);
+    }
+    if (fd >= 0) {
+      // the headers (with any extensions of them), the proxy, padding and the image data,
+      // then the original's mode, ACL and extended attributes, e.g. Finder tags
+      UInt8 padding[kDPXProxyImageAlignment] = { 0 };
+      written = DPXwriteAll(fd, &header, sizeof(header)) &&
+                DPXwriteAll(fd, file->bytes + sizeof(header), userDataOffset - sizeof(header)) &&
+                DPXwriteAll(fd, userData, userDataSize) &&
+                DPXwriteAll(fd, padding, newImageOffset - userDataOffset - userDataSize) &&
+                DPXwriteAll(fd, file->bytes + imageOffset, file->length - imageOffset) &&
+                (fcopyfile(file->fd, fd, NULL, COPYFILE_METADATA) == 0);
+      written = (close(fd) == 0) && written;
+      written = written && (rename(temporaryPath, path) == 0);
+      if (!written) {
+        unlink(temporaryPath);
+      }
+    }
+  }
+
+  free(userData);
+  releaseDPXImage(image);
+  return written;
 }
@@ -11,9 +11,17 @@
 
 #include <CoreGraphics/CoreGraphics.h>
 
+#include <stdbool.h>
 #include <stdio.h>
 
-typedef const void * DPXImage;
+#include "DPXDecoder.h"
+
+// bool isDPXFile(CFURLRef url)
+// checks the magic number of the file at the given URL.
+// Only the first four bytes of the file are read, so this is cheap enough
+// to be called for every file regardless of its extension.
+// returns true if the file is a DPX (or Cineon) file
+bool isDPXFile(CFURLRef url);
 
 // DPXImage readDPXImage(CFURLRef url)
 // reads a DPX image from the given URL
@@ -21,35 +29,91 @@ typedef const void * DPXImage;
 //  - a reference to the DPX image if the file exists and is a DPX file.
 //      The caller takes ownership of the returned image and has to release
 //      it with releaseDPXImage when it is no longer needed.
-//  - NULL if the file couldn't be read
+//  - NULL if the file couldn't be read or is not a DPX file, see isDPXFile
 DPXImage readDPXImage(CFURLRef url);
 
-// void releaseDPXImage(DPXImage)
-// release a DPX image and free its memory.
-// The DPXImage and pointers derived from it (e.g. with *DPXcreator)
-// must not be used after calling this function.
-void releaseDPXImage(DPXImage);
-
-// const char *DPXcreator(DPXImage)
-// returns a pointer to the "creator" field (stored as a 0-terminated C string)
-// in the DPX header. The pointer will be valid until the DPXImage has been
-// released with releaseDPXImage.
-const char *DPXcreator(DPXImage);
+// DPXImage readDPXImageWithCancellation(CFURLRef, DPXCancellation)
+// reads a DPX image from the given URL like readDPXImage, keeping a reference
+// to the given cancellation (which may be NULL). Once it is cancelled, the
+// decoders stop and return NULL (or false).
+// returns NULL if the cancellation is already cancelled, otherwise the same
+// as readDPXImage
+DPXImage readDPXImageWithCancellation(CFURLRef url, DPXCancellation cancellation);
 
 // CGSize DPXsize(DPXImage)
-// returns the size of the image
+// returns the size of the image. Stereo pairs stored in two image elements
+// are decoded with the left eye above the right one, so they are twice the
+// height of an element.
 CGSize DPXsize(DPXImage);
 
-// CGImageRef createCGImageFromDPX(DPXImage)
-// create a CGImage representation of the DPX image.
+// CGImageRef createCGImageFromDPX(DPXImage, DPXComponentFormat)
+// create a CGImage representation of the DPX image with components
+// of the given format, see DPXComponentFormat.
+// The caller takes ownership of the returned CGImage
+CGImageRef createCGImageFromDPX(DPXImage, DPXComponentFormat format);
+
+// CGImageRef createCGImageWithRectFromDPX(DPXImage, CGRect, CGFloat, DPXComponentFormat)
+// create a CGImage of the part of the image inside rect, given in pixels
+// from the top left corner of the image, scaled by scale, with components
+// of the given format. Scales below 1 average like thumbnails.
 // The caller takes ownership of the returned CGImage
-CGImageRef createCGImageFromDPX(DPXImage);
+// returns NULL if rect is outside the image
+CGImageRef createCGImageWithRectFromDPX(DPXImage, CGRect rect, CGFloat scale, DPXComponentFormat format);
 
-// CGImageRef createCGImageWithSizeFromDPX(DPXImage, CGSize)
-// create a thumbnail represation of the image with the given size.
+// CGImageRef createCGImageWithSizeFromDPX(DPXImage, CGSize, DPXComponentFormat)
+// create a thumbnail represation of the image with the given size
+// and components of the given format.
 // If the size is larger than the original image, the original image
 // will be returned.
 // The caller takes ownership of the returned CGImage
-CGImageRef createThumbnailCGImageWithSizeFromDPX(DPXImage, CGSize);
+CGImageRef createThumbnailCGImageWithSizeFromDPX(DPXImage, CGSize, DPXComponentFormat format);
+
+// void (*DPXCGImageStageCallback)(CGImageRef, bool, void *)
+// receives the images of the stages of decodeCGImagesProgressivelyFromDPX,
+// final being true for the full size image. The image is only valid during
+// the call, callbacks keeping it have to retain it.
+typedef void (*DPXCGImageStageCallback)(CGImageRef image, bool final, void *info);
+
+// bool decodeCGImagesProgressivelyFromDPX(DPXImage, CGSize, DPXComponentFormat, DPXCGImageStageCallback, void *)
+// decodes the image coarse to fine with components of the given format, see
+// DPXdecodeProgressively, passing a CGImage of every stage to callback
+// together with info, on the calling thread: first a thumbnail no larger
+// than coarseSize, then the full size image.
+// returns false if the full size image couldn't be created, e.g. because the
+// image's cancellation was cancelled
+bool decodeCGImagesProgressivelyFromDPX(DPXImage, CGSize coarseSize, DPXComponentFormat format, DPXCGImageStageCallback callback, void *info);
+
+// bool DPXgetPixelFormat(DPXImage, DPXComponentFormat, size_t *, size_t *, CGBitmapInfo *)
+// gets the bits per component, bits per pixel and bitmap info of the lines
+// DPXdecodeLines decodes with the given format, see DPXgetLineFormat, which
+// are those of the images createCGImageFromDPX creates.
+// returns false if the layout of the image isn't supported
+bool DPXgetPixelFormat(DPXImage, DPXComponentFormat format, size_t *bitsPerComponent, size_t *bitsPerPixel, CGBitmapInfo *bitmapInfo);
+
+// CGSize DPXthumbnailSize(CGSize, CGSize)
+// returns the size of the thumbnail createThumbnailCGImageWithSizeFromDPX
+// creates with the given size for an image of imageSize pixels
+CGSize DPXthumbnailSize(CGSize imageSize, CGSize size);
+
+// CGImageRef createThumbnailCGImageWithSizeFromRendition(CGImageRef, CGSize, CGSize)
+// create the thumbnail with the given size of a DPX image of imageSize pixels
+// from a larger rendition of it, created by createCGImageFromDPX or
+// createThumbnailCGImageWithSizeFromDPX, without going back to the file.
+// The thumbnail has the component format of the rendition.
+// The caller takes ownership of the returned CGImage
+// returns NULL if the rendition is smaller than the thumbnail or has
+// half float components
+CGImageRef createThumbnailCGImageWithSizeFromRendition(CGImageRef rendition, CGSize imageSize, CGSize size);
+
+// bool DPXwriteProxy(CFURLRef, CGSize, DPXComponentFormat)
+// embeds a thumbnail no larger than size with 8-bit components of the given
+// format (DPXComponentFormat8 or DPXComponentFormat8Dithered) into the
+// user-defined data of the DPX file at the given URL, which
+// createThumbnailCGImageWithSizeFromDPX then uses instead of decoding the image.
+// Files without room for it are rewritten with the image data moved back,
+// keeping their metadata.
+// returns false if the file isn't a DPX file, holds user-defined data of other
+// software or couldn't be written
+bool DPXwriteProxy(CFURLRef url, CGSize size, DPXComponentFormat format);
 
 #endif  // QLDPX_DPXIMAGE_H_
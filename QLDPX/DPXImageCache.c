@@ -0,0 +1,216 @@
+//
+//  DPXImageCache.c
+//  QLDPX
+//
+//  Copyright © 2019 Thomas Angarano. All rights reserved.
+//
+
+#include <limits.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <CoreFoundation/CoreFoundation.h>
+
+#include "DPXImageCache.h"
+
+// the total size of the cached thumbnails, and that of the cached full size images, above
+// which the least recently used ones of the same kind are evicted. Full size images have a
+// budget of their own, so a few previews don't evict every thumbnail.
+#define kDPXImageCacheThumbnailCapacity (64 * 1024 * 1024)
+#define kDPXImageCacheFullSizeCapacity (192 * 1024 * 1024)
+
+typedef struct _dpxImageCacheEntry {
+  struct _dpxImageCacheEntry *previous;  // the next more recently used entry
+  struct _dpxImageCacheEntry *next;      // the next less recently used entry
+  DPXFileIdentity file;
+  CGSize maxSize;                        // the maximum size the image was created for
+  CGSize imageSize;                      // the size of the DPX image
+  DPXComponentFormat format;             // the component format the image was created with
+  CGImageRef image;
+  size_t bytes;                          // the size of the image's pixels
+  bool fullSize;                         // true if maxSize is kDPXFullSize
+} DPXImageCacheEntry;
+
+// the entries, most recently used first
+static DPXImageCacheEntry *mostRecentlyUsed = NULL;
+static DPXImageCacheEntry *leastRecentlyUsed = NULL;
+static size_t cachedBytes[2];  // of the thumbnails and of the full size images
+static DPXImageCacheStatistics cacheStatistics;
+static pthread_mutex_t cacheMutex = PTHREAD_MUTEX_INITIALIZER;
+
+// finds the identity of the file at the given URL in its current state
+// returns false if the file doesn't exist
+static bool DPXfileIdentity(CFURLRef url, DPXFileIdentity *identity) {
+  char path[PATH_MAX];
+  return CFURLGetFileSystemRepresentation(url, true, (UInt8 *)path, sizeof(path)) && DPXfileIdentityAtPath(path, identity);
+}
+
+// returns the capacity of the full size images or the thumbnails
+static size_t DPXcacheCapacity(bool fullSize) {
+  return fullSize ? kDPXImageCacheFullSizeCapacity : kDPXImageCacheThumbnailCapacity;
+}
+
+// the following functions have to be called with cacheMutex locked
+
+static void DPXunlinkEntry(DPXImageCacheEntry *entry) {
+  if (entry->previous) {
+    entry->previous->next = entry->next;
+  } else {
+    mostRecentlyUsed = entry->next;
+  }
+  if (entry->next) {
+    entry->next->previous = entry->previous;
+  } else {
+    leastRecentlyUsed = entry->previous;
+  }
+  entry->previous = NULL;
+  entry->next = NULL;
+}
+
+static void DPXinsertEntry(DPXImageCacheEntry *entry) {
+  entry->previous = NULL;
+  entry->next = mostRecentlyUsed;
+  if (mostRecentlyUsed) {
+    mostRecentlyUsed->previous = entry;
+  } else {
+    leastRecentlyUsed = entry;
+  }
+  mostRecentlyUsed = entry;
+}
+
+static void DPXremoveEntry(DPXImageCacheEntry *entry) {
+  DPXunlinkEntry(entry);
+  cachedBytes[entry->fullSize] -= entry->bytes;
+  CGImageRelease(entry->image);
+  free(entry);
+}
+
+// adds a new entry, replacing an image another request has cached in the meantime,
+// and evicts the least recently used entries of its kind if they have grown too large
+static void DPXaddEntry(DPXImageCacheEntry *entry) {
+  for (DPXImageCacheEntry *cached = mostRecentlyUsed; cached; cached = cached->next) {
+    if (DPXisSameFile(&cached->file, &entry->file) && CGSizeEqualToSize(cached->maxSize, entry->maxSize) && (cached->format == entry->format)) {
+      DPXremoveEntry(cached);
+      break;
+    }
+  }
+
+  DPXinsertEntry(entry);
+  cachedBytes[entry->fullSize] += entry->bytes;
+  DPXImageCacheEntry *candidate = leastRecentlyUsed;
+  while ((cachedBytes[entry->fullSize] > DPXcacheCapacity(entry->fullSize)) && (candidate != entry)) {
+    DPXImageCacheEntry *moreRecentlyUsed = candidate->previous;
+    if (candidate->fullSize == entry->fullSize) {
+      DPXremoveEntry(candidate);
+      cacheStatistics.evictions++;
+    }
+    candidate = moreRecentlyUsed;
+  }
+}
+
+CGImageRef createCachedCGImage(CFURLRef url, CGSize maxSize, DPXComponentFormat format) {
+  DPXFileIdentity file;
+  if (!DPXfileIdentity(url, &file)) {
+    return NULL;
+  }
+
+  pthread_mutex_lock(&cacheMutex);
+
+  // look for the image itself or the smallest image of the same file and format it can be reduced from
+  DPXImageCacheEntry *source = NULL;
+  for (DPXImageCacheEntry *entry = mostRecentlyUsed; entry; entry = entry->next) {
+    if (!DPXisSameFile(&entry->file, &file) || (entry->format != format)) {
+      continue;
+    }
+
+    const CGSize cachedSize = CGSizeMake(CGImageGetWidth(entry->image), CGImageGetHeight(entry->image));
+    const CGSize thumbnailSize = DPXthumbnailSize(entry->imageSize, maxSize);
+    if (CGSizeEqualToSize(cachedSize, thumbnailSize)) {
+      DPXunlinkEntry(entry);
+      DPXinsertEntry(entry);
+      cacheStatistics.hits++;
+
+      CGImageRef cgImage = CGImageRetain(entry->image);
+      pthread_mutex_unlock(&cacheMutex);
+      return cgImage;
+    }
+
+    if ((cachedSize.width >= thumbnailSize.width) && (cachedSize.height >= thumbnailSize.height) &&
+        (!source || (entry->bytes < source->bytes))) {
+      source = entry;
+    }
+  }
+
+  if (!source) {
+    cacheStatistics.misses++;
+    pthread_mutex_unlock(&cacheMutex);
+    return NULL;
+  }
+
+  // reduce the larger image without holding the lock
+  CGImageRef sourceImage = CGImageRetain(source->image);
+  const CGSize imageSize = source->imageSize;
+  DPXunlinkEntry(source);
+  DPXinsertEntry(source);
+  pthread_mutex_unlock(&cacheMutex);
+
+  CGImageRef cgImage = createThumbnailCGImageWithSizeFromRendition(sourceImage, imageSize, maxSize);
+  CGImageRelease(sourceImage);
+
+  // the reduced image is cached like a decoded one, so it is found directly next time
+  DPXImageCacheEntry *entry = cgImage ? calloc(1, sizeof(DPXImageCacheEntry)) : NULL;
+  if (entry) {
+    entry->file = file;
+    entry->maxSize = maxSize;
+    entry->imageSize = imageSize;
+    entry->format = format;
+    entry->image = CGImageRetain(cgImage);
+    entry->bytes = CGImageGetBytesPerRow(cgImage) * CGImageGetHeight(cgImage);
+  }
+
+  pthread_mutex_lock(&cacheMutex);
+  if (cgImage) {
+    cacheStatistics.reductions++;
+  } else {
+    cacheStatistics.misses++;
+  }
+  if (entry) {
+    DPXaddEntry(entry);
+  }
+  pthread_mutex_unlock(&cacheMutex);
+
+  return cgImage;
+}
+
+void cacheCGImage(DPXImage image, CGSize maxSize, DPXComponentFormat format, CGImageRef cgImage) {
+  if (!image || !cgImage) {
+    return;
+  }
+
+  const size_t bytes = CGImageGetBytesPerRow(cgImage) * CGImageGetHeight(cgImage);
+  const bool fullSize = CGSizeEqualToSize(maxSize, kDPXFullSize);
+  if (bytes > DPXcacheCapacity(fullSize)) {
+    return;
+  }
+
+  DPXImageCacheEntry *entry = calloc(1, sizeof(DPXImageCacheEntry));
+  if (!entry) {
+    return;
+  }
+  DPXgetFileIdentity(image, &entry->file);
+  entry->maxSize = maxSize;
+  entry->imageSize = DPXsize(image);
+  entry->format = format;
+  entry->image = CGImageRetain(cgImage);
+  entry->bytes = bytes;
+  entry->fullSize = fullSize;
+
+  pthread_mutex_lock(&cacheMutex);
+  DPXaddEntry(entry);
+  pthread_mutex_unlock(&cacheMutex);
+}
+
+void DPXimageCacheGetStatistics(DPXImageCacheStatistics *statistics) {
+  pthread_mutex_lock(&cacheMutex);
+  *statistics = cacheStatistics;
+  pthread_mutex_unlock(&cacheMutex);
+}
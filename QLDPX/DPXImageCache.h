@@ -0,0 +1,54 @@
+//
+//  DPXImageCache.h
+//  QLDPX
+//
+//  Copyright © 2019 Thomas Angarano. All rights reserved.
+//
+
+#ifndef QLDPX_DPXIMAGECACHE_H_
+#define QLDPX_DPXIMAGECACHE_H_
+
+#include <CoreGraphics/CoreGraphics.h>
+
+#include <math.h>
+#include <stdint.h>
+
+#include "DPXImage.h"
+
+// In-memory image cache
+//
+// Images of recent requests are kept in memory, keyed by the identity of their
+// file, maximum size and component format, with separate byte budgets for
+// thumbnails and full size images, evicting the least recently used first.
+// Smaller sizes are reduced from larger cached images.
+// All functions are thread-safe.
+
+// the maximum size that stands for the full size image
+#define kDPXFullSize CGSizeMake(INFINITY, INFINITY)
+
+typedef struct _dpxImageCacheStatistics {
+  uint64_t hits;        // requests served with a cached image
+  uint64_t reductions;  // requests served by reducing a larger cached image
+  uint64_t misses;      // requests without a suitable cached image
+  uint64_t evictions;   // images evicted to make room for new ones
+} DPXImageCacheStatistics;
+
+// CGImageRef createCachedCGImage(CFURLRef, CGSize, DPXComponentFormat)
+// looks up the image of the file at the given URL, in its current state, with
+// the given maximum size (kDPXFullSize for the full size image) and component format.
+// returns
+//  - the cached image, or one reduced from a larger cached image.
+//      The caller takes ownership of the returned CGImage.
+//  - NULL if there is no suitable image in the cache.
+CGImageRef createCachedCGImage(CFURLRef url, CGSize maxSize, DPXComponentFormat format);
+
+// void cacheCGImage(DPXImage, CGSize, DPXComponentFormat, CGImageRef)
+// adds cgImage, created from image with the given maximum size and component
+// format, to the cache, for the file in the state it was read in.
+void cacheCGImage(DPXImage image, CGSize maxSize, DPXComponentFormat format, CGImageRef cgImage);
+
+// void DPXimageCacheGetStatistics(DPXImageCacheStatistics *)
+// copies the cache's counters, counted since the process started
+void DPXimageCacheGetStatistics(DPXImageCacheStatistics *statistics);
+
+#endif  // QLDPX_DPXIMAGECACHE_H_
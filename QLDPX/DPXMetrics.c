@@ -0,0 +1,468 @@
+//
+//  DPXMetrics.c
+//  QLDPX
+//
+//  Copyright © 2019 Thomas Angarano. All rights reserved.
+//
+
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
+#include <unistd.h>
+
+#include "DPXMetrics.h"
+
+// the number of buckets of a histogram. Bucket i counts the durations of at least
+// 2^(i-1) and less than 2^i microseconds, the last one all longer ones as well.
+#define kDPXHistogramBuckets 32
+
+// the number of combinations of decode path, bit size, packing and descriptor
+// counted separately, further ones are counted together with the last one
+#define kDPXPathKeys 64
+
+// the number of slowest images, with the files they were created from, that are kept
+#define kDPXSlowestImages 16
+
+// the number of trace events that are kept, further ones are dropped
+#define kDPXMaxTraceEvents (256 * 1024)
+
+// the number of recently traced file names searched before a name is copied again
+#define kDPXRecentFileNames 16
+
+typedef struct _dpxHistogram {
+  uint64_t count;
+  uint64_t total;    // nanoseconds
+  uint64_t longest;  // nanoseconds
+  uint64_t buckets[kDPXHistogramBuckets];
+} DPXHistogram;
+
+typedef struct _dpxPathKey {
+  DPXDecodePath path;
+  uint8_t bitSize;
+  uint16_t packing;
+  uint8_t descriptor;
+} DPXPathKey;
+
+typedef struct _dpxPathMetrics {
+  DPXPathKey key;
+  DPXHistogram histogram;
+} DPXPathMetrics;
+
+typedef struct _dpxSlowImage {
+  DPXPathKey key;
+  uint64_t duration;  // nanoseconds
+  char file[PATH_MAX];
+} DPXSlowImage;
+
+// a stage, or an image created along a path if isPath is true
+typedef struct _dpxTraceEvent {
+  uint64_t start;     // nanoseconds since the metrics were turned on
+  uint64_t duration;  // nanoseconds
+  uint64_t thread;
+  const char *file;   // one of traceFileNames, or NULL
+  bool isPath;
+  DPXStage stage;
+  DPXPathKey key;
+} DPXTraceEvent;
+
+// a copy of the metrics, taken with metricsMutex locked and written without it
+typedef struct _dpxMetricsSnapshot {
+  uint64_t counters[DPXCounterCount];
+  DPXHistogram stageHistograms[DPXStageCount];
+  DPXPathMetrics pathMetrics[kDPXPathKeys];
+  size_t pathKeyCount;
+  DPXSlowImage slowestImages[kDPXSlowestImages];
+  size_t slowImageCount;
+  DPXTraceEvent *traceEvents;
+  size_t traceEventCount;
+  size_t traceEventCapacity;
+  uint64_t droppedTraceEvents;
+} DPXMetricsSnapshot;
+
+static const char *const stageNames[DPXStageCount] = { "open", "read", "decode", "scale", "createImage" };
+static const char *const pathNames[DPXPathCount] = { "reference", "decode", "scale", "proxy", "rendition", "unsupported" };
+static const char *const counterNames[DPXCounterCount] = { "images", "bytesRead", "bytesAllocated" };
+
+static pthread_once_t metricsOnce = PTHREAD_ONCE_INIT;
+static bool metricsEnabled;
+static char *summaryPath;  // QLDPX_METRICS, with the process id
+static char *tracePath;    // QLDPX_TRACE, with the process id
+static uint64_t metricsOrigin;
+
+static uint64_t counters[DPXCounterCount];
+
+static pthread_mutex_t metricsMutex = PTHREAD_MUTEX_INITIALIZER;
+static DPXHistogram stageHistograms[DPXStageCount];
+static DPXPathMetrics pathMetrics[kDPXPathKeys];
+static size_t pathKeyCount;
+static DPXSlowImage slowestImages[kDPXSlowestImages];
+static size_t slowImageCount;
+static DPXTraceEvent *traceEvents;
+static size_t traceEventCount;
+static size_t traceEventCapacity;
+static uint64_t droppedTraceEvents;
+static char **traceFileNames;
+static size_t traceFileNameCount;
+static size_t traceFileNameCapacity;
+
+// serializes writing, so the snapshot and the temporary files are used by one thread at a time
+static pthread_mutex_t writeMutex = PTHREAD_MUTEX_INITIALIZER;
+static DPXMetricsSnapshot snapshot;
+
+static uint64_t DPXmonotonicNanoseconds(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t)now.tv_sec * 1000000000 + (uint64_t)now.tv_nsec;
+}
+
+static void DPXwriteMetricsAtExit(void) {
+  DPXwriteMetrics();
+}
+
+// returns a copy of path with the process id inserted in front of its extension, e.g.
+// metrics.1234.json, so the processes QuickLook runs side by side write files of their own,
+// or NULL if path is NULL or empty
+static char *DPXprocessPath(const char *path) {
+  if (!path || !*path) {
+    return NULL;
+  }
+
+  const char *name = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+  const char *extension = strrchr(name, '.');
+  const int stemLength = (int)((extension && (extension != name)) ? (size_t)(extension - path) : strlen(path));
+  const char *suffix = path + stemLength;
+  char processPath[PATH_MAX];
+  if (snprintf(processPath, sizeof(processPath), "%.*s.%d%s", stemLength, path, (int)getpid(), suffix) >= (int)sizeof(processPath)) {
+    return NULL;
+  }
+  return strdup(processPath);
+}
+
+static void DPXinitMetrics(void) {
+  summaryPath = DPXprocessPath(getenv("QLDPX_METRICS"));
+  tracePath = DPXprocessPath(getenv("QLDPX_TRACE"));
+  metricsEnabled = summaryPath || tracePath;
+  if (metricsEnabled) {
+    // stages started at the origin would have a start of 0, which means metrics are off
+    metricsOrigin = DPXmonotonicNanoseconds() - 1;
+    atexit(DPXwriteMetricsAtExit);
+  }
+}
+
+bool DPXmetricsEnabled(void) {
+  pthread_once(&metricsOnce, DPXinitMetrics);
+  return metricsEnabled;
+}
+
+uint64_t DPXmetricsNow(void) {
+  if (!DPXmetricsEnabled()) {
+    return 0;
+  }
+  return DPXmonotonicNanoseconds();
+}
+
+void DPXmetricsCount(DPXCounter counter, uint64_t amount) {
+  if (!DPXmetricsEnabled()) {
+    return;
+  }
+  __atomic_add_fetch(&counters[counter], amount, __ATOMIC_RELAXED);
+}
+
+// MARK: - recording
+
+static void DPXaddToHistogram(DPXHistogram *histogram, uint64_t duration) {
+  const uint64_t microseconds = duration / 1000;
+  size_t bucket = 0;
+  while ((bucket < kDPXHistogramBuckets - 1) && (microseconds >> bucket)) {
+    bucket++;
+  }
+
+  histogram->count++;
+  histogram->total += duration;
+  if (duration > histogram->longest) {
+    histogram->longest = duration;
+  }
+  histogram->buckets[bucket]++;
+}
+
+static bool DPXsamePathKey(const DPXPathKey *a, const DPXPathKey *b) {
+  return (a->path == b->path) && (a->bitSize == b->bitSize) && (a->packing == b->packing) && (a->descriptor == b->descriptor);
+}
+
+// keeps the image if it's one of the kDPXSlowestImages slowest, sorted slowest first.
+// The metrics have to be locked.
+static void DPXrecordSlowImage(const DPXPathKey *key, uint64_t duration, const char *file) {
+  if ((slowImageCount == kDPXSlowestImages) && (duration <= slowestImages[kDPXSlowestImages - 1].duration)) {
+    return;
+  }
+
+  size_t index = (slowImageCount < kDPXSlowestImages) ? slowImageCount++ : kDPXSlowestImages - 1;
+  for (; (index > 0) && (slowestImages[index - 1].duration < duration); index--) {
+    slowestImages[index] = slowestImages[index - 1];
+  }
+
+  slowestImages[index].key = *key;
+  slowestImages[index].duration = duration;
+  snprintf(slowestImages[index].file, sizeof(slowestImages[index].file), "%s", file ? file : "");
+}
+
+// returns a copy of the file name kept for the trace, or NULL if there wasn't enough memory.
+// Stages of the same file usually follow each other closely, so only the names of the last
+// few files are looked for. The metrics have to be locked.
+static const char *DPXtraceFileName(const char *file) {
+  for (size_t i = traceFileNameCount; (i > 0) && (i + kDPXRecentFileNames > traceFileNameCount); i--) {
+    if (strcmp(traceFileNames[i - 1], file) == 0) {
+      return traceFileNames[i - 1];
+    }
+  }
+
+  if (traceFileNameCount == traceFileNameCapacity) {
+    const size_t capacity = traceFileNameCapacity ? traceFileNameCapacity * 2 : 256;
+    char **names = realloc(traceFileNames, capacity * sizeof(char *));
+    if (!names) {
+      return NULL;
+    }
+    traceFileNames = names;
+    traceFileNameCapacity = capacity;
+  }
+
+  char *name = strdup(file);
+  if (name) {
+    traceFileNames[traceFileNameCount++] = name;
+  }
+  return name;
+}
+
+// appends an event to the trace, or counts it as dropped.
+// The metrics have to be locked.
+static void DPXrecordTraceEvent(DPXTraceEvent *event, const char *file) {
+  if ((traceEventCount == traceEventCapacity) && (traceEventCapacity < kDPXMaxTraceEvents)) {
+    const size_t capacity = traceEventCapacity ? traceEventCapacity * 2 : 1024;
+    DPXTraceEvent *events = realloc(traceEvents, capacity * sizeof(DPXTraceEvent));
+    if (events) {
+      traceEvents = events;
+      traceEventCapacity = capacity;
+    }
+  }
+  if (traceEventCount == traceEventCapacity) {
+    droppedTraceEvents++;
+    return;
+  }
+
+  uint64_t thread = 0;
+#if defined(__APPLE__)
+  pthread_threadid_np(NULL, &thread);
+#elif defined(__linux__)
+  thread = (uint64_t)syscall(SYS_gettid);
+#else
+  thread = (uint64_t)(uintptr_t)pthread_self();
+#endif
+  event->thread = thread;
+  event->file = file ? DPXtraceFileName(file) : NULL;
+  traceEvents[traceEventCount++] = *event;
+}
+
+void DPXmetricsRecordStage(DPXStage stage, uint64_t start, const char *file) {
+  if (start == 0) {
+    return;
+  }
+
+  const uint64_t duration = DPXmonotonicNanoseconds() - start;
+
+  pthread_mutex_lock(&metricsMutex);
+  DPXaddToHistogram(&stageHistograms[stage], duration);
+  if (tracePath) {
+    DPXTraceEvent event = { start - metricsOrigin, duration, 0, NULL, false, stage, { 0, 0, 0, 0 } };
+    DPXrecordTraceEvent(&event, file);
+  }
+  pthread_mutex_unlock(&metricsMutex);
+}
+
+void DPXmetricsRecordPath(DPXDecodePath path, uint8_t bitSize, uint16_t packing, uint8_t descriptor, uint64_t start, const char *file) {
+  if (start == 0) {
+    return;
+  }
+
+  const uint64_t duration = DPXmonotonicNanoseconds() - start;
+  const DPXPathKey key = { path, bitSize, packing, descriptor };
+
+  pthread_mutex_lock(&metricsMutex);
+  size_t index = 0;
+  while ((index < pathKeyCount) && !DPXsamePathKey(&pathMetrics[index].key, &key)) {
+    index++;
+  }
+  if (index == pathKeyCount) {
+    index = (pathKeyCount < kDPXPathKeys) ? pathKeyCount++ : kDPXPathKeys - 1;
+    pathMetrics[index].key = key;
+  }
+  DPXaddToHistogram(&pathMetrics[index].histogram, duration);
+  DPXrecordSlowImage(&key, duration, file);
+  if (tracePath) {
+    DPXTraceEvent event = { start - metricsOrigin, duration, 0, NULL, true, DPXStageCount, key };
+    DPXrecordTraceEvent(&event, file);
+  }
+  pthread_mutex_unlock(&metricsMutex);
+}
+
+// MARK: - writing
+
+// writes a JSON string literal
+static void DPXwriteJSONString(FILE *stream, const char *string) {
+  fputc('"', stream);
+  for (const unsigned char *c = (const unsigned char *)string; *c; c++) {
+    if ((*c == '"') || (*c == '\\')) {
+      fprintf(stream, "\\%c", *c);
+    } else if (*c < 0x20) {
+      fprintf(stream, "\\u%04x", *c);
+    } else {
+      fputc(*c, stream);
+    }
+  }
+  fputc('"', stream);
+}
+
+static void DPXwritePathKey(FILE *stream, const DPXPathKey *key) {
+  fprintf(stream, "\"path\": \"%s\", \"bitSize\": %u, \"packing\": %u, \"descriptor\": %u", pathNames[key->path], key->bitSize, key->packing, key->descriptor);
+}
+
+static void DPXwriteHistogram(FILE *stream, const DPXHistogram *histogram) {
+  fprintf(stream, "\"count\": %llu, \"totalMicroseconds\": %llu, \"longestMicroseconds\": %llu, \"histogram\": [",
+          (unsigned long long)histogram->count, (unsigned long long)(histogram->total / 1000), (unsigned long long)(histogram->longest / 1000));
+
+  // only the buckets that counted anything
+  bool first = true;
+  for (size_t bucket = 0; bucket < kDPXHistogramBuckets; bucket++) {
+    if (histogram->buckets[bucket]) {
+      fprintf(stream, "%s{\"lessThanMicroseconds\": %llu, \"count\": %llu}", first ? "" : ", ", 1ULL << bucket, (unsigned long long)histogram->buckets[bucket]);
+      first = false;
+    }
+  }
+  fputc(']', stream);
+}
+
+// writes the histograms, counters and slowest images of the snapshot as JSON
+static void DPXwriteSummary(FILE *stream, const DPXMetricsSnapshot *snapshot) {
+  fputs("{\n  \"stages\": [", stream);
+  for (size_t stage = 0; stage < DPXStageCount; stage++) {
+    fprintf(stream, "%s\n    {\"stage\": \"%s\", ", stage ? "," : "", stageNames[stage]);
+    DPXwriteHistogram(stream, &snapshot->stageHistograms[stage]);
+    fputc('}', stream);
+  }
+
+  fputs("\n  ],\n  \"paths\": [", stream);
+  for (size_t index = 0; index < snapshot->pathKeyCount; index++) {
+    fprintf(stream, "%s\n    {", index ? "," : "");
+    DPXwritePathKey(stream, &snapshot->pathMetrics[index].key);
+    fputs(", ", stream);
+    DPXwriteHistogram(stream, &snapshot->pathMetrics[index].histogram);
+    fputc('}', stream);
+  }
+
+  fputs("\n  ],\n  \"counters\": {", stream);
+  for (size_t counter = 0; counter < DPXCounterCount; counter++) {
+    fprintf(stream, "%s\"%s\": %llu", counter ? ", " : "", counterNames[counter], (unsigned long long)snapshot->counters[counter]);
+  }
+
+  fputs("},\n  \"slowest\": [", stream);
+  for (size_t index = 0; index < snapshot->slowImageCount; index++) {
+    fprintf(stream, "%s\n    {\"file\": ", index ? "," : "");
+    DPXwriteJSONString(stream, snapshot->slowestImages[index].file);
+    fputs(", ", stream);
+    DPXwritePathKey(stream, &snapshot->slowestImages[index].key);
+    fprintf(stream, ", \"microseconds\": %llu}", (unsigned long long)(snapshot->slowestImages[index].duration / 1000));
+  }
+  fputs("\n  ]\n}\n", stream);
+}
+
+// writes the events of the snapshot in the trace event format, as complete
+// events on the threads they were recorded on
+static void DPXwriteTrace(FILE *stream, const DPXMetricsSnapshot *snapshot) {
+  const int pid = (int)getpid();
+  fputs("{\"traceEvents\": [", stream);
+  for (size_t index = 0; index < snapshot->traceEventCount; index++) {
+    const DPXTraceEvent *event = &snapshot->traceEvents[index];
+    fprintf(stream, "%s\n{\"name\": \"%s\", \"cat\": \"%s\", \"ph\": \"X\", \"ts\": %.3f, \"dur\": %.3f, \"pid\": %d, \"tid\": %llu, \"args\": {",
+            index ? "," : "", event->isPath ? pathNames[event->key.path] : stageNames[event->stage], event->isPath ? "path" : "stage",
+            event->start / 1000.0, event->duration / 1000.0, pid, (unsigned long long)event->thread);
+    if (event->isPath) {
+      fprintf(stream, "\"bitSize\": %u, \"packing\": %u, \"descriptor\": %u%s", event->key.bitSize, event->key.packing, event->key.descriptor, event->file ? ", " : "");
+    }
+    if (event->file) {
+      fputs("\"file\": ", stream);
+      DPXwriteJSONString(stream, event->file);
+    }
+    fputs("}}", stream);
+  }
+  fprintf(stream, "\n], \"displayTimeUnit\": \"ms\", \"otherData\": {\"droppedEvents\": %llu}}\n", (unsigned long long)snapshot->droppedTraceEvents);
+}
+
+// writes a file next to path and moves it over path, so a file that is being
+// read is never seen half written
+static bool DPXwriteMetricsFile(const char *path, void (*write)(FILE *, const DPXMetricsSnapshot *)) {
+  char temporaryPath[PATH_MAX];
+  if (snprintf(temporaryPath, sizeof(temporaryPath), "%s.%d.tmp", path, (int)getpid()) >= (int)sizeof(temporaryPath)) {
+    return false;
+  }
+
+  FILE *stream = fopen(temporaryPath, "w");
+  if (!stream) {
+    return false;
+  }
+
+  write(stream, &snapshot);
+  const bool written = !ferror(stream);
+  if ((fclose(stream) != 0) || !written || (rename(temporaryPath, path) != 0)) {
+    unlink(temporaryPath);
+    return false;
+  }
+  return true;
+}
+
+bool DPXwriteMetrics(void) {
+  if (!DPXmetricsEnabled()) {
+    return false;
+  }
+
+  // the decoders only wait for the copy, not for the files to be written
+  pthread_mutex_lock(&writeMutex);
+  pthread_mutex_lock(&metricsMutex);
+  for (size_t counter = 0; counter < DPXCounterCount; counter++) {
+    snapshot.counters[counter] = __atomic_load_n(&counters[counter], __ATOMIC_RELAXED);
+  }
+  memcpy(snapshot.stageHistograms, stageHistograms, sizeof(stageHistograms));
+  memcpy(snapshot.pathMetrics, pathMetrics, sizeof(pathMetrics));
+  snapshot.pathKeyCount = pathKeyCount;
+  memcpy(snapshot.slowestImages, slowestImages, sizeof(slowestImages));
+  snapshot.slowImageCount = slowImageCount;
+  if (snapshot.traceEventCapacity < traceEventCount) {
+    DPXTraceEvent *events = realloc(snapshot.traceEvents, traceEventCapacity * sizeof(DPXTraceEvent));
+    if (events) {
+      snapshot.traceEvents = events;
+      snapshot.traceEventCapacity = traceEventCapacity;
+    }
+  }
+  // the events point to file names that are never freed, so they stay valid
+  snapshot.traceEventCount = (traceEventCount < snapshot.traceEventCapacity) ? traceEventCount : snapshot.traceEventCapacity;
+  if (snapshot.traceEventCount > 0) {
+    memcpy(snapshot.traceEvents, traceEvents, snapshot.traceEventCount * sizeof(DPXTraceEvent));
+  }
+  snapshot.droppedTraceEvents = droppedTraceEvents + (traceEventCount - snapshot.traceEventCount);
+  pthread_mutex_unlock(&metricsMutex);
+
+  bool written = true;
+  if (summaryPath) {
+    written = DPXwriteMetricsFile(summaryPath, DPXwriteSummary) && written;
+  }
+  if (tracePath) {
+    written = DPXwriteMetricsFile(tracePath, DPXwriteTrace) && written;
+  }
+  pthread_mutex_unlock(&writeMutex);
+
+  return written;
+}
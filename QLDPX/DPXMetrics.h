@@ -0,0 +1,84 @@
+//
+//  DPXMetrics.h
+//  QLDPX
+//
+//  Copyright © 2019 Thomas Angarano. All rights reserved.
+//
+
+#ifndef QLDPX_DPXMETRICS_H_
+#define QLDPX_DPXMETRICS_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Pipeline metrics
+//
+// QLDPX_METRICS set to a file path writes histograms of the stage and decode
+// path durations and byte counts to it as JSON, QLDPX_TRACE every stage as a
+// trace event. Each process inserts its id before the extension (e.g.
+// metrics.1234.json) and writes at exit and on DPXwriteMetrics.
+// Unset, the functions return at once and DPXmetricsNow returns 0.
+// All functions are thread-safe.
+
+typedef enum _dpxStage {
+  DPXStageOpen,         // the header read and the file mapped by readDPXImage
+  DPXStageRead,         // lines read with pread, for thumbnails
+  DPXStageDecode,       // lines unpacked and converted at full size
+  DPXStageScale,        // thumbnails area averaged from their source lines, including reading them
+  DPXStageCreateImage,  // the CGImage created around the decoded pixels
+  DPXStageCount
+} DPXStage;
+
+typedef enum _dpxDecodePath {
+  DPXPathReference,    // 8 and 16-bit data referenced in the mapped file
+  DPXPathDecode,       // decoded at full size
+  DPXPathScale,        // scaled down, to a thumbnail or part of the image
+  DPXPathProxy,        // the proxy embedded into the file, see DPXwriteProxy
+  DPXPathRendition,    // reduced from a rendition decoded before
+  DPXPathUnsupported,  // a layout without kernels, left black
+  DPXPathCount
+} DPXDecodePath;
+
+typedef enum _dpxCounter {
+  DPXCounterImages,          // images opened
+  DPXCounterBytesRead,       // bytes read with pread, excluding pages faulted in from the mapping
+  DPXCounterBytesAllocated,  // bytes of image buffers and lines read, see DPXallocateBuffer
+  DPXCounterCount
+} DPXCounter;
+
+// bool DPXmetricsEnabled(void)
+// returns true if QLDPX_METRICS or QLDPX_TRACE is set
+bool DPXmetricsEnabled(void);
+
+// uint64_t DPXmetricsNow(void)
+// returns the current time in nanoseconds, to be passed as the start of a
+// stage or path, or 0 if metrics are off
+uint64_t DPXmetricsNow(void);
+
+// void DPXmetricsRecordStage(DPXStage, uint64_t, const char *)
+// records a stage that started at start (see DPXmetricsNow) and ends now,
+// for the file at the given path, which may be NULL.
+// Does nothing if start is 0.
+void DPXmetricsRecordStage(DPXStage stage, uint64_t start, const char *file);
+
+// void DPXmetricsRecordPath(DPXDecodePath, uint8_t, uint16_t, uint8_t, uint64_t, const char *)
+// records an image created along the given path from image data with the given
+// bit size, packing and descriptor, which started at start and ends now.
+// Does nothing if start is 0.
+void DPXmetricsRecordPath(DPXDecodePath path, uint8_t bitSize, uint16_t packing, uint8_t descriptor, uint64_t start, const char *file);
+
+// void DPXmetricsCount(DPXCounter, uint64_t)
+// adds amount to the counter
+void DPXmetricsCount(DPXCounter counter, uint64_t amount);
+
+// bool DPXwriteMetrics(void)
+// writes the metrics recorded so far to the process's files named after
+// QLDPX_METRICS and QLDPX_TRACE, replacing them. The metrics are copied first,
+// so recording only waits for the copy, not for the files to be written.
+// QuickLook ends its processes without running exit handlers, so the
+// generators call this after every request.
+// returns false if metrics are off or a file couldn't be written
+bool DPXwriteMetrics(void);
+
+#endif  // QLDPX_DPXMETRICS_H_
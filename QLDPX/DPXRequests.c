@@ -0,0 +1,70 @@
+//
+//  DPXRequests.c
+//  QLDPX
+//
+//  Copyright © 2019 Thomas Angarano. All rights reserved.
+//
+
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "DPXRequests.h"
+
+typedef struct _dpxRequest {
+  struct _dpxRequest *next;
+  const void *request;
+  DPXCancellation cancellation;
+} DPXRequest;
+
+// the requests being generated; there are only ever a few, so a list will do
+static DPXRequest *requests = NULL;
+static pthread_mutex_t requestsMutex = PTHREAD_MUTEX_INITIALIZER;
+
+DPXCancellation DPXbeginRequest(const void *request) {
+  DPXRequest *entry = malloc(sizeof(DPXRequest));
+  if (!entry) {
+    return NULL;
+  }
+
+  entry->request = request;
+  entry->cancellation = DPXcreateCancellation();
+  if (!entry->cancellation) {
+    free(entry);
+    return NULL;
+  }
+
+  pthread_mutex_lock(&requestsMutex);
+  entry->next = requests;
+  requests = entry;
+  pthread_mutex_unlock(&requestsMutex);
+
+  return entry->cancellation;
+}
+
+void DPXcancelRequest(const void *request) {
+  pthread_mutex_lock(&requestsMutex);
+  for (DPXRequest *entry = requests; entry; entry = entry->next) {
+    if (entry->request == request) {
+      DPXcancel(entry->cancellation);
+    }
+  }
+  pthread_mutex_unlock(&requestsMutex);
+}
+
+void DPXendRequest(const void *request) {
+  pthread_mutex_lock(&requestsMutex);
+  DPXRequest *entry = NULL;
+  for (DPXRequest **link = &requests; *link; link = &(*link)->next) {
+    if ((*link)->request == request) {
+      entry = *link;
+      *link = entry->next;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&requestsMutex);
+
+  if (entry) {
+    releaseDPXCancellation(entry->cancellation);
+    free(entry);
+  }
+}
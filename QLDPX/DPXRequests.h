@@ -0,0 +1,35 @@
+//
+//  DPXRequests.h
+//  QLDPX
+//
+//  Copyright © 2019 Thomas Angarano. All rights reserved.
+//
+
+#ifndef QLDPX_DPXREQUESTS_H_
+#define QLDPX_DPXREQUESTS_H_
+
+#include "DPXImage.h"
+
+// Cancellation of QuickLook requests
+//
+// The cancellation a request's images are read with is registered for the
+// request, so the generator's cancel function can find it. Cancels before
+// DPXbeginRequest are lost, so check the request after it.
+// All functions are thread-safe.
+
+// DPXCancellation DPXbeginRequest(const void *)
+// creates a cancellation for the given request and registers it until DPXendRequest.
+// returns the cancellation, which stays valid until DPXendRequest, or NULL if
+// there wasn't enough memory, in which case the request can't be cancelled
+DPXCancellation DPXbeginRequest(const void *request);
+
+// void DPXcancelRequest(const void *)
+// cancels the cancellation registered for the given request, if there is one
+void DPXcancelRequest(const void *request);
+
+// void DPXendRequest(const void *)
+// unregisters and releases the cancellation registered for the given request.
+// Images read with it keep their own reference.
+void DPXendRequest(const void *request);
+
+#endif  // QLDPX_DPXREQUESTS_H_
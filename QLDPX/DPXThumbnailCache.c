@@ -0,0 +1,313 @@
+//
+//  DPXThumbnailCache.c
+//  QLDPX
+//
+//  Copyright © 2019 Thomas Angarano. All rights reserved.
+//
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <CoreFoundation/CoreFoundation.h>
+
+#include "DPXThumbnailCache.h"
+
+#define kDPXThumbnailCacheMagic 0x54585044  // "DPXT"
+#define kDPXThumbnailCacheVersion 3  // version 1 entries of 16-bit images have the wrong byte order, version 2 entries show log data as it is
+
+// the total size of all entries above which old entries are evicted
+#define kDPXThumbnailCacheCapacity (128 * 1024 * 1024)
+// the total size an oversized cache is trimmed down to, leaving room for new entries
+#define kDPXThumbnailCacheTrimmedSize (kDPXThumbnailCacheCapacity / 4 * 3)
+
+// A cache entry is this header, in host byte order, directly followed by the
+// pixels of the thumbnail as CoreGraphics describes them, so an entry can be
+// mapped and handed to CoreGraphics as it is.
+typedef struct _dpxThumbnailCacheHeader {
+  UInt32 magic;             // kDPXThumbnailCacheMagic
+  UInt32 version;           // kDPXThumbnailCacheVersion
+  UInt32 width;
+  UInt32 height;
+  UInt32 bitsPerComponent;
+  UInt32 bitsPerPixel;
+  UInt32 bytesPerRow;
+  UInt32 bitmapInfo;
+} DPXThumbnailCacheHeader;
+
+typedef struct _dpxThumbnailCacheEntry {
+  char name[NAME_MAX + 1];
+  off_t size;
+  struct timespec lastUse;  // the entry's access time, updated on every cache hit
+} DPXThumbnailCacheEntry;
+
+static char cacheDirectory[PATH_MAX];
+static pthread_once_t cacheDirectoryOnce = PTHREAD_ONCE_INIT;
+
+// creates the cache directory inside the user's cache directory.
+// cacheDirectory stays empty if that fails, which disables the cache.
+static void createCacheDirectory(void) {
+  char userCacheDirectory[PATH_MAX];
+  const size_t length = confstr(_CS_DARWIN_USER_CACHE_DIR, userCacheDirectory, sizeof(userCacheDirectory));
+  if ((length == 0) || (length > sizeof(userCacheDirectory))) {
+    return;
+  }
+
+  // the user cache directory ends with a '/'
+  char path[PATH_MAX];
+  snprintf(path, sizeof(path), "%scom.angarano.QLDPX", userCacheDirectory);
+  if ((mkdir(path, 0700) != 0) && (errno != EEXIST)) {
+    return;
+  }
+
+  strlcat(path, "/Thumbnails", sizeof(path));
+  if ((mkdir(path, 0700) != 0) && (errno != EEXIST)) {
+    return;
+  }
+
+  strlcpy(cacheDirectory, path, sizeof(cacheDirectory));
+}
+
+// writes the path of the cache entry for the file with the given identity, the given
+// maximum size and component format to entryPath
+// returns false if the cache is not available
+static bool DPXcacheEntryPath(const DPXFileIdentity *file, CGSize maxSize, DPXComponentFormat format, char *entryPath, size_t length) {
+  pthread_once(&cacheDirectoryOnce, createCacheDirectory);
+  if (!cacheDirectory[0]) {
+    return false;
+  }
+
+  // device, inode, size, modification time, maximum size and component format
+  const int pathLength = snprintf(entryPath, length, "%s/%llx-%llx-%llx-%llx.%09ld-%ldx%ld-%d.thumbnail", cacheDirectory,
+                                  (unsigned long long)file->device, (unsigned long long)file->inode,
+                                  (unsigned long long)file->size, (unsigned long long)file->modificationTime.tv_sec,
+                                  file->modificationTime.tv_nsec, (long)maxSize.width, (long)maxSize.height, (int)format);
+  return (pathLength > 0) && ((size_t)pathLength < length);
+}
+
+// returns true if header describes an entry of the given length in bytes
+static bool DPXisValidCacheHeader(const DPXThumbnailCacheHeader *header, off_t length) {
+  if ((header->magic != kDPXThumbnailCacheMagic) || (header->version != kDPXThumbnailCacheVersion)) {
+    return false;
+  }
+  if ((header->width == 0) || (header->height == 0) || (header->bitsPerPixel % 8 != 0)) {
+    return false;
+  }
+  if ((size_t)header->bytesPerRow < (size_t)header->width * header->bitsPerPixel / 8) {
+    return false;
+  }
+
+  return (size_t)length == sizeof(DPXThumbnailCacheHeader) + (size_t)header->height * header->bytesPerRow;
+}
+
+static void unmapCachedThumbnail(void *info, const void *data, size_t size) {
+  munmap((void *)((const UInt8 *)data - sizeof(DPXThumbnailCacheHeader)), size + sizeof(DPXThumbnailCacheHeader));
+}
+
+CGImageRef createCachedThumbnailCGImage(CFURLRef url, CGSize maxSize, DPXComponentFormat format) {
+  char path[PATH_MAX];
+  DPXFileIdentity file;
+  if (!CFURLGetFileSystemRepresentation(url, true, (UInt8 *)path, sizeof(path)) || !DPXfileIdentityAtPath(path, &file)) {
+    return NULL;
+  }
+
+  char entryPath[PATH_MAX];
+  if (!DPXcacheEntryPath(&file, maxSize, format, entryPath, sizeof(entryPath))) {
+    return NULL;
+  }
+
+  int fd = open(entryPath, O_RDONLY);
+  if (fd < 0) {
+    return NULL;
+  }
+
+  struct stat entryStatus;
+  if ((fstat(fd, &entryStatus) != 0) || (entryStatus.st_size < (off_t)sizeof(DPXThumbnailCacheHeader))) {
+    close(fd);
+    return NULL;
+  }
+
+  const size_t length = (size_t)entryStatus.st_size;
+  const UInt8 *bytes = mmap(NULL, length, PROT_READ, MAP_SHARED, fd, 0);
+  if (bytes == MAP_FAILED) {
+    close(fd);
+    return NULL;
+  }
+
+  // mark the entry as recently used, the eviction goes by access time
+  const struct timespec times[2] = { { 0, UTIME_NOW }, { 0, UTIME_OMIT } };
+  futimens(fd, times);
+  close(fd);
+
+  const DPXThumbnailCacheHeader *header = (const DPXThumbnailCacheHeader *)bytes;
+  if (!DPXisValidCacheHeader(header, entryStatus.st_size)) {
+    munmap((void *)bytes, length);
+    return NULL;
+  }
+
+  CGDataProviderRef imageDataProvider = CGDataProviderCreateWithData(NULL, bytes + sizeof(DPXThumbnailCacheHeader), length - sizeof(DPXThumbnailCacheHeader), &unmapCachedThumbnail);
+  if (imageDataProvider == NULL) {
+    munmap((void *)bytes, length);
+    return NULL;
+  }
+
+  CGColorSpaceRef colourSpace = (header->bitsPerPixel == header->bitsPerComponent) ? CGColorSpaceCreateDeviceGray() : CGColorSpaceCreateDeviceRGB();
+  CGImageRef cgImage = CGImageCreate(header->width, header->height, header->bitsPerComponent, header->bitsPerPixel, header->bytesPerRow, colourSpace, header->bitmapInfo, imageDataProvider, NULL, false, kCGRenderingIntentDefault);
+
+  CGColorSpaceRelease(colourSpace);
+  CGDataProviderRelease(imageDataProvider);
+
+  return cgImage;
+}
+
+static int compareCacheEntries(const void *a, const void *b) {
+  const struct timespec *lastUseA = &((const DPXThumbnailCacheEntry *)a)->lastUse;
+  const struct timespec *lastUseB = &((const DPXThumbnailCacheEntry *)b)->lastUse;
+
+  if (lastUseA->tv_sec != lastUseB->tv_sec) {
+    return (lastUseA->tv_sec < lastUseB->tv_sec) ? -1 : 1;
+  }
+  if (lastUseA->tv_nsec != lastUseB->tv_nsec) {
+    return (lastUseA->tv_nsec < lastUseB->tv_nsec) ? -1 : 1;
+  }
+  return 0;
+}
+
+// evicts the least recently used entries once the cache has grown beyond its capacity.
+// Only one process trims the cache at a time, the others skip this while it is locked.
+// Left over temporary files count as entries, so they are evicted eventually, too.
+static void DPXtrimCache(void) {
+  DIR *directory = opendir(cacheDirectory);
+  if (!directory) {
+    return;
+  }
+
+  const int directoryFd = dirfd(directory);
+  if (flock(directoryFd, LOCK_EX | LOCK_NB) != 0) {
+    closedir(directory);
+    return;
+  }
+
+  DPXThumbnailCacheEntry *entries = NULL;
+  size_t entryCount = 0;
+  size_t entryCapacity = 0;
+  off_t totalSize = 0;
+
+  struct dirent *directoryEntry;
+  while ((directoryEntry = readdir(directory)) != NULL) {
+    struct stat entryStatus;
+    if ((fstatat(directoryFd, directoryEntry->d_name, &entryStatus, AT_SYMLINK_NOFOLLOW) != 0) || !S_ISREG(entryStatus.st_mode)) {
+      continue;
+    }
+
+    if (entryCount == entryCapacity) {
+      entryCapacity = entryCapacity ? entryCapacity * 2 : 64;
+      DPXThumbnailCacheEntry *grownEntries = realloc(entries, entryCapacity * sizeof(DPXThumbnailCacheEntry));
+      if (!grownEntries) {
+        free(entries);
+        closedir(directory);
+        return;
+      }
+      entries = grownEntries;
+    }
+
+    DPXThumbnailCacheEntry *entry = &entries[entryCount++];
+    strlcpy(entry->name, directoryEntry->d_name, sizeof(entry->name));
+    entry->size = entryStatus.st_size;
+    entry->lastUse = entryStatus.st_atimespec;
+    totalSize += entryStatus.st_size;
+  }
+
+  if (totalSize > kDPXThumbnailCacheCapacity) {
+    qsort(entries, entryCount, sizeof(DPXThumbnailCacheEntry), compareCacheEntries);
+
+    // another process may have evicted an entry already, so failing to remove it is fine
+    for (size_t i = 0; (i < entryCount) && (totalSize > kDPXThumbnailCacheTrimmedSize); i++) {
+      unlinkat(directoryFd, entries[i].name, 0);
+      totalSize -= entries[i].size;
+    }
+  }
+
+  free(entries);
+  closedir(directory);  // this releases the lock, too
+}
+
+void cacheThumbnailCGImage(DPXImage dpxImage, CGSize maxSize, DPXComponentFormat format, CGImageRef image) {
+  if ((dpxImage == NULL) || (image == NULL)) {
+    return;
+  }
+
+  DPXFileIdentity file;
+  DPXgetFileIdentity(dpxImage, &file);
+  char entryPath[PATH_MAX];
+  if (!DPXcacheEntryPath(&file, maxSize, format, entryPath, sizeof(entryPath))) {
+    return;
+  }
+
+  const DPXThumbnailCacheHeader header = {
+    kDPXThumbnailCacheMagic,
+    kDPXThumbnailCacheVersion,
+    (UInt32)CGImageGetWidth(image),
+    (UInt32)CGImageGetHeight(image),
+    (UInt32)CGImageGetBitsPerComponent(image),
+    (UInt32)CGImageGetBitsPerPixel(image),
+    (UInt32)CGImageGetBytesPerRow(image),
+    (UInt32)CGImageGetBitmapInfo(image)
+  };
+
+  CFDataRef pixels = CGDataProviderCopyData(CGImageGetDataProvider(image));
+  if (pixels == NULL) {
+    return;
+  }
+  // the last line of an image can end without the padding of the others, e.g. that of an
+  // image referencing the lines of its file, so the entry gets it as zeros
+  const size_t rowLength = (size_t)header.width * header.bitsPerPixel / 8;
+  const size_t entryPixelsLength = (size_t)header.height * header.bytesPerRow;
+  const size_t dataLength = (size_t)CFDataGetLength(pixels);
+  const size_t pixelsLength = (dataLength < entryPixelsLength) ? dataLength : entryPixelsLength;
+  const size_t paddingLength = entryPixelsLength - pixelsLength;
+  void *padding = (paddingLength > 0) ? calloc(1, paddingLength) : NULL;
+  if (!DPXisValidCacheHeader(&header, (off_t)(sizeof(header) + entryPixelsLength)) ||
+      (pixelsLength + header.bytesPerRow < entryPixelsLength + rowLength) || ((paddingLength > 0) && !padding)) {
+    free(padding);
+    CFRelease(pixels);
+    return;
+  }
+
+  // write the entry under a temporary name first and rename it into place when it
+  // is complete, so other processes never see a partly written entry
+  char temporaryPath[PATH_MAX];
+  snprintf(temporaryPath, sizeof(temporaryPath), "%s/.entry.XXXXXX", cacheDirectory);
+  int fd = mkstemp(temporaryPath);
+  if (fd < 0) {
+    free(padding);
+    CFRelease(pixels);
+    return;
+  }
+
+  struct iovec parts[3] = {
+    { (void *)&header, sizeof(header) },
+    { (void *)CFDataGetBytePtr(pixels), pixelsLength },
+    { padding, paddingLength }
+  };
+  const bool written = (writev(fd, parts, 3) == (ssize_t)(sizeof(header) + entryPixelsLength));
+  close(fd);
+  free(padding);
+  CFRelease(pixels);
+
+  if (!written || (rename(temporaryPath, entryPath) != 0)) {
+    unlink(temporaryPath);
+    return;
+  }
+
+  DPXtrimCache();
+}
@@ -0,0 +1,37 @@
+//
+//  DPXThumbnailCache.h
+//  QLDPX
+//
+//  Copyright © 2019 Thomas Angarano. All rights reserved.
+//
+
+#ifndef QLDPX_DPXTHUMBNAILCACHE_H_
+#define QLDPX_DPXTHUMBNAILCACHE_H_
+
+#include <CoreGraphics/CoreGraphics.h>
+
+#include "DPXDecoder.h"
+
+// On-disk thumbnail cache
+//
+// Thumbnails are kept in the user's cache directory, one file each, keyed by
+// the identity of the image file, maximum size and component format, and
+// evicted least recently used first. Entries are renamed into place, so
+// several processes can share the cache.
+
+// CGImageRef createCachedThumbnailCGImage(CFURLRef, CGSize, DPXComponentFormat)
+// looks up the thumbnail of the file at the given URL for the given maximum size
+// and component format.
+// The entry is memory-mapped, so the pixels are only paged in when they are drawn.
+// returns
+//  - the cached thumbnail. The caller takes ownership of the returned CGImage.
+//  - NULL if there is no (valid) entry for the file in its current state.
+CGImageRef createCachedThumbnailCGImage(CFURLRef url, CGSize maxSize, DPXComponentFormat format);
+
+// void cacheThumbnailCGImage(DPXImage, CGSize, DPXComponentFormat, CGImageRef)
+// stores the thumbnail of the DPX image, created for the given maximum size
+// and component format, in the cache, for the file in the state it was read in. Errors are ignored, the thumbnail just won't be
+// found the next time.
+void cacheThumbnailCGImage(DPXImage dpxImage, CGSize maxSize, DPXComponentFormat format, CGImageRef image);
+
+#endif  // QLDPX_DPXTHUMBNAILCACHE_H_
@@ -0,0 +1,1591 @@
+//
+//  DPXUnpack.c
+//  QLDPX
+//
+//  Copyright © 2019 Thomas Angarano. All rights reserved.
+//
+
+#include <math.h>
+#include <pthread.h>
+#include <string.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define DPX_UNPACK_X86 1
+#endif
+
+#include "DPXUnpack.h"
+
+// padding is the number of unused bits above the components of each word:
+// 0 for packing method A, 2 (10-bit) or 4 (12-bit) for method B.
+// Shifting a method B word up by its padding gives the method A layout.
+typedef void (*DPXUnpackLineFunction)(const uint32_t *source, uint8_t *target, size_t width, unsigned padding, bool swap);
+typedef void (*DPXAccumulateLineFunction)(const uint32_t *source, uint32_t *sums, size_t width, unsigned padding, bool swap);
+// count is the number of components in the line, including any alpha
+typedef void (*DPXUnpackPackedFunction)(const uint32_t *source, uint8_t *target, size_t count, size_t components, bool swap);
+
+static inline uint32_t DPXswapWord(uint32_t word, bool swap) {
+  return swap ? __builtin_bswap32(word) : word;
+}
+
+static unsigned DPXpadding(uint8_t bitSize, uint16_t packing) {
+  if (packing != 2) {
+    return 0;
+  }
+  return (bitSize == 10) ? 2 : 4;
+}
+
+// MARK: - plain C
+
+// The plain C kernels are written once with swap as a parameter and
+// instantiated for both byte orders, so the byte order test is resolved
+// at compile time rather than for every word.
+
+__attribute__((always_inline))
+static inline void unpack10FilledRGBScalarLoop(const uint32_t *source, uint8_t *target, size_t width, unsigned padding, const bool swap) {
+  for (size_t x = 0; x < width; x++) {
+    const uint32_t word = DPXswapWord(source[x], swap) << padding;
+
+    target[x * 3 + 0] = word >> 24;
+    target[x * 3 + 1] = word >> 14;
+    target[x * 3 + 2] = word >> 4;
+  }
+}
+
+static void unpack10FilledRGBScalar(const uint32_t *source, uint8_t *target, size_t width, unsigned padding, bool swap) {
+  if (swap) {
+    unpack10FilledRGBScalarLoop(source, target, width, padding, true);
+  } else {
+    unpack10FilledRGBScalarLoop(source, target, width, padding, false);
+  }
+}
+
+__attribute__((always_inline))
+static inline void unpack10FilledRGBAScalarLoop(const uint32_t *source, uint8_t *target, size_t width, unsigned padding, const bool swap) {
+  size_t x = 0;
+
+  // 3 RGBA pixels (12 components) fill exactly 4 words
+  for (; x + 3 <= width; x += 3, source += 4, target += 9) {
+    const uint32_t word0 = DPXswapWord(source[0], swap) << padding;  // R0 G0 B0
+    const uint32_t word1 = DPXswapWord(source[1], swap) << padding;  // A0 R1 G1
+    const uint32_t word2 = DPXswapWord(source[2], swap) << padding;  // B1 A1 R2
+    const uint32_t word3 = DPXswapWord(source[3], swap) << padding;  // G2 B2 A2
+
+    target[0] = word0 >> 24;
+    target[1] = word0 >> 14;
+    target[2] = word0 >> 4;
+    target[3] = word1 >> 14;
+    target[4] = word1 >> 4;
+    target[5] = word2 >> 24;
+    target[6] = word2 >> 4;
+    target[7] = word3 >> 24;
+    target[8] = word3 >> 14;
+  }
+
+  // the last one or two pixels of the line
+  for (size_t pixel = 0; pixel < width - x; pixel++) {
+    for (size_t component = 0; component < 3; component++) {
+      const size_t componentIndex = pixel * 4 + component;
+      const uint32_t word = DPXswapWord(source[componentIndex / 3], swap) << padding;
+
+      target[pixel * 3 + component] = word >> (24 - (componentIndex % 3) * 10);
+    }
+  }
+}
+
+static void unpack10FilledRGBAScalar(const uint32_t *source, uint8_t *target, size_t width, unsigned padding, bool swap) {
+  if (swap) {
+    unpack10FilledRGBAScalarLoop(source, target, width, padding, true);
+  } else {
+    unpack10FilledRGBAScalarLoop(source, target, width, padding, false);
+  }
+}
+
+__attribute__((always_inline))
+static inline void accumulate10FilledRGBScalarLoop(const uint32_t *source, uint32_t *sums, size_t width, unsigned padding, const bool swap) {
+  for (size_t x = 0; x < width; x++) {
+    const uint32_t word = DPXswapWord(source[x], swap) << padding;
+
+    sums[x * 3 + 0] += (word >> 22) & 0x3FF;
+    sums[x * 3 + 1] += (word >> 12) & 0x3FF;
+    sums[x * 3 + 2] += (word >> 2) & 0x3FF;
+  }
+}
+
+static void accumulate10FilledRGBScalar(const uint32_t *source, uint32_t *sums, size_t width, unsigned padding, bool swap) {
+  if (swap) {
+    accumulate10FilledRGBScalarLoop(source, sums, width, padding, true);
+  } else {
+    accumulate10FilledRGBScalarLoop(source, sums, width, padding, false);
+  }
+}
+
+// Packed data (packing 0) is a stream of components filled into 32-bit words from
+// the least significant bit up, read through a 64-bit buffer one word at a time.
+
+typedef struct _dpxBitReader {
+  const uint32_t *next;  // the next word to load
+  uint64_t buffer;       // loaded bits not read yet, the next component lowest
+  unsigned buffered;     // number of bits in buffer
+} DPXBitReader;
+
+__attribute__((always_inline))
+static inline uint32_t DPXreadComponent(DPXBitReader *reader, const unsigned bits, const bool swap) {
+  if (reader->buffered < bits) {
+    reader->buffer |= (uint64_t)DPXswapWord(*reader->next++, swap) << reader->buffered;
+    reader->buffered += 32;
+  }
+
+  const uint32_t component = reader->buffer & ((1u << bits) - 1);
+  reader->buffer >>= bits;
+  reader->buffered -= bits;
+  return component;
+}
+
+// unpacks count components into the top 8 bits of each, dropping every
+// fourth (alpha) component if components is 4
+__attribute__((always_inline))
+static inline void unpackPackedScalarLoop(const uint32_t *source, uint8_t *target, size_t count, size_t components, const unsigned bits, const bool swap) {
+  DPXBitReader reader = { source, 0, 0 };
+
+  if (components == 4) {
+    for (size_t i = 0; i + 4 <= count; i += 4, target += 3) {
+      target[0] = DPXreadComponent(&reader, bits, swap) >> (bits - 8);
+      target[1] = DPXreadComponent(&reader, bits, swap) >> (bits - 8);
+      target[2] = DPXreadComponent(&reader, bits, swap) >> (bits - 8);
+      DPXreadComponent(&reader, bits, swap);
+    }
+    return;
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    target[i] = DPXreadComponent(&reader, bits, swap) >> (bits - 8);
+  }
+}
+
+__attribute__((always_inline))
+static inline void accumulatePackedLoop(const uint32_t *source, uint32_t *sums, size_t count, size_t components, const unsigned bits, const bool swap) {
+  DPXBitReader reader = { source, 0, 0 };
+
+  if (components == 4) {
+    for (size_t i = 0; i + 4 <= count; i += 4, sums += 3) {
+      sums[0] += DPXreadComponent(&reader, bits, swap);
+      sums[1] += DPXreadComponent(&reader, bits, swap);
+      sums[2] += DPXreadComponent(&reader, bits, swap);
+      DPXreadComponent(&reader, bits, swap);
+    }
+    return;
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    sums[i] += DPXreadComponent(&reader, bits, swap);
+  }
+}
+
+static void unpack10PackedScalar(const uint32_t *source, uint8_t *target, size_t count, size_t components, bool swap) {
+  if (swap) {
+    unpackPackedScalarLoop(source, target, count, components, 10, true);
+  } else {
+    unpackPackedScalarLoop(source, target, count, components, 10, false);
+  }
+}
+
+static void unpack12PackedScalar(const uint32_t *source, uint8_t *target, size_t count, size_t components, bool swap) {
+  if (swap) {
+    unpackPackedScalarLoop(source, target, count, components, 12, true);
+  } else {
+    unpackPackedScalarLoop(source, target, count, components, 12, false);
+  }
+}
+
+#if DPX_UNPACK_X86
+
+// MARK: - SSE4.1
+
+// returns the top 8 bits of the three 10-bit components of each word in bytes 0-2 of its lane
+__attribute__((target("sse4.1")))
+static inline __m128i unpack10WordsSSE41(__m128i words, __m128i byteOrder, __m128i padding) {
+  words = _mm_sll_epi32(_mm_shuffle_epi8(words, byteOrder), padding);
+
+  const __m128i component0 = _mm_srli_epi32(words, 24);
+  const __m128i component1 = _mm_and_si128(_mm_srli_epi32(words, 6), _mm_set1_epi32(0x0000FF00));
+  const __m128i component2 = _mm_and_si128(_mm_slli_epi32(words, 12), _mm_set1_epi32(0x00FF0000));
+
+  return _mm_or_si128(component0, _mm_or_si128(component1, component2));
+}
+
+// stores the first 12 bytes of pixels
+__attribute__((target("sse4.1")))
+static inline void store12SSE41(uint8_t *target, __m128i pixels) {
+  _mm_storel_epi64((__m128i *)target, pixels);
+  const uint32_t last = (uint32_t)_mm_extract_epi32(pixels, 2);
+  memcpy(target + 8, &last, sizeof(last));
+}
+
+// stores the first 9 bytes of pixels
+__attribute__((target("sse4.1")))
+static inline void store9SSE41(uint8_t *target, __m128i pixels) {
+  _mm_storel_epi64((__m128i *)target, pixels);
+  target[8] = (uint8_t)_mm_extract_epi8(pixels, 8);
+}
+
+__attribute__((target("sse4.1")))
+static __m128i byteOrderSSE41(bool swap) {
+  return swap ? _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12)
+              : _mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+}
+
+__attribute__((target("sse4.1")))
+static void unpack10FilledRGBSSE41(const uint32_t *source, uint8_t *target, size_t width, unsigned padding, bool swap) {
+  const __m128i byteOrder = byteOrderSSE41(swap);
+  const __m128i shift = _mm_cvtsi32_si128((int)padding);
+  // drop the empty fourth byte of each pixel
+  const __m128i compact = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+
+  size_t x = 0;
+  for (; x + 8 <= width; x += 8) {
+    const __m128i words0 = _mm_loadu_si128((const __m128i *)(source + x));
+    const __m128i words1 = _mm_loadu_si128((const __m128i *)(source + x + 4));
+
+    store12SSE41(target + x * 3, _mm_shuffle_epi8(unpack10WordsSSE41(words0, byteOrder, shift), compact));
+    store12SSE41(target + x * 3 + 12, _mm_shuffle_epi8(unpack10WordsSSE41(words1, byteOrder, shift), compact));
+  }
+
+  unpack10FilledRGBScalar(source + x, target + x * 3, width - x, padding, swap);
+}
+
+__attribute__((target("sse4.1")))
+static void unpack10FilledRGBASSE41(const uint32_t *source, uint8_t *target, size_t width, unsigned padding, bool swap) {
+  const __m128i byteOrder = byteOrderSSE41(swap);
+  const __m128i shift = _mm_cvtsi32_si128((int)padding);
+  // pick the R, G and B components of the 3 pixels held by 4 words, dropping alpha
+  const __m128i compact = _mm_setr_epi8(0, 1, 2, 5, 6, 8, 10, 12, 13, -1, -1, -1, -1, -1, -1, -1);
+
+  size_t x = 0;
+  for (; x + 6 <= width; x += 6, source += 8, target += 18) {
+    const __m128i words0 = _mm_loadu_si128((const __m128i *)source);
+    const __m128i words1 = _mm_loadu_si128((const __m128i *)(source + 4));
+
+    store9SSE41(target, _mm_shuffle_epi8(unpack10WordsSSE41(words0, byteOrder, shift), compact));
+    store9SSE41(target + 9, _mm_shuffle_epi8(unpack10WordsSSE41(words1, byteOrder, shift), compact));
+  }
+
+  unpack10FilledRGBAScalar(source, target, width - x, padding, swap);
+}
+
+// adds the full 10-bit components of 4 pixels at a time to sums
+__attribute__((target("sse4.1")))
+static void accumulate10FilledRGBSSE41(const uint32_t *source, uint32_t *sums, size_t width, unsigned padding, bool swap) {
+  const __m128i byteOrder = byteOrderSSE41(swap);
+  const __m128i shift = _mm_cvtsi32_si128((int)padding);
+  const __m128i mask = _mm_set1_epi32(0x3FF);
+
+  size_t x = 0;
+  for (; x + 4 <= width; x += 4) {
+    const __m128i words = _mm_sll_epi32(_mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(source + x)), byteOrder), shift);
+    const __m128i red = _mm_srli_epi32(words, 22);
+    const __m128i green = _mm_and_si128(_mm_srli_epi32(words, 12), mask);
+    const __m128i blue = _mm_and_si128(_mm_srli_epi32(words, 2), mask);
+
+    // interleave the components back into R0 G0 B0 R1 | G1 B1 R2 G2 | B2 R3 G3 B3
+    const __m128i redGreen01 = _mm_unpacklo_epi32(red, green);  // R0 G0 R1 G1
+    const __m128i redGreen23 = _mm_unpackhi_epi32(red, green);  // R2 G2 R3 G3
+    const __m128i pixels0 = _mm_blend_epi16(_mm_shuffle_epi32(redGreen01, _MM_SHUFFLE(2, 0, 1, 0)),
+                                            _mm_shuffle_epi32(blue, _MM_SHUFFLE(0, 0, 0, 0)), 0x30);
+    const __m128i pixels1 = _mm_blend_epi16(_mm_blend_epi16(_mm_shuffle_epi32(redGreen01, _MM_SHUFFLE(3, 3, 3, 3)),
+                                                            _mm_shuffle_epi32(blue, _MM_SHUFFLE(1, 1, 1, 1)), 0x0C),
+                                            _mm_shuffle_epi32(redGreen23, _MM_SHUFFLE(1, 0, 0, 0)), 0xF0);
+    const __m128i pixels2 = _mm_blend_epi16(_mm_shuffle_epi32(redGreen23, _MM_SHUFFLE(3, 3, 2, 2)),
+                                            _mm_shuffle_epi32(blue, _MM_SHUFFLE(3, 3, 3, 2)), 0xC3);
+
+    __m128i *target = (__m128i *)(sums + x * 3);
+    _mm_storeu_si128(target + 0, _mm_add_epi32(_mm_loadu_si128(target + 0), pixels0));
+    _mm_storeu_si128(target + 1, _mm_add_epi32(_mm_loadu_si128(target + 1), pixels1));
+    _mm_storeu_si128(target + 2, _mm_add_epi32(_mm_loadu_si128(target + 2), pixels2));
+  }
+
+  accumulate10FilledRGBScalar(source + x, sums + x * 3, width - x, padding, swap);
+}
+
+// Packed components are extracted 8 at a time: each 16-bit lane gets the two
+// bytes its component starts in and a multiply moves it to the top of the lane.
+
+// returns the top 8 bits of the 8 components starting at byte 0 of bytes in bytes 0-7
+__attribute__((always_inline, target("sse4.1")))
+static inline __m128i unpackPackedBytesSSE41(__m128i bytes, const unsigned bits) {
+  const __m128i pairs = (bits == 10) ? _mm_setr_epi8(0, 1, 1, 2, 2, 3, 3, 4, 5, 6, 6, 7, 7, 8, 8, 9)
+                                     : _mm_setr_epi8(0, 1, 1, 2, 3, 4, 4, 5, 6, 7, 7, 8, 9, 10, 10, 11);
+  const __m128i scale = (bits == 10) ? _mm_setr_epi16(64, 16, 4, 1, 64, 16, 4, 1)
+                                     : _mm_setr_epi16(16, 1, 16, 1, 16, 1, 16, 1);
+  const __m128i highBytes = _mm_setr_epi8(1, 3, 5, 7, 9, 11, 13, 15, -1, -1, -1, -1, -1, -1, -1, -1);
+
+  return _mm_shuffle_epi8(_mm_mullo_epi16(_mm_shuffle_epi8(bytes, pairs), scale), highBytes);
+}
+
+// Lines are unpacked in chunks of 128 components, which end on a word boundary,
+// copied to a buffer in host byte order first so the loads may run past the chunk.
+__attribute__((always_inline, target("sse4.1")))
+static inline void unpackPackedSSE41Loop(const uint32_t *source, uint8_t *target, size_t count, size_t components, bool swap, const unsigned bits) {
+  const __m128i byteOrder = byteOrderSSE41(swap);
+  // drop every fourth (alpha) component
+  const __m128i compact = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+  const size_t chunkWords = bits * 4;
+  uint32_t words[12 * 4 + 4];
+  uint8_t values[128];
+
+  size_t i = 0;
+  for (; i + 128 <= count; i += 128, source += chunkWords) {
+    for (size_t word = 0; word < chunkWords; word += 4) {
+      _mm_storeu_si128((__m128i *)(words + word), _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(source + word)), byteOrder));
+    }
+
+    uint8_t *output = (components == 4) ? values : target;
+    const uint8_t *bytes = (const uint8_t *)words;
+    for (size_t component = 0; component < 128; component += 16, bytes += bits * 2) {
+      const __m128i low = unpackPackedBytesSSE41(_mm_loadu_si128((const __m128i *)bytes), bits);
+      const __m128i high = unpackPackedBytesSSE41(_mm_loadu_si128((const __m128i *)(bytes + bits)), bits);
+      _mm_storeu_si128((__m128i *)(output + component), _mm_unpacklo_epi64(low, high));
+    }
+
+    if (components == 4) {
+      for (size_t component = 0; component < 128; component += 16, target += 12) {
+        store12SSE41(target, _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(values + component)), compact));
+      }
+    } else {
+      target += 128;
+    }
+  }
+
+  // chunks hold whole RGBA pixels, so the rest of the line starts with a pixel
+  if (bits == 10) {
+    unpack10PackedScalar(source, target, count - i, components, swap);
+  } else {
+    unpack12PackedScalar(source, target, count - i, components, swap);
+  }
+}
+
+__attribute__((target("sse4.1")))
+static void unpack10PackedSSE41(const uint32_t *source, uint8_t *target, size_t count, size_t components, bool swap) {
+  unpackPackedSSE41Loop(source, target, count, components, swap, 10);
+}
+
+__attribute__((target("sse4.1")))
+static void unpack12PackedSSE41(const uint32_t *source, uint8_t *target, size_t count, size_t components, bool swap) {
+  unpackPackedSSE41Loop(source, target, count, components, swap, 12);
+}
+
+// MARK: - AVX2
+
+__attribute__((target("avx2")))
+static inline __m256i unpack10WordsAVX2(__m256i words, __m256i byteOrder, __m128i padding) {
+  words = _mm256_sll_epi32(_mm256_shuffle_epi8(words, byteOrder), padding);
+
+  const __m256i component0 = _mm256_srli_epi32(words, 24);
+  const __m256i component1 = _mm256_and_si256(_mm256_srli_epi32(words, 6), _mm256_set1_epi32(0x0000FF00));
+  const __m256i component2 = _mm256_and_si256(_mm256_slli_epi32(words, 12), _mm256_set1_epi32(0x00FF0000));
+
+  return _mm256_or_si256(component0, _mm256_or_si256(component1, component2));
+}
+
+__attribute__((target("avx2")))
+static __m256i byteOrderAVX2(bool swap) {
+  return swap ? _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+                                 3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12)
+              : _mm256_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+                                 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+}
+
+__attribute__((target("avx2")))
+static void unpack10FilledRGBAVX2(const uint32_t *source, uint8_t *target, size_t width, unsigned padding, bool swap) {
+  const __m256i byteOrder = byteOrderAVX2(swap);
+  const __m128i shift = _mm_cvtsi32_si128((int)padding);
+  const __m256i compact = _mm256_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+                                           0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+
+  size_t x = 0;
+  for (; x + 16 <= width; x += 16) {
+    const __m256i pixels0 = _mm256_shuffle_epi8(unpack10WordsAVX2(_mm256_loadu_si256((const __m256i *)(source + x)), byteOrder, shift), compact);
+    const __m256i pixels1 = _mm256_shuffle_epi8(unpack10WordsAVX2(_mm256_loadu_si256((const __m256i *)(source + x + 8)), byteOrder, shift), compact);
+
+    store12SSE41(target + x * 3, _mm256_castsi256_si128(pixels0));
+    store12SSE41(target + x * 3 + 12, _mm256_extracti128_si256(pixels0, 1));
+    store12SSE41(target + x * 3 + 24, _mm256_castsi256_si128(pixels1));
+    store12SSE41(target + x * 3 + 36, _mm256_extracti128_si256(pixels1, 1));
+  }
+
+  unpack10FilledRGBScalar(source + x, target + x * 3, width - x, padding, swap);
+}
+
+__attribute__((target("avx2")))
+static void unpack10FilledRGBAAVX2(const uint32_t *source, uint8_t *target, size_t width, unsigned padding, bool swap) {
+  const __m256i byteOrder = byteOrderAVX2(swap);
+  const __m128i shift = _mm_cvtsi32_si128((int)padding);
+  const __m256i compact = _mm256_setr_epi8(0, 1, 2, 5, 6, 8, 10, 12, 13, -1, -1, -1, -1, -1, -1, -1,
+                                           0, 1, 2, 5, 6, 8, 10, 12, 13, -1, -1, -1, -1, -1, -1, -1);
+
+  size_t x = 0;
+  for (; x + 12 <= width; x += 12, source += 16, target += 36) {
+    const __m256i pixels0 = _mm256_shuffle_epi8(unpack10WordsAVX2(_mm256_loadu_si256((const __m256i *)source), byteOrder, shift), compact);
+    const __m256i pixels1 = _mm256_shuffle_epi8(unpack10WordsAVX2(_mm256_loadu_si256((const __m256i *)(source + 8)), byteOrder, shift), compact);
+
+    store9SSE41(target, _mm256_castsi256_si128(pixels0));
+    store9SSE41(target + 9, _mm256_extracti128_si256(pixels0, 1));
+    store9SSE41(target + 18, _mm256_castsi256_si128(pixels1));
+    store9SSE41(target + 27, _mm256_extracti128_si256(pixels1, 1));
+  }
+
+  unpack10FilledRGBAScalar(source, target, width - x, padding, swap);
+}
+
+#endif  // DPX_UNPACK_X86
+
+// MARK: - kernel selection
+
+static DPXUnpackLineFunction unpack10FilledRGB = unpack10FilledRGBScalar;
+static DPXUnpackLineFunction unpack10FilledRGBA = unpack10FilledRGBAScalar;
+static DPXAccumulateLineFunction accumulate10FilledRGB = accumulate10FilledRGBScalar;
+static DPXUnpackPackedFunction unpack10Packed = unpack10PackedScalar;
+static DPXUnpackPackedFunction unpack12Packed = unpack12PackedScalar;
+
+static pthread_once_t selectKernelsOnce = PTHREAD_ONCE_INIT;
+
+// the best instruction set the kernels may use, see DPXlimitInstructionSet
+static DPXInstructionSet instructionSetLimit = DPXInstructionSetAVX2;
+
+// returns true if the host CPU supports the instruction set and it is within the limit
+static bool DPXuseInstructionSet(DPXInstructionSet instructionSet) {
+  return (instructionSet <= instructionSetLimit) && (instructionSet <= DPXhostInstructionSet());
+}
+
+static void selectKernels(void) {
+  unpack10FilledRGB = unpack10FilledRGBScalar;
+  unpack10FilledRGBA = unpack10FilledRGBAScalar;
+  accumulate10FilledRGB = accumulate10FilledRGBScalar;
+  unpack10Packed = unpack10PackedScalar;
+  unpack12Packed = unpack12PackedScalar;
+#if DPX_UNPACK_X86
+  if (DPXuseInstructionSet(DPXInstructionSetAVX2)) {
+    unpack10FilledRGB = unpack10FilledRGBAVX2;
+    unpack10FilledRGBA = unpack10FilledRGBAAVX2;
+  } else if (DPXuseInstructionSet(DPXInstructionSetSSE41)) {
+    unpack10FilledRGB = unpack10FilledRGBSSE41;
+    unpack10FilledRGBA = unpack10FilledRGBASSE41;
+  }
+  if (DPXuseInstructionSet(DPXInstructionSetSSE41)) {
+    accumulate10FilledRGB = accumulate10FilledRGBSSE41;
+    unpack10Packed = unpack10PackedSSE41;
+    unpack12Packed = unpack12PackedSSE41;
+  }
+#endif
+}
+
+static void unpack10FilledRGBLine(const uint32_t *source, uint8_t *target, size_t width, unsigned padding, bool swap) {
+  pthread_once(&selectKernelsOnce, selectKernels);
+  unpack10FilledRGB(source, target, width, padding, swap);
+}
+
+static void unpack10FilledRGBALine(const uint32_t *source, uint8_t *target, size_t width, unsigned padding, bool swap) {
+  pthread_once(&selectKernelsOnce, selectKernels);
+  unpack10FilledRGBA(source, target, width, padding, swap);
+}
+
+static void accumulate10FilledRGBLine(const uint32_t *source, uint32_t *sums, size_t width, unsigned padding, bool swap) {
+  pthread_once(&selectKernelsOnce, selectKernels);
+  accumulate10FilledRGB(source, sums, width, padding, swap);
+}
+
+void DPXunpack10FilledRGBLine(const uint32_t *source, uint8_t *target, size_t width, uint16_t packing, bool swap) {
+  unpack10FilledRGBLine(source, target, width, DPXpadding(10, packing), swap);
+}
+
+void DPXunpack10FilledRGBALine(const uint32_t *source, uint8_t *target, size_t width, uint16_t packing, bool swap) {
+  unpack10FilledRGBALine(source, target, width, DPXpadding(10, packing), swap);
+}
+
+void DPXunpackPackedLine(const uint32_t *source, uint8_t *target, size_t width, uint8_t bitSize, size_t components, bool swap) {
+  pthread_once(&selectKernelsOnce, selectKernels);
+  if (bitSize == 10) {
+    unpack10Packed(source, target, width * components, components, swap);
+  } else {
+    unpack12Packed(source, target, width * components, components, swap);
+  }
+}
+
+// MARK: - line kernels
+
+// 8 and 16-bit components are copied as they are, the byte order is
+// left for CoreGraphics to deal with
+#define DPX_COPY_KERNEL(bytesPerPixel) \
+static void copyLine##bytesPerPixel(const void *source, void *target, size_t width, const void *context) { \
+  memcpy(target, source, width * bytesPerPixel); \
+}
+
+DPX_COPY_KERNEL(1)
+DPX_COPY_KERNEL(2)
+DPX_COPY_KERNEL(3)
+DPX_COPY_KERNEL(4)
+DPX_COPY_KERNEL(6)
+DPX_COPY_KERNEL(8)
+
+// luma lines are unpacked with the RGB kernels as pixels of 3 components,
+// and the last components, which don't fill a whole word, one by one
+__attribute__((always_inline))
+static inline void unpack10FilledLuma(const uint32_t *source, uint8_t *target, size_t width, unsigned padding, const bool swap) {
+  const size_t words = width / 3;
+  unpack10FilledRGBLine(source, target, words, padding, swap);
+
+  for (size_t component = words * 3; component < width; component++) {
+    target[component] = (DPXswapWord(source[words], swap) << padding) >> (24 - (component % 3) * 10);
+  }
+}
+
+__attribute__((always_inline))
+static inline void unpack12FilledComponents(const uint32_t *source, uint8_t *target, size_t components, unsigned padding, const bool swap) {
+  size_t component = 0;
+  for (; component + 2 <= components; component += 2) {
+    const uint32_t word = DPXswapWord(source[component / 2], swap) << padding;  // 1 32bit source word holds 2 12bit components
+
+    target[component + 0] = word >> 24;
+    target[component + 1] = word >> 8;
+  }
+  if (component < components) {
+    target[component] = (DPXswapWord(source[component / 2], swap) << padding) >> 24;
+  }
+}
+
+__attribute__((always_inline))
+static inline void unpack12FilledRGB(const uint32_t *source, uint8_t *target, size_t width, unsigned padding, const bool swap) {
+  unpack12FilledComponents(source, target, width * 3, padding, swap);
+}
+
+__attribute__((always_inline))
+static inline void unpack12FilledLuma(const uint32_t *source, uint8_t *target, size_t width, unsigned padding, const bool swap) {
+  unpack12FilledComponents(source, target, width, padding, swap);
+}
+
+// MARK: - accumulating kernels
+
+// The accumulating kernels unpack a line at full precision and add each
+// component to the matching entry of a line of sums, which is later
+// reduced to the scaled image by DPXreduceLine.
+
+#define DPX_ACCUMULATE_KERNEL(components) \
+static void accumulateLine8x##components(const void *source, uint32_t *sums, size_t width, const void *context) { \
+  const uint8_t *source8 = source; \
+  for (size_t i = 0; i < width * components; i++) { \
+    sums[i] += source8[i]; \
+  } \
+} \
+static void accumulateLine16x##components##Native(const void *source, uint32_t *sums, size_t width, const void *context) { \
+  const uint16_t *source16 = source; \
+  for (size_t i = 0; i < width * components; i++) { \
+    sums[i] += source16[i]; \
+  } \
+} \
+static void accumulateLine16x##components##Swapped(const void *source, uint32_t *sums, size_t width, const void *context) { \
+  const uint16_t *source16 = source; \
+  for (size_t i = 0; i < width * components; i++) { \
+    sums[i] += __builtin_bswap16(source16[i]); \
+  } \
+}
+
+DPX_ACCUMULATE_KERNEL(1)
+DPX_ACCUMULATE_KERNEL(3)
+DPX_ACCUMULATE_KERNEL(4)
+
+__attribute__((always_inline))
+static inline void accumulate10FilledRGBA(const uint32_t *source, uint32_t *sums, size_t width, unsigned padding, const bool swap) {
+  size_t x = 0;
+
+  // 3 RGBA pixels (12 components) fill exactly 4 words
+  for (; x + 3 <= width; x += 3, source += 4, sums += 9) {
+    const uint32_t word0 = DPXswapWord(source[0], swap) << padding;  // R0 G0 B0
+    const uint32_t word1 = DPXswapWord(source[1], swap) << padding;  // A0 R1 G1
+    const uint32_t word2 = DPXswapWord(source[2], swap) << padding;  // B1 A1 R2
+    const uint32_t word3 = DPXswapWord(source[3], swap) << padding;  // G2 B2 A2
+
+    sums[0] += (word0 >> 22) & 0x3FF;
+    sums[1] += (word0 >> 12) & 0x3FF;
+    sums[2] += (word0 >> 2) & 0x3FF;
+    sums[3] += (word1 >> 12) & 0x3FF;
+    sums[4] += (word1 >> 2) & 0x3FF;
+    sums[5] += (word2 >> 22) & 0x3FF;
+    sums[6] += (word2 >> 2) & 0x3FF;
+    sums[7] += (word3 >> 22) & 0x3FF;
+    sums[8] += (word3 >> 12) & 0x3FF;
+  }
+
+  // the last one or two pixels of the line
+  for (size_t pixel = 0; pixel < width - x; pixel++) {
+    for (size_t component = 0; component < 3; component++) {
+      const size_t componentIndex = pixel * 4 + component;
+      const uint32_t word = DPXswapWord(source[componentIndex / 3], swap) << padding;
+
+      sums[pixel * 3 + component] += (word >> (22 - (componentIndex % 3) * 10)) & 0x3FF;
+    }
+  }
+}
+
+__attribute__((always_inline))
+static inline void accumulate10FilledLuma(const uint32_t *source, uint32_t *sums, size_t width, unsigned padding, const bool swap) {
+  const size_t words = width / 3;
+  accumulate10FilledRGBLine(source, sums, words, padding, swap);
+
+  for (size_t component = words * 3; component < width; component++) {
+    sums[component] += ((DPXswapWord(source[words], swap) << padding) >> (22 - (component % 3) * 10)) & 0x3FF;
+  }
+}
+
+__attribute__((always_inline))
+static inline void accumulate12FilledComponents(const uint32_t *source, uint32_t *sums, size_t components, unsigned padding, const bool swap) {
+  size_t component = 0;
+  for (; component + 2 <= components; component += 2) {
+    const uint32_t word = DPXswapWord(source[component / 2], swap) << padding;  // 1 32bit source word holds 2 12bit components
+
+    sums[component + 0] += word >> 20;
+    sums[component + 1] += (word >> 4) & 0xFFF;
+  }
+  if (component < components) {
+    sums[component] += (DPXswapWord(source[component / 2], swap) << padding) >> 20;
+  }
+}
+
+__attribute__((always_inline))
+static inline void accumulate12FilledRGB(const uint32_t *source, uint32_t *sums, size_t width, unsigned padding, const bool swap) {
+  accumulate12FilledComponents(source, sums, width * 3, padding, swap);
+}
+
+__attribute__((always_inline))
+static inline void accumulate12FilledLuma(const uint32_t *source, uint32_t *sums, size_t width, unsigned padding, const bool swap) {
+  accumulate12FilledComponents(source, sums, width, padding, swap);
+}
+
+// native and swapped byte order instances of the 10 and 12-bit kernels,
+// for packing method A (1) and B (2)
+
+#define DPX_FILLED_KERNELS(bits, name, unpack, accumulate, packing) \
+static void line##name##Native(const void *source, void *target, size_t width, const void *context) { \
+  unpack(source, target, width, DPXpadding(bits, packing), false); \
+} \
+static void line##name##Swapped(const void *source, void *target, size_t width, const void *context) { \
+  unpack(source, target, width, DPXpadding(bits, packing), true); \
+} \
+static void accumulateLine##name##Native(const void *source, uint32_t *sums, size_t width, const void *context) { \
+  accumulate(source, sums, width, DPXpadding(bits, packing), false); \
+} \
+static void accumulateLine##name##Swapped(const void *source, uint32_t *sums, size_t width, const void *context) { \
+  accumulate(source, sums, width, DPXpadding(bits, packing), true); \
+}
+
+DPX_FILLED_KERNELS(10, 10FilledARGB, unpack10FilledRGBLine, accumulate10FilledRGBLine, 1)
+DPX_FILLED_KERNELS(10, 10FilledBRGB, unpack10FilledRGBLine, accumulate10FilledRGBLine, 2)
+DPX_FILLED_KERNELS(10, 10FilledARGBA, unpack10FilledRGBALine, accumulate10FilledRGBA, 1)
+DPX_FILLED_KERNELS(10, 10FilledBRGBA, unpack10FilledRGBALine, accumulate10FilledRGBA, 2)
+DPX_FILLED_KERNELS(12, 12FilledARGB, unpack12FilledRGB, accumulate12FilledRGB, 1)
+DPX_FILLED_KERNELS(12, 12FilledBRGB, unpack12FilledRGB, accumulate12FilledRGB, 2)
+DPX_FILLED_KERNELS(10, 10FilledALuma, unpack10FilledLuma, accumulate10FilledLuma, 1)
+DPX_FILLED_KERNELS(10, 10FilledBLuma, unpack10FilledLuma, accumulate10FilledLuma, 2)
+DPX_FILLED_KERNELS(12, 12FilledALuma, unpack12FilledLuma, accumulate12FilledLuma, 1)
+DPX_FILLED_KERNELS(12, 12FilledBLuma, unpack12FilledLuma, accumulate12FilledLuma, 2)
+
+// packed kernels, with components components per pixel in the source
+#define DPX_PACKED_KERNELS(bits, name, components) \
+static void line##bits##Packed##name##Native(const void *source, void *target, size_t width, const void *context) { \
+  DPXunpackPackedLine(source, target, width, bits, components, false); \
+} \
+static void line##bits##Packed##name##Swapped(const void *source, void *target, size_t width, const void *context) { \
+  DPXunpackPackedLine(source, target, width, bits, components, true); \
+} \
+static void accumulateLine##bits##Packed##name##Native(const void *source, uint32_t *sums, size_t width, const void *context) { \
+  accumulatePackedLoop(source, sums, width * components, components, bits, false); \
+} \
+static void accumulateLine##bits##Packed##name##Swapped(const void *source, uint32_t *sums, size_t width, const void *context) { \
+  accumulatePackedLoop(source, sums, width * components, components, bits, true); \
+}
+
+DPX_PACKED_KERNELS(10, Luma, 1)
+DPX_PACKED_KERNELS(10, RGB, 3)
+DPX_PACKED_KERNELS(10, RGBA, 4)
+DPX_PACKED_KERNELS(12, Luma, 1)
+DPX_PACKED_KERNELS(12, RGB, 3)
+DPX_PACKED_KERNELS(12, RGBA, 4)
+
+// MARK: - float kernels
+
+// 32-bit float components are tone mapped to 16 bits as they are unpacked, with
+// the sRGB transfer function looked up in a table of kDPXSRGBTableBits bits.
+// Alpha is only clipped.
+
+#define kDPXSRGBTableBits 14
+
+static uint16_t srgbTable[(1 << kDPXSRGBTableBits) + 1];
+
+// alpha is the index of the alpha component in each pixel,
+// or components if the pixels have no alpha
+typedef void (*DPXToneMapFunction)(const uint32_t *source, void *target, size_t count, size_t components, size_t alpha, bool swap, bool accumulate, const DPXToneMapping *toneMapping);
+
+// the factor a value from 0.0 to 1.0 is quantized with before it's
+// rounded, to 16 bits or to an index into srgbTable
+static inline float DPXtoneScale(DPXToneCurve curve, bool alpha) {
+  return (alpha || (curve == DPXToneCurveLinear)) ? 65535.0f : (float)(1 << kDPXSRGBTableBits);
+}
+
+// values are rounded the same way by the scalar and the vector kernels
+__attribute__((always_inline))
+static inline uint16_t DPXtoneMap(uint32_t word, float gain, DPXToneCurve curve, bool alpha) {
+  float value;
+  memcpy(&value, &word, sizeof(value));
+  value *= alpha ? 1.0f : gain;
+  value = (value > 0.0f) ? value : 0.0f;
+  if ((curve == DPXToneCurveReinhard) && !alpha) {
+    // x / (1 + x), written so it's 1.0 rather than NaN for infinity
+    value = 1.0f - 1.0f / (1.0f + value);
+  }
+  value = (value < 1.0f) ? value : 1.0f;
+
+  const uint32_t quantized = (uint32_t)(value * DPXtoneScale(curve, alpha) + 0.5f);
+  return (alpha || (curve == DPXToneCurveLinear)) ? (uint16_t)quantized : srgbTable[quantized];
+}
+
+// tone maps count components into 16-bit components, or adds them to sums if accumulate is true
+__attribute__((always_inline))
+static inline void toneMapFloatsScalarLoop(const uint32_t *source, void *target, size_t count, size_t components, size_t alpha, const bool swap, const bool accumulate, const DPXToneMapping *toneMapping) {
+  const float gain = exp2f(toneMapping->exposure);
+  const DPXToneCurve curve = toneMapping->curve;
+  uint16_t *target16 = target;
+  uint32_t *sums = target;
+
+  for (size_t i = 0; i < count; i++) {
+    const uint16_t value = DPXtoneMap(DPXswapWord(source[i], swap), gain, curve, (i % components) == alpha);
+    if (accumulate) {
+      sums[i] += value;
+    } else {
+      target16[i] = value;
+    }
+  }
+}
+
+static void toneMapFloatsScalar(const uint32_t *source, void *target, size_t count, size_t components, size_t alpha, bool swap, bool accumulate, const DPXToneMapping *toneMapping) {
+  if (swap) {
+    if (accumulate) {
+      toneMapFloatsScalarLoop(source, target, count, components, alpha, true, true, toneMapping);
+    } else {
+      toneMapFloatsScalarLoop(source, target, count, components, alpha, true, false, toneMapping);
+    }
+  } else {
+    if (accumulate) {
+      toneMapFloatsScalarLoop(source, target, count, components, alpha, false, true, toneMapping);
+    } else {
+      toneMapFloatsScalarLoop(source, target, count, components, alpha, false, false, toneMapping);
+    }
+  }
+}
+
+#if DPX_UNPACK_X86
+
+// tone maps 4 components at a time. Pixels with alpha have 4 components, or
+// are alpha only, so alpha is in the same lanes of every vector; the few
+// components left over at the end of other lines are tone mapped by the scalar loop.
+__attribute__((always_inline, target("sse4.1")))
+static inline void toneMapFloatsSSE41Loop(const uint32_t *source, void *target, size_t count, size_t components, size_t alpha, bool swap, const bool accumulate, const DPXToneMapping *toneMapping) {
+  const float gain = exp2f(toneMapping->exposure);
+  const DPXToneCurve curve = toneMapping->curve;
+  const __m128i byteOrder = byteOrderSSE41(swap);
+
+  // alpha lanes are all ones in alphaMask, and aren't scaled by the gain
+  float gains[4];
+  float scales[4];
+  int32_t alphaLanes[4];
+  for (size_t lane = 0; lane < 4; lane++) {
+    const bool isAlpha = (alpha < components) && (lane % components == alpha);
+    alphaLanes[lane] = isAlpha ? -1 : 0;
+    gains[lane] = isAlpha ? 1.0f : gain;
+    scales[lane] = DPXtoneScale(curve, isAlpha);
+  }
+  const __m128 alphaMask = _mm_castsi128_ps(_mm_loadu_si128((const __m128i *)alphaLanes));
+  const __m128 gainVector = _mm_loadu_ps(gains);
+  const __m128 scaleVector = _mm_loadu_ps(scales);
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 one = _mm_set1_ps(1.0f);
+  const __m128 half = _mm_set1_ps(0.5f);
+
+  uint16_t *target16 = target;
+  uint32_t *sums = target;
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    const __m128i words = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(source + i)), byteOrder);
+    // max returns its second operand for NaN
+    __m128 values = _mm_max_ps(_mm_mul_ps(_mm_castsi128_ps(words), gainVector), zero);
+    if (curve == DPXToneCurveReinhard) {
+      const __m128 compressed = _mm_sub_ps(one, _mm_div_ps(one, _mm_add_ps(one, values)));
+      values = _mm_blendv_ps(compressed, values, alphaMask);
+    }
+    values = _mm_min_ps(values, one);
+    __m128i quantized = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(values, scaleVector), half));
+
+    if (curve != DPXToneCurveLinear) {
+      // there's no gather before AVX2, the table is looked up lane by lane,
+      // with alpha, which is quantized to 16 bits, looking up entry 0
+      const __m128i indices = _mm_andnot_si128(_mm_castps_si128(alphaMask), quantized);
+      const __m128i encoded = _mm_setr_epi32(srgbTable[_mm_extract_epi32(indices, 0)], srgbTable[_mm_extract_epi32(indices, 1)],
+                                             srgbTable[_mm_extract_epi32(indices, 2)], srgbTable[_mm_extract_epi32(indices, 3)]);
+      quantized = _mm_castps_si128(_mm_blendv_ps(_mm_castsi128_ps(encoded), _mm_castsi128_ps(quantized), alphaMask));
+    }
+
+    if (accumulate) {
+      const __m128i lineSums = _mm_loadu_si128((const __m128i *)(sums + i));
+      _mm_storeu_si128((__m128i *)(sums + i), _mm_add_epi32(lineSums, quantized));
+    } else {
+      _mm_storel_epi64((__m128i *)(target16 + i), _mm_packus_epi32(quantized, quantized));
+    }
+  }
+
+  if (i < count) {
+    void *rest = accumulate ? (void *)(sums + i) : (void *)(target16 + i);
+    if (swap) {
+      toneMapFloatsScalarLoop(source + i, rest, count - i, components, alpha, true, accumulate, toneMapping);
+    } else {
+      toneMapFloatsScalarLoop(source + i, rest, count - i, components, alpha, false, accumulate, toneMapping);
+    }
+  }
+}
+
+__attribute__((target("sse4.1")))
+static void toneMapFloatsSSE41(const uint32_t *source, void *target, size_t count, size_t components, size_t alpha, bool swap, bool accumulate, const DPXToneMapping *toneMapping) {
+  if (accumulate) {
+    toneMapFloatsSSE41Loop(source, target, count, components, alpha, swap, true, toneMapping);
+  } else {
+    toneMapFloatsSSE41Loop(source, target, count, components, alpha, swap, false, toneMapping);
+  }
+}
+
+#endif  // DPX_UNPACK_X86
+
+static DPXToneMapFunction toneMapFloats = toneMapFloatsScalar;
+
+static pthread_once_t selectToneMappingOnce = PTHREAD_ONCE_INIT;
+
+static void selectToneMapping(void) {
+  for (size_t i = 0; i < sizeof(srgbTable) / sizeof(srgbTable[0]); i++) {
+    const double linear = (double)i / (double)(1 << kDPXSRGBTableBits);
+    const double encoded = (linear <= 0.0031308) ? linear * 12.92 : 1.055 * pow(linear, 1.0 / 2.4) - 0.055;
+    srgbTable[i] = (uint16_t)(encoded * 65535.0 + 0.5);
+  }
+
+  toneMapFloats = toneMapFloatsScalar;
+#if DPX_UNPACK_X86
+  if (DPXuseInstructionSet(DPXInstructionSetSSE41)) {
+    toneMapFloats = toneMapFloatsSSE41;
+  }
+#endif
+}
+
+static void toneMapFloatLine(const uint32_t *source, void *target, size_t count, size_t components, size_t alpha, bool swap, bool accumulate, const DPXToneMapping *toneMapping) {
+  pthread_once(&selectToneMappingOnce, selectToneMapping);
+  toneMapFloats(source, target, count, components, alpha, swap, accumulate, toneMapping);
+}
+
+// float kernels, with components components per pixel and alpha at index alpha
+// (components if there is none). The context is the image's DPXToneMapping.
+#define DPX_FLOAT_KERNELS(name, components, alpha) \
+static void line32Float##name##Native(const void *source, void *target, size_t width, const void *context) { \
+  toneMapFloatLine(source, target, width * components, components, alpha, false, false, context); \
+} \
+static void line32Float##name##Swapped(const void *source, void *target, size_t width, const void *context) { \
+  toneMapFloatLine(source, target, width * components, components, alpha, true, false, context); \
+} \
+static void accumulateLine32Float##name##Native(const void *source, uint32_t *sums, size_t width, const void *context) { \
+  toneMapFloatLine(source, sums, width * components, components, alpha, false, true, context); \
+} \
+static void accumulateLine32Float##name##Swapped(const void *source, uint32_t *sums, size_t width, const void *context) { \
+  toneMapFloatLine(source, sums, width * components, components, alpha, true, true, context); \
+}
+
+DPX_FLOAT_KERNELS(Luma, 1, 1)
+DPX_FLOAT_KERNELS(Alpha, 1, 0)
+DPX_FLOAT_KERNELS(RGB, 3, 3)
+DPX_FLOAT_KERNELS(RGBA, 4, 3)
+DPX_FLOAT_KERNELS(ABGR, 4, 0)
+
+// MARK: - table kernels
+
+// 10-bit components can be converted through a table of the 16-bit values of
+// all 1024 code values as they are unpacked, which is how log data is
+// converted to display values, see DPXbuildLogTable.
+
+// what the table kernels do with the components they look up
+typedef enum _dpxLookUpOutput {
+  DPXLookUp16,         // store them as 16-bit components
+  DPXLookUp8,          // store their upper 8 bits, like DPXconvertLine does for DPXComponentFormat8
+  DPXLookUpAccumulate  // add them to sums
+} DPXLookUpOutput;
+
+// stores the component with the given code looked up in table, or adds it to sums
+__attribute__((always_inline))
+static inline void lookUp10Component(uint32_t code, void *target, size_t index, const DPXLookUpOutput output, const uint16_t *table) {
+  switch (output) {
+    case DPXLookUp16:
+      ((uint16_t *)target)[index] = table[code & 0x3FF];
+      break;
+    case DPXLookUp8:
+      ((uint8_t *)target)[index] = (uint8_t)(table[code & 0x3FF] >> 8);
+      break;
+    case DPXLookUpAccumulate:
+      ((uint32_t *)target)[index] += table[code & 0x3FF];
+      break;
+  }
+}
+
+// converts count components, read 3 at a time from filled words, into the given
+// output, dropping every fourth (alpha) component if components is 4
+__attribute__((always_inline))
+static inline void lookUp10FilledLoop(const uint32_t *source, void *target, size_t count, size_t components, unsigned padding, const bool swap, const DPXLookUpOutput output, const uint16_t *table) {
+  size_t i = 0, written = 0;
+
+  // whole words at a time, 4 of them for 3 RGBA pixels, whose alpha components are skipped
+  if (components == 4) {
+    for (; i + 12 <= count; i += 12, source += 4, written += 9) {
+      const uint32_t word0 = DPXswapWord(source[0], swap) << padding;
+      const uint32_t word1 = DPXswapWord(source[1], swap) << padding;
+      const uint32_t word2 = DPXswapWord(source[2], swap) << padding;
+      const uint32_t word3 = DPXswapWord(source[3], swap) << padding;
+      lookUp10Component(word0 >> 22, target, written, output, table);
+      lookUp10Component(word0 >> 12, target, written + 1, output, table);
+      lookUp10Component(word0 >> 2, target, written + 2, output, table);
+      lookUp10Component(word1 >> 12, target, written + 3, output, table);
+      lookUp10Component(word1 >> 2, target, written + 4, output, table);
+      lookUp10Component(word2 >> 22, target, written + 5, output, table);
+      lookUp10Component(word2 >> 2, target, written + 6, output, table);
+      lookUp10Component(word3 >> 22, target, written + 7, output, table);
+      lookUp10Component(word3 >> 12, target, written + 8, output, table);
+    }
+  } else {
+    for (; i + 3 <= count; i += 3, source++, written += 3) {
+      const uint32_t word = DPXswapWord(*source, swap) << padding;
+      lookUp10Component(word >> 22, target, written, output, table);
+      lookUp10Component(word >> 12, target, written + 1, output, table);
+      lookUp10Component(word >> 2, target, written + 2, output, table);
+    }
+  }
+
+  // the components of the last pixels
+  for (; i < count; source++) {
+    const uint32_t word = DPXswapWord(*source, swap) << padding;
+    for (unsigned component = 0; (component < 3) && (i < count); component++, i++) {
+      if ((components != 4) || ((i & 3) != 3)) {
+        lookUp10Component(word >> (22 - component * 10), target, written++, output, table);
+      }
+    }
+  }
+}
+
+// like lookUp10FilledLoop for packed data, padding is ignored
+__attribute__((always_inline))
+static inline void lookUp10PackedLoop(const uint32_t *source, void *target, size_t count, size_t components, unsigned padding, const bool swap, const DPXLookUpOutput output, const uint16_t *table) {
+  DPXBitReader reader = { source, 0, 0 };
+
+  for (size_t i = 0, written = 0; i < count; i++) {
+    const uint32_t code = DPXreadComponent(&reader, 10, swap);
+    if ((components == 4) && ((i & 3) == 3)) {
+      continue;
+    }
+
+    lookUp10Component(code, target, written++, output, table);
+  }
+}
+
+// table kernels, with components components per pixel in the source.
+// The context is the table.
+#define DPX_TABLE_KERNELS(name, lookUp, components, packing) \
+static void line10Table##name##Native(const void *source, void *target, size_t width, const void *context) { \
+  lookUp(source, target, width * components, components, DPXpadding(10, packing), false, DPXLookUp16, context); \
+} \
+static void line10Table##name##Swapped(const void *source, void *target, size_t width, const void *context) { \
+  lookUp(source, target, width * components, components, DPXpadding(10, packing), true, DPXLookUp16, context); \
+} \
+static void line8Table##name##Native(const void *source, void *target, size_t width, const void *context) { \
+  lookUp(source, target, width * components, components, DPXpadding(10, packing), false, DPXLookUp8, context); \
+} \
+static void line8Table##name##Swapped(const void *source, void *target, size_t width, const void *context) { \
+  lookUp(source, target, width * components, components, DPXpadding(10, packing), true, DPXLookUp8, context); \
+} \
+static void accumulateLine10Table##name##Native(const void *source, uint32_t *sums, size_t width, const void *context) { \
+  lookUp(source, sums, width * components, components, DPXpadding(10, packing), false, DPXLookUpAccumulate, context); \
+} \
+static void accumulateLine10Table##name##Swapped(const void *source, uint32_t *sums, size_t width, const void *context) { \
+  lookUp(source, sums, width * components, components, DPXpadding(10, packing), true, DPXLookUpAccumulate, context); \
+}
+
+DPX_TABLE_KERNELS(FilledALuma, lookUp10FilledLoop, 1, 1)
+DPX_TABLE_KERNELS(FilledARGB, lookUp10FilledLoop, 3, 1)
+DPX_TABLE_KERNELS(FilledARGBA, lookUp10FilledLoop, 4, 1)
+DPX_TABLE_KERNELS(FilledBLuma, lookUp10FilledLoop, 1, 2)
+DPX_TABLE_KERNELS(FilledBRGB, lookUp10FilledLoop, 3, 2)
+DPX_TABLE_KERNELS(FilledBRGBA, lookUp10FilledLoop, 4, 2)
+DPX_TABLE_KERNELS(PackedLuma, lookUp10PackedLoop, 1, 0)
+DPX_TABLE_KERNELS(PackedRGB, lookUp10PackedLoop, 3, 0)
+DPX_TABLE_KERNELS(PackedRGBA, lookUp10PackedLoop, 4, 0)
+
+// the density of a printing density code value above the one before it
+#define kDPXDensityPerCode 0.002
+
+// the gamma of the negative film the densities were scanned from
+#define kDPXNegativeGamma 0.6
+
+void DPXbuildLogTable(uint32_t black, uint32_t white, uint16_t *table) {
+  if ((white == 0) || (white > 1023) || (black >= white)) {
+    // the reference values of the Cineon format
+    black = 95;
+    white = 685;
+  }
+
+  // relative exposure, 1.0 at the reference white, offset so the reference black is 0.0
+  const double blackExposure = pow(10.0, ((double)black - (double)white) * kDPXDensityPerCode / kDPXNegativeGamma);
+  for (size_t code = 0; code < kDPXTableSize; code++) {
+    const double exposure = pow(10.0, ((double)code - (double)white) * kDPXDensityPerCode / kDPXNegativeGamma);
+    double linear = (exposure - blackExposure) / (1.0 - blackExposure);
+    linear = (linear > 0.0) ? ((linear < 1.0) ? linear : 1.0) : 0.0;
+
+    const double encoded = (linear <= 0.0031308) ? linear * 12.92 : 1.055 * pow(linear, 1.0 / 2.4) - 0.055;
+    table[code] = (uint16_t)(encoded * 65535.0 + 0.5);
+  }
+}
+
+void DPXbuildLinearTable(uint16_t *table) {
+  // like DPXconvertLine, the top bits are repeated below the value
+  for (uint32_t code = 0; code < kDPXTableSize; code++) {
+    table[code] = (uint16_t)((code << 6) | (code >> 4));
+  }
+}
+
+// MARK: - kernel table
+
+typedef enum _dpxComponentLayout {
+  DPXLayoutLuma,   // descriptors 1-8, 1 component
+  DPXLayoutAlpha,  // descriptor 4, 1 component, unpacked like luma unless it is float data
+  DPXLayoutRGB,    // descriptor 50
+  DPXLayoutRGBA,   // descriptor 51
+  DPXLayoutABGR,   // descriptor 52
+  DPXLayoutOther   // anything else, treated as 3 components when copied
+} DPXComponentLayout;
+
+typedef struct _dpxLineKernelEntry {
+  uint8_t bitSize;
+  uint16_t packing;
+  DPXComponentLayout layout;
+  bool swap;
+  DPXLineKernels kernels;
+} DPXLineKernelEntry;
+
+// Entries for 8-bit data are looked up with packing 0 and swap false,
+// entries for 16 and 32-bit data with packing 0.
+static const DPXLineKernelEntry lineKernelTable[] = {
+  { 8, 0, DPXLayoutLuma, false, { copyLine1, accumulateLine8x1, 1, 8, NULL } },
+  { 8, 0, DPXLayoutRGB, false, { copyLine3, accumulateLine8x3, 3, 8, NULL } },
+  { 8, 0, DPXLayoutRGBA, false, { copyLine4, accumulateLine8x4, 4, 8, NULL } },
+  { 8, 0, DPXLayoutABGR, false, { copyLine4, accumulateLine8x4, 4, 8, NULL } },
+  { 8, 0, DPXLayoutOther, false, { copyLine3, accumulateLine8x3, 3, 8, NULL } },
+
+  { 16, 0, DPXLayoutLuma, false, { copyLine2, accumulateLine16x1Native, 1, 16, NULL } },
+  { 16, 0, DPXLayoutLuma, true, { copyLine2, accumulateLine16x1Swapped, 1, 16, NULL } },
+  { 16, 0, DPXLayoutRGB, false, { copyLine6, accumulateLine16x3Native, 3, 16, NULL } },
+  { 16, 0, DPXLayoutRGB, true, { copyLine6, accumulateLine16x3Swapped, 3, 16, NULL } },
+  { 16, 0, DPXLayoutRGBA, false, { copyLine8, accumulateLine16x4Native, 4, 16, NULL } },
+  { 16, 0, DPXLayoutRGBA, true, { copyLine8, accumulateLine16x4Swapped, 4, 16, NULL } },
+  { 16, 0, DPXLayoutABGR, false, { copyLine8, accumulateLine16x4Native, 4, 16, NULL } },
+  { 16, 0, DPXLayoutABGR, true, { copyLine8, accumulateLine16x4Swapped, 4, 16, NULL } },
+  { 16, 0, DPXLayoutOther, false, { copyLine6, accumulateLine16x3Native, 3, 16, NULL } },
+  { 16, 0, DPXLayoutOther, true, { copyLine6, accumulateLine16x3Swapped, 3, 16, NULL } },
+
+  { 10, 1, DPXLayoutLuma, false, { line10FilledALumaNative, accumulateLine10FilledALumaNative, 1, 10, NULL } },
+  { 10, 1, DPXLayoutLuma, true, { line10FilledALumaSwapped, accumulateLine10FilledALumaSwapped, 1, 10, NULL } },
+  { 10, 1, DPXLayoutRGB, false, { line10FilledARGBNative, accumulateLine10FilledARGBNative, 3, 10, NULL } },
+  { 10, 1, DPXLayoutRGB, true, { line10FilledARGBSwapped, accumulateLine10FilledARGBSwapped, 3, 10, NULL } },
+  { 10, 1, DPXLayoutRGBA, false, { line10FilledARGBANative, accumulateLine10FilledARGBANative, 3, 10, NULL } },
+  { 10, 1, DPXLayoutRGBA, true, { line10FilledARGBASwapped, accumulateLine10FilledARGBASwapped, 3, 10, NULL } },
+
+  { 10, 2, DPXLayoutLuma, false, { line10FilledBLumaNative, accumulateLine10FilledBLumaNative, 1, 10, NULL } },
+  { 10, 2, DPXLayoutLuma, true, { line10FilledBLumaSwapped, accumulateLine10FilledBLumaSwapped, 1, 10, NULL } },
+  { 10, 2, DPXLayoutRGB, false, { line10FilledBRGBNative, accumulateLine10FilledBRGBNative, 3, 10, NULL } },
+  { 10, 2, DPXLayoutRGB, true, { line10FilledBRGBSwapped, accumulateLine10FilledBRGBSwapped, 3, 10, NULL } },
+  { 10, 2, DPXLayoutRGBA, false, { line10FilledBRGBANative, accumulateLine10FilledBRGBANative, 3, 10, NULL } },
+  { 10, 2, DPXLayoutRGBA, true, { line10FilledBRGBASwapped, accumulateLine10FilledBRGBASwapped, 3, 10, NULL } },
+
+  { 12, 1, DPXLayoutLuma, false, { line12FilledALumaNative, accumulateLine12FilledALumaNative, 1, 12, NULL } },
+  { 12, 1, DPXLayoutLuma, true, { line12FilledALumaSwapped, accumulateLine12FilledALumaSwapped, 1, 12, NULL } },
+  { 12, 1, DPXLayoutRGB, false, { line12FilledARGBNative, accumulateLine12FilledARGBNative, 3, 12, NULL } },
+  { 12, 1, DPXLayoutRGB, true, { line12FilledARGBSwapped, accumulateLine12FilledARGBSwapped, 3, 12, NULL } },
+
+  { 12, 2, DPXLayoutLuma, false, { line12FilledBLumaNative, accumulateLine12FilledBLumaNative, 1, 12, NULL } },
+  { 12, 2, DPXLayoutLuma, true, { line12FilledBLumaSwapped, accumulateLine12FilledBLumaSwapped, 1, 12, NULL } },
+  { 12, 2, DPXLayoutRGB, false, { line12FilledBRGBNative, accumulateLine12FilledBRGBNative, 3, 12, NULL } },
+  { 12, 2, DPXLayoutRGB, true, { line12FilledBRGBSwapped, accumulateLine12FilledBRGBSwapped, 3, 12, NULL } },
+
+  { 10, 0, DPXLayoutLuma, false, { line10PackedLumaNative, accumulateLine10PackedLumaNative, 1, 10, NULL } },
+  { 10, 0, DPXLayoutLuma, true, { line10PackedLumaSwapped, accumulateLine10PackedLumaSwapped, 1, 10, NULL } },
+  { 10, 0, DPXLayoutRGB, false, { line10PackedRGBNative, accumulateLine10PackedRGBNative, 3, 10, NULL } },
+  { 10, 0, DPXLayoutRGB, true, { line10PackedRGBSwapped, accumulateLine10PackedRGBSwapped, 3, 10, NULL } },
+  { 10, 0, DPXLayoutRGBA, false, { line10PackedRGBANative, accumulateLine10PackedRGBANative, 3, 10, NULL } },
+  { 10, 0, DPXLayoutRGBA, true, { line10PackedRGBASwapped, accumulateLine10PackedRGBASwapped, 3, 10, NULL } },
+
+  { 12, 0, DPXLayoutLuma, false, { line12PackedLumaNative, accumulateLine12PackedLumaNative, 1, 12, NULL } },
+  { 12, 0, DPXLayoutLuma, true, { line12PackedLumaSwapped, accumulateLine12PackedLumaSwapped, 1, 12, NULL } },
+  { 12, 0, DPXLayoutRGB, false, { line12PackedRGBNative, accumulateLine12PackedRGBNative, 3, 12, NULL } },
+  { 12, 0, DPXLayoutRGB, true, { line12PackedRGBSwapped, accumulateLine12PackedRGBSwapped, 3, 12, NULL } },
+  { 12, 0, DPXLayoutRGBA, false, { line12PackedRGBANative, accumulateLine12PackedRGBANative, 3, 12, NULL } },
+  { 12, 0, DPXLayoutRGBA, true, { line12PackedRGBASwapped, accumulateLine12PackedRGBASwapped, 3, 12, NULL } },
+
+  { 32, 0, DPXLayoutLuma, false, { line32FloatLumaNative, accumulateLine32FloatLumaNative, 1, 16, NULL } },
+  { 32, 0, DPXLayoutLuma, true, { line32FloatLumaSwapped, accumulateLine32FloatLumaSwapped, 1, 16, NULL } },
+  { 32, 0, DPXLayoutAlpha, false, { line32FloatAlphaNative, accumulateLine32FloatAlphaNative, 1, 16, NULL } },
+  { 32, 0, DPXLayoutAlpha, true, { line32FloatAlphaSwapped, accumulateLine32FloatAlphaSwapped, 1, 16, NULL } },
+  { 32, 0, DPXLayoutRGB, false, { line32FloatRGBNative, accumulateLine32FloatRGBNative, 3, 16, NULL } },
+  { 32, 0, DPXLayoutRGB, true, { line32FloatRGBSwapped, accumulateLine32FloatRGBSwapped, 3, 16, NULL } },
+  { 32, 0, DPXLayoutRGBA, false, { line32FloatRGBANative, accumulateLine32FloatRGBANative, 4, 16, NULL } },
+  { 32, 0, DPXLayoutRGBA, true, { line32FloatRGBASwapped, accumulateLine32FloatRGBASwapped, 4, 16, NULL } },
+  { 32, 0, DPXLayoutABGR, false, { line32FloatABGRNative, accumulateLine32FloatABGRNative, 4, 16, NULL } },
+  { 32, 0, DPXLayoutABGR, true, { line32FloatABGRSwapped, accumulateLine32FloatABGRSwapped, 4, 16, NULL } },
+  { 32, 0, DPXLayoutOther, false, { line32FloatRGBNative, accumulateLine32FloatRGBNative, 3, 16, NULL } },
+  { 32, 0, DPXLayoutOther, true, { line32FloatRGBSwapped, accumulateLine32FloatRGBSwapped, 3, 16, NULL } },
+};
+
+// Entries for table kernels, all of them for 10-bit data.
+static const DPXLineKernelEntry tableLineKernelTable[] = {
+  { 10, 1, DPXLayoutLuma, false, { line10TableFilledALumaNative, accumulateLine10TableFilledALumaNative, 1, 16, NULL, line8TableFilledALumaNative } },
+  { 10, 1, DPXLayoutLuma, true, { line10TableFilledALumaSwapped, accumulateLine10TableFilledALumaSwapped, 1, 16, NULL, line8TableFilledALumaSwapped } },
+  { 10, 1, DPXLayoutRGB, false, { line10TableFilledARGBNative, accumulateLine10TableFilledARGBNative, 3, 16, NULL, line8TableFilledARGBNative } },
+  { 10, 1, DPXLayoutRGB, true, { line10TableFilledARGBSwapped, accumulateLine10TableFilledARGBSwapped, 3, 16, NULL, line8TableFilledARGBSwapped } },
+  { 10, 1, DPXLayoutRGBA, false, { line10TableFilledARGBANative, accumulateLine10TableFilledARGBANative, 3, 16, NULL, line8TableFilledARGBANative } },
+  { 10, 1, DPXLayoutRGBA, true, { line10TableFilledARGBASwapped, accumulateLine10TableFilledARGBASwapped, 3, 16, NULL, line8TableFilledARGBASwapped } },
+
+  { 10, 2, DPXLayoutLuma, false, { line10TableFilledBLumaNative, accumulateLine10TableFilledBLumaNative, 1, 16, NULL, line8TableFilledBLumaNative } },
+  { 10, 2, DPXLayoutLuma, true, { line10TableFilledBLumaSwapped, accumulateLine10TableFilledBLumaSwapped, 1, 16, NULL, line8TableFilledBLumaSwapped } },
+  { 10, 2, DPXLayoutRGB, false, { line10TableFilledBRGBNative, accumulateLine10TableFilledBRGBNative, 3, 16, NULL, line8TableFilledBRGBNative } },
+  { 10, 2, DPXLayoutRGB, true, { line10TableFilledBRGBSwapped, accumulateLine10TableFilledBRGBSwapped, 3, 16, NULL, line8TableFilledBRGBSwapped } },
+  { 10, 2, DPXLayoutRGBA, false, { line10TableFilledBRGBANative, accumulateLine10TableFilledBRGBANative, 3, 16, NULL, line8TableFilledBRGBANative } },
+  { 10, 2, DPXLayoutRGBA, true, { line10TableFilledBRGBASwapped, accumulateLine10TableFilledBRGBASwapped, 3, 16, NULL, line8TableFilledBRGBASwapped } },
+
+  { 10, 0, DPXLayoutLuma, false, { line10TablePackedLumaNative, accumulateLine10TablePackedLumaNative, 1, 16, NULL, line8TablePackedLumaNative } },
+  { 10, 0, DPXLayoutLuma, true, { line10TablePackedLumaSwapped, accumulateLine10TablePackedLumaSwapped, 1, 16, NULL, line8TablePackedLumaSwapped } },
+  { 10, 0, DPXLayoutRGB, false, { line10TablePackedRGBNative, accumulateLine10TablePackedRGBNative, 3, 16, NULL, line8TablePackedRGBNative } },
+  { 10, 0, DPXLayoutRGB, true, { line10TablePackedRGBSwapped, accumulateLine10TablePackedRGBSwapped, 3, 16, NULL, line8TablePackedRGBSwapped } },
+  { 10, 0, DPXLayoutRGBA, false, { line10TablePackedRGBANative, accumulateLine10TablePackedRGBANative, 3, 16, NULL, line8TablePackedRGBANative } },
+  { 10, 0, DPXLayoutRGBA, true, { line10TablePackedRGBASwapped, accumulateLine10TablePackedRGBASwapped, 3, 16, NULL, line8TablePackedRGBASwapped } },
+};
+
+static DPXComponentLayout DPXcomponentLayout(uint8_t descriptor) {
+  if (descriptor == 4) {
+    return DPXLayoutAlpha;
+  }
+  if (descriptor >= 1 && descriptor <= 8) {
+    return DPXLayoutLuma;
+  }
+  switch (descriptor) {
+    case 50:
+      return DPXLayoutRGB;
+    case 51:
+      return DPXLayoutRGBA;
+    case 52:
+      return DPXLayoutABGR;
+    default:
+      return DPXLayoutOther;
+  }
+}
+
+// looks up the kernels for the given layout in a table of count entries
+static bool DPXlookUpLineKernels(const DPXLineKernelEntry *table, size_t count, uint8_t bitSize, uint16_t packing, uint8_t descriptor, bool swap, DPXLineKernels *kernels) {
+  if (bitSize == 8 || bitSize == 16 || bitSize == 32) {
+    // whole components, packing doesn't matter
+    packing = 0;
+  }
+  if (bitSize == 8) {
+    // neither does the byte order
+    swap = false;
+  }
+
+  DPXComponentLayout layout = DPXcomponentLayout(descriptor);
+  if ((layout == DPXLayoutAlpha) && (bitSize != 32)) {
+    // integer alpha is unpacked like luma
+    layout = DPXLayoutLuma;
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    const DPXLineKernelEntry *entry = &table[i];
+    if (entry->bitSize == bitSize && entry->packing == packing && entry->layout == layout && entry->swap == swap) {
+      *kernels = entry->kernels;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+bool DPXfindLineKernels(uint8_t bitSize, uint16_t packing, uint8_t descriptor, bool swap, DPXLineKernels *kernels) {
+  return DPXlookUpLineKernels(lineKernelTable, sizeof(lineKernelTable) / sizeof(lineKernelTable[0]), bitSize, packing, descriptor, swap, kernels);
+}
+
+bool DPXfindTableLineKernels(uint16_t packing, uint8_t descriptor, bool swap, DPXLineKernels *kernels) {
+  return DPXlookUpLineKernels(tableLineKernelTable, sizeof(tableLineKernelTable) / sizeof(tableLineKernelTable[0]), 10, packing, descriptor, swap, kernels);
+}
+
+// MARK: - component conversion
+
+typedef void (*DPXConvertLineFunction)(const uint32_t *values, size_t width, size_t components, unsigned precision, size_t y, void *target);
+
+// 4x4 Bayer matrix: the order in which the pixels of a 4x4 block round up
+static const uint8_t ditherMatrix[4][4] = {
+  { 0, 8, 2, 10 },
+  { 12, 4, 14, 6 },
+  { 3, 11, 1, 9 },
+  { 15, 7, 13, 5 },
+};
+
+// returns the threshold added to the components of pixel x in row y before
+// their lowest droppedBits bits are dropped, between 0 and 2^droppedBits - 1
+static inline uint32_t DPXditherThreshold(size_t x, size_t y, unsigned droppedBits) {
+  return ((2u * ditherMatrix[y & 3][x & 3] + 1) << droppedBits) >> 5;
+}
+
+// converts a value between 0 and 1 to half precision, rounding to nearest even like F16C
+static inline uint16_t DPXhalf(float value) {
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  if (bits < 0x38800000) {
+    // below 2^-14 halves are subnormal, in steps of 2^-24
+    return (uint16_t)lrintf(value * 16777216.0f);
+  }
+
+  // rebias the exponent from 127 to 15 and round the mantissa from 23 to 10 bits
+  uint32_t half = (bits - 0x38000000) >> 13;
+  const uint32_t rest = bits & 0x1FFF;
+  if ((rest > 0x1000) || ((rest == 0x1000) && (half & 1))) {
+    half++;
+  }
+  return (uint16_t)half;
+}
+
+static void convertLine8Scalar(const uint32_t *values, size_t width, size_t components, unsigned precision, size_t y, void *target) {
+  uint8_t *target8 = target;
+  for (size_t i = 0; i < width * components; i++) {
+    target8[i] = (uint8_t)(values[i] >> (precision - 8));
+  }
+}
+
+static void convertLine8DitheredScalar(const uint32_t *values, size_t width, size_t components, unsigned precision, size_t y, void *target) {
+  const unsigned droppedBits = precision - 8;
+  uint8_t *target8 = target;
+
+  for (size_t x = 0; x < width; x++) {
+    const uint32_t threshold = DPXditherThreshold(x, y, droppedBits);
+    for (size_t component = 0; component < components; component++) {
+      const uint32_t value = (values[x * components + component] + threshold) >> droppedBits;
+      target8[x * components + component] = (value > 0xFF) ? 0xFF : (uint8_t)value;
+    }
+  }
+}
+
+// the top bits are repeated below the value, so the largest value becomes 0xFFFF
+static void convertLine16Scalar(const uint32_t *values, size_t width, size_t components, unsigned precision, size_t y, void *target) {
+  uint16_t *target16 = target;
+  for (size_t i = 0; i < width * components; i++) {
+    target16[i] = (uint16_t)((values[i] << (16 - precision)) | (values[i] >> (2 * precision - 16)));
+  }
+}
+
+static void convertLineHalfScalar(const uint32_t *values, size_t width, size_t components, unsigned precision, size_t y, void *target) {
+  const float scale = 1.0f / (float)((1u << precision) - 1);
+  uint16_t *target16 = target;
+  for (size_t i = 0; i < width * components; i++) {
+    target16[i] = DPXhalf((float)values[i] * scale);
+  }
+}
+
+#if DPX_UNPACK_X86
+
+// The vector kernels convert 16 components (8 for half) at a time, whatever
+// pixels they belong to, and leave the rest of the line to the plain C kernels.
+
+__attribute__((target("sse4.1")))
+static void convertLine8SSE41(const uint32_t *values, size_t width, size_t components, unsigned precision, size_t y, void *target) {
+  const __m128i shift = _mm_cvtsi32_si128((int)(precision - 8));
+  const size_t count = width * components;
+  uint8_t *target8 = target;
+
+  size_t i = 0;
+  for (; i + 16 <= count; i += 16) {
+    const __m128i values0 = _mm_srl_epi32(_mm_loadu_si128((const __m128i *)(values + i)), shift);
+    const __m128i values1 = _mm_srl_epi32(_mm_loadu_si128((const __m128i *)(values + i + 4)), shift);
+    const __m128i values2 = _mm_srl_epi32(_mm_loadu_si128((const __m128i *)(values + i + 8)), shift);
+    const __m128i values3 = _mm_srl_epi32(_mm_loadu_si128((const __m128i *)(values + i + 12)), shift);
+
+    _mm_storeu_si128((__m128i *)(target8 + i), _mm_packus_epi16(_mm_packus_epi32(values0, values1), _mm_packus_epi32(values2, values3)));
+  }
+
+  convertLine8Scalar(values + i, count - i, 1, precision, y, target8 + i);
+}
+
+// The dither pattern repeats every 4 pixels, and 48 components hold a whole
+// number of repeats for 1, 3 and 4 components per pixel, so the thresholds
+// of one line are laid out once for 48 components.
+__attribute__((target("sse4.1")))
+static void convertLine8DitheredSSE41(const uint32_t *values, size_t width, size_t components, unsigned precision, size_t y, void *target) {
+  const unsigned droppedBits = precision - 8;
+  const __m128i shift = _mm_cvtsi32_si128((int)droppedBits);
+  const size_t count = width * components;
+  uint8_t *target8 = target;
+
+  uint32_t thresholds[48];
+  for (size_t i = 0; i < 48; i++) {
+    thresholds[i] = DPXditherThreshold(i / components, y, droppedBits);
+  }
+
+  size_t i = 0;
+  for (; i + 16 <= count; i += 16) {
+    const uint32_t *threshold = thresholds + i % 48;
+    __m128i dithered[4];
+    for (size_t j = 0; j < 4; j++) {
+      const __m128i sum = _mm_add_epi32(_mm_loadu_si128((const __m128i *)(values + i + j * 4)), _mm_loadu_si128((const __m128i *)(threshold + j * 4)));
+      dithered[j] = _mm_srl_epi32(sum, shift);
+    }
+
+    // values rounded up to 256 saturate to 255
+    _mm_storeu_si128((__m128i *)(target8 + i), _mm_packus_epi16(_mm_packus_epi32(dithered[0], dithered[1]), _mm_packus_epi32(dithered[2], dithered[3])));
+  }
+
+  for (; i < count; i++) {
+    const uint32_t value = (values[i] + thresholds[i % 48]) >> droppedBits;
+    target8[i] = (value > 0xFF) ? 0xFF : (uint8_t)value;
+  }
+}
+
+__attribute__((target("sse4.1")))
+static void convertLine16SSE41(const uint32_t *values, size_t width, size_t components, unsigned precision, size_t y, void *target) {
+  const __m128i up = _mm_cvtsi32_si128((int)(16 - precision));
+  const __m128i down = _mm_cvtsi32_si128((int)(2 * precision - 16));
+  const size_t count = width * components;
+  uint16_t *target16 = target;
+
+  size_t i = 0;
+  for (; i + 16 <= count; i += 16) {
+    __m128i converted[4];
+    for (size_t j = 0; j < 4; j++) {
+      const __m128i value = _mm_loadu_si128((const __m128i *)(values + i + j * 4));
+      converted[j] = _mm_or_si128(_mm_sll_epi32(value, up), _mm_srl_epi32(value, down));
+    }
+
+    _mm_storeu_si128((__m128i *)(target16 + i), _mm_packus_epi32(converted[0], converted[1]));
+    _mm_storeu_si128((__m128i *)(target16 + i + 8), _mm_packus_epi32(converted[2], converted[3]));
+  }
+
+  convertLine16Scalar(values + i, count - i, 1, precision, y, target16 + i);
+}
+
+__attribute__((target("sse4.1,f16c")))
+static void convertLineHalfF16C(const uint32_t *values, size_t width, size_t components, unsigned precision, size_t y, void *target) {
+  const __m128 scale = _mm_set1_ps(1.0f / (float)((1u << precision) - 1));
+  const size_t count = width * components;
+  uint16_t *target16 = target;
+
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    const __m128 values0 = _mm_mul_ps(_mm_cvtepi32_ps(_mm_loadu_si128((const __m128i *)(values + i))), scale);
+    const __m128 values1 = _mm_mul_ps(_mm_cvtepi32_ps(_mm_loadu_si128((const __m128i *)(values + i + 4))), scale);
+
+    _mm_storeu_si128((__m128i *)(target16 + i), _mm_unpacklo_epi64(_mm_cvtps_ph(values0, _MM_FROUND_TO_NEAREST_INT),
+                                                                    _mm_cvtps_ph(values1, _MM_FROUND_TO_NEAREST_INT)));
+  }
+
+  convertLineHalfScalar(values + i, count - i, 1, precision, y, target16 + i);
+}
+
+#endif  // DPX_UNPACK_X86
+
+// indexed by DPXComponentFormat
+static DPXConvertLineFunction convertLine[] = { convertLine8Scalar, convertLine8DitheredScalar, convertLine16Scalar, convertLineHalfScalar };
+
+static pthread_once_t selectConversionOnce = PTHREAD_ONCE_INIT;
+
+static void selectConversion(void) {
+  convertLine[DPXComponentFormat8] = convertLine8Scalar;
+  convertLine[DPXComponentFormat8Dithered] = convertLine8DitheredScalar;
+  convertLine[DPXComponentFormat16] = convertLine16Scalar;
+  convertLine[DPXComponentFormatHalf] = convertLineHalfScalar;
+#if DPX_UNPACK_X86
+  if (DPXuseInstructionSet(DPXInstructionSetSSE41)) {
+    convertLine[DPXComponentFormat8] = convertLine8SSE41;
+    convertLine[DPXComponentFormat8Dithered] = convertLine8DitheredSSE41;
+    convertLine[DPXComponentFormat16] = convertLine16SSE41;
+    if (__builtin_cpu_supports("f16c")) {
+      convertLine[DPXComponentFormatHalf] = convertLineHalfF16C;
+    }
+  }
+#endif
+}
+
+void DPXconvertLine(const uint32_t *values, size_t width, size_t components, uint8_t precision, DPXComponentFormat format, size_t y, void *target) {
+  pthread_once(&selectConversionOnce, selectConversion);
+  convertLine[format](values, width, components, precision, y, target);
+}
+
+// MARK: - area average reduction
+
+// adds up the sums of count consecutive pixels with the given number of components
+static inline void addPixels(const uint32_t *sums, size_t components, size_t count, uint64_t *totals) {
+  for (size_t component = 0; component < components; component++) {
+    totals[component] = 0;
+  }
+  for (size_t x = 0; x < count; x++) {
+    for (size_t component = 0; component < components; component++) {
+      totals[component] += sums[x * components + component];
+    }
+  }
+}
+
+typedef void (*DPXAddPixelsFunction)(const uint32_t *sums, size_t components, size_t count, uint64_t *totals);
+typedef void (*DPXReduceLineFunction)(const DPXLineKernels *kernels, const uint32_t *sums, const size_t *columnStarts, size_t targetWidth, size_t lineCount, DPXComponentFormat format, size_t y, bool swap, void *target);
+
+// The reduction is written once and instantiated with each way of adding up
+// pixels, so the adding is inlined rather than called for every target pixel.
+__attribute__((always_inline))
+static inline void reduceLineLoop(const DPXLineKernels *kernels, const uint32_t *sums, const size_t *columnStarts, size_t targetWidth, size_t lineCount, DPXComponentFormat format, size_t y, bool swap, void *target, const DPXAddPixelsFunction addPixelsFunction) {
+  const size_t components = kernels->components;
+  // the averages are computed with 24 fractional bits and shifted down to 8 bits,
+  // or to 8 bits with 8 fractional bits to be dithered
+  const unsigned shift = 24 + kernels->precision - 8;
+  const unsigned ditherShift = 24 + kernels->precision - 16;
+  // and scaled to 16-bit or half components in floating point
+  const double maximum = (double)((1u << kernels->precision) - 1);
+  const double scale16 = 65535.0 / maximum / (double)(1 << 24);
+  const double scaleHalf = 1.0 / maximum / (double)(1 << 24);
+  // 16-bit data is reduced in the file's byte order
+  const bool swap16 = swap && (kernels->precision == 16);
+
+  uint8_t *target8 = target;
+  uint16_t *target16 = target;
+  uint64_t totals[4];
+
+  for (size_t x = 0; x < targetWidth; x++) {
+    const size_t columns = columnStarts[x + 1] - columnStarts[x];
+    addPixelsFunction(sums + columnStarts[x] * components, components, columns, totals);
+
+    // 1 / (number of source pixels) in 8.24 fixed point
+    const uint64_t weight = ((1 << 24) + (columns * lineCount) / 2) / (columns * lineCount);
+    const uint32_t threshold = DPXditherThreshold(x, y, 8);
+
+    for (size_t component = 0; component < components; component++) {
+      const uint64_t average = totals[component] * weight;
+      const size_t index = x * components + component;
+
+      switch (format) {
+        case DPXComponentFormat8: {
+          const uint64_t value = (average + (1ull << (shift - 1))) >> shift;
+          target8[index] = (value > 0xFF) ? 0xFF : (uint8_t)value;
+          break;
+        }
+        case DPXComponentFormat8Dithered: {
+          const uint64_t value = ((average >> ditherShift) + threshold) >> 8;
+          target8[index] = (value > 0xFF) ? 0xFF : (uint8_t)value;
+          break;
+        }
+        case DPXComponentFormat16: {
+          const double value = (double)average * scale16 + 0.5;
+          const uint16_t value16 = (value > 65535.0) ? 0xFFFF : (uint16_t)value;
+          target16[index] = swap16 ? __builtin_bswap16(value16) : value16;
+          break;
+        }
+        case DPXComponentFormatHalf: {
+          const double value = (double)average * scaleHalf;
+          target16[index] = DPXhalf((value > 1.0) ? 1.0f : (float)value);
+          break;
+        }
+      }
+    }
+  }
+}
+
+static void reduceLineScalar(const DPXLineKernels *kernels, const uint32_t *sums, const size_t *columnStarts, size_t targetWidth, size_t lineCount, DPXComponentFormat format, size_t y, bool swap, void *target) {
+  reduceLineLoop(kernels, sums, columnStarts, targetWidth, lineCount, format, y, swap, target, addPixels);
+}
+
+#if DPX_UNPACK_X86
+
+// adds up 3 or 4 components per pixel, one pixel per vector.
+// For 3 components the fourth lane picks up the next pixel and is ignored,
+// so sums has to extend one element beyond the last pixel.
+__attribute__((target("sse4.1")))
+static inline void addPixelsSSE41(const uint32_t *sums, size_t components, size_t count, uint64_t *totals) {
+  if (components < 3) {
+    addPixels(sums, components, count, totals);
+    return;
+  }
+
+  // two 64-bit accumulators per pair of components, so long spans of 16-bit data can't overflow
+  __m128i totals01 = _mm_setzero_si128();
+  __m128i totals23 = _mm_setzero_si128();
+  for (size_t x = 0; x < count; x++) {
+    const __m128i pixel = _mm_loadu_si128((const __m128i *)(sums + x * components));
+    totals01 = _mm_add_epi64(totals01, _mm_cvtepu32_epi64(pixel));
+    totals23 = _mm_add_epi64(totals23, _mm_cvtepu32_epi64(_mm_unpackhi_epi64(pixel, pixel)));
+  }
+
+  totals[0] = (uint64_t)_mm_cvtsi128_si64(totals01);
+  totals[1] = (uint64_t)_mm_extract_epi64(totals01, 1);
+  totals[2] = (uint64_t)_mm_cvtsi128_si64(totals23);
+  if (components == 4) {
+    totals[3] = (uint64_t)_mm_extract_epi64(totals23, 1);
+  }
+}
+
+__attribute__((target("sse4.1")))
+static void reduceLineSSE41(const DPXLineKernels *kernels, const uint32_t *sums, const size_t *columnStarts, size_t targetWidth, size_t lineCount, DPXComponentFormat format, size_t y, bool swap, void *target) {
+  reduceLineLoop(kernels, sums, columnStarts, targetWidth, lineCount, format, y, swap, target, addPixelsSSE41);
+}
+
+#endif  // DPX_UNPACK_X86
+
+static DPXReduceLineFunction reduceLine = reduceLineScalar;
+
+static pthread_once_t selectReductionOnce = PTHREAD_ONCE_INIT;
+
+static void selectReduction(void) {
+  reduceLine = reduceLineScalar;
+#if DPX_UNPACK_X86
+  if (DPXuseInstructionSet(DPXInstructionSetSSE41)) {
+    reduceLine = reduceLineSSE41;
+  }
+#endif
+}
+
+void DPXreduceLine(const DPXLineKernels *kernels, const uint32_t *sums, const size_t *columnStarts, size_t targetWidth, size_t lineCount, DPXComponentFormat format, size_t y, bool swap, void *target) {
+  pthread_once(&selectReductionOnce, selectReduction);
+  reduceLine(kernels, sums, columnStarts, targetWidth, lineCount, format, y, swap, target);
+}
+
+// MARK: - instruction sets
+
+DPXInstructionSet DPXhostInstructionSet(void) {
+#if DPX_UNPACK_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return DPXInstructionSetAVX2;
+  }
+  if (__builtin_cpu_supports("sse4.1")) {
+    return DPXInstructionSetSSE41;
+  }
+#endif
+  return DPXInstructionSetScalar;
+}
+
+void DPXlimitInstructionSet(DPXInstructionSet instructionSet) {
+  // the first selection has to have happened, or it would undo this one
+  pthread_once(&selectKernelsOnce, selectKernels);
+  pthread_once(&selectToneMappingOnce, selectToneMapping);
+  pthread_once(&selectConversionOnce, selectConversion);
+  pthread_once(&selectReductionOnce, selectReduction);
+
+  instructionSetLimit = instructionSet;
+  selectKernels();
+  selectToneMapping();
+  selectConversion();
+  selectReduction();
+}
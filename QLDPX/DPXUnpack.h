@@ -0,0 +1,177 @@
+//
+//  DPXUnpack.h
+//  QLDPX
+//
+//  Copyright © 2019 Thomas Angarano. All rights reserved.
+//
+
+#ifndef QLDPX_DPXUNPACK_H_
+#define QLDPX_DPXUNPACK_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Line unpack kernels
+//
+// Each kernel converts one line of DPX image data: 10 and 12-bit data into
+// 8-bit luma or RGB, 32-bit float data and 10-bit data looked up in a table
+// into 16-bit components, see DPXfindLineKernels and DPXfindTableLineKernels.
+// The best implementation for the host CPU (AVX2, SSE4.1 or plain C) is
+// selected at runtime the first time a kernel is called.
+// swap has to be true if the file's byte order differs from the host's.
+
+// void DPXunpack10FilledRGBLine(const uint32_t *, uint8_t *, size_t, uint16_t, bool)
+// unpacks width pixels of 10-bit RGB (descriptor 50), packed into 32-bit
+// words with packing method A (1) or B (2), into width * 3 bytes of 8-bit RGB.
+void DPXunpack10FilledRGBLine(const uint32_t *source, uint8_t *target, size_t width, uint16_t packing, bool swap);
+
+// void DPXunpack10FilledRGBALine(const uint32_t *, uint8_t *, size_t, uint16_t, bool)
+// unpacks width pixels of 10-bit RGBA (descriptor 51), packed into 32-bit
+// words with packing method A (1) or B (2), into width * 3 bytes of 8-bit RGB.
+// The alpha component is dropped.
+void DPXunpack10FilledRGBALine(const uint32_t *source, uint8_t *target, size_t width, uint16_t packing, bool swap);
+
+// void DPXunpackPackedLine(const uint32_t *, uint8_t *, size_t, uint8_t, size_t, bool)
+// unpacks width pixels of 10 or 12-bit data with 1, 3 or 4 components,
+// tightly packed into 32-bit words (packing 0), into width * 1 bytes of
+// 8-bit luma or width * 3 bytes of 8-bit RGB.
+// The alpha component of 4 component pixels is dropped.
+void DPXunpackPackedLine(const uint32_t *source, uint8_t *target, size_t width, uint8_t bitSize, size_t components, bool swap);
+
+// Component formats
+//
+// The images can be decoded to components of several formats, so a preview
+// takes no more memory than its consumer needs.
+
+typedef enum _dpxComponentFormat {
+  DPXComponentFormat8,          // 8-bit integer, lower bits truncated
+  DPXComponentFormat8Dithered,  // 8-bit integer, lower bits spread with an ordered dither
+  DPXComponentFormat16,         // 16-bit integer
+  DPXComponentFormatHalf        // 16-bit float, 0.0 to 1.0
+} DPXComponentFormat;
+
+// Float data
+//
+// 32-bit float components hold linear light or display values without a
+// fixed range. They are converted to 16-bit integers with an exposure and
+// a tone curve while they are unpacked, and take the same path as integer
+// data from there. Alpha is clipped to 0.0 to 1.0 and kept as it is.
+
+typedef enum _dpxToneCurve {
+  DPXToneCurveLinear,    // values are clipped to 0.0 to 1.0 and kept as they are
+  DPXToneCurveSRGB,      // values are clipped to 0.0 to 1.0 and encoded with the sRGB transfer function
+  DPXToneCurveReinhard   // values are compressed with x / (1 + x) and encoded like DPXToneCurveSRGB
+} DPXToneCurve;
+
+typedef struct _dpxToneMapping {
+  float exposure;        // in stops, values are multiplied by 2^exposure before the curve
+  DPXToneCurve curve;
+} DPXToneMapping;
+
+// Log data
+//
+// 10-bit components holding printing density, like those of scanned film,
+// are converted to display values while they are unpacked: each code value
+// is looked up in a table of kDPXTableSize 16-bit values, built once per image,
+// so the conversion doesn't add a pass over the image.
+
+// the number of entries of the table of a table kernel, one for every 10-bit code value
+#define kDPXTableSize 1024
+
+// void DPXbuildLogTable(uint32_t, uint32_t, uint16_t *)
+// fills the kDPXTableSize entries of table with the display values of the
+// printing density code values, given the code values of reference black and
+// white (ref_low_data and ref_high_data of the image element). Code values
+// are converted to linear light with the density per code value and the gamma
+// of Cineon negatives, clipped at reference white and encoded with the sRGB
+// transfer function. Undefined or invalid reference values are replaced with
+// Cineon's 95 and 685.
+void DPXbuildLogTable(uint32_t black, uint32_t white, uint16_t *table);
+
+// void DPXbuildLinearTable(uint16_t *)
+// fills the kDPXTableSize entries of table with the 16-bit values of the code
+// values, for other 10-bit elements of an image with log elements
+void DPXbuildLinearTable(uint16_t *table);
+
+// Decode kernel table
+//
+// The kernels for an image are looked up once from its layout (bit size,
+// packing, descriptor and byte order), so the loops that run for every
+// line don't have to test any of these.
+
+// void DPXLineKernel(const void *source, void *target, size_t width, const void *context)
+// converts a whole line of width pixels
+typedef void (*DPXLineKernel)(const void *source, void *target, size_t width, const void *context);
+
+// void DPXAccumulateLineKernel(const void *source, uint32_t *sums, size_t width, const void *context)
+// unpacks a line of width pixels at full precision and adds each component
+// to the matching entry of sums
+typedef void (*DPXAccumulateLineKernel)(const void *source, uint32_t *sums, size_t width, const void *context);
+
+typedef struct _dpxLineKernels {
+  DPXLineKernel line;                        // full size decoding, NULL if not supported
+  DPXAccumulateLineKernel accumulateLine;    // area average scaling, NULL if not supported
+  uint8_t components;                        // components per pixel accumulated by accumulateLine
+  uint8_t precision;                         // bits per component accumulated by accumulateLine
+  const void *context;                       // passed to the kernels: the DPXToneMapping of float data, the table of table kernels, NULL otherwise
+  DPXLineKernel line8;                       // full size decoding to DPXComponentFormat8 where line produces 16 bits, NULL if not supported
+} DPXLineKernels;
+
+// bool DPXfindLineKernels(uint8_t, uint16_t, uint8_t, bool, DPXLineKernels *)
+// looks up the kernels for image data with the given layout.
+// 10 and 12-bit data is converted to 8-bit luma or RGB, 8 and 16-bit data
+// is copied as it is, and 32-bit float data is tone mapped to 16-bit
+// components in the host's byte order. The context is left NULL, the
+// kernels of float data need it set to their DPXToneMapping.
+// returns false if the layout is not supported
+bool DPXfindLineKernels(uint8_t bitSize, uint16_t packing, uint8_t descriptor, bool swap, DPXLineKernels *kernels);
+
+// bool DPXfindTableLineKernels(uint16_t, uint8_t, bool, DPXLineKernels *)
+// looks up kernels for 10-bit image data with the given packing, descriptor
+// and byte order that convert every component through a table of kDPXTableSize
+// 16-bit values, see DPXbuildLogTable, to 16-bit components in the host's byte
+// order, or with line8 to the upper 8 bits of the table's values. The alpha
+// component of RGBA data is dropped. The context is left NULL, the kernels need
+// it set to the table.
+// returns false if the layout is not supported
+bool DPXfindTableLineKernels(uint16_t packing, uint8_t descriptor, bool swap, DPXLineKernels *kernels);
+
+// void DPXconvertLine(const uint32_t *, size_t, size_t, uint8_t, DPXComponentFormat, size_t, void *)
+// converts a line of width pixels with the given number of components, each
+// of the given precision as unpacked by an accumulating kernel, to the given
+// format in the host's byte order. y is the line's row in the image, which
+// picks the row of the dither pattern.
+void DPXconvertLine(const uint32_t *values, size_t width, size_t components, uint8_t precision, DPXComponentFormat format, size_t y, void *target);
+
+// void DPXreduceLine(const DPXLineKernels *, const uint32_t *, const size_t *, size_t, size_t, DPXComponentFormat, size_t, bool, void *)
+// reduces a line of sums, accumulated from lineCount source lines with
+// kernels->accumulateLine, to targetWidth pixels of the scaled image.
+// Target pixel x is the average of the source pixels in the columns from
+// columnStarts[x] up to columnStarts[x + 1]. sums needs one entry beyond its
+// last pixel. 16-bit integers reduced from 16-bit data stay in the file's byte
+// order. y is the target line's row in the scaled image.
+void DPXreduceLine(const DPXLineKernels *kernels, const uint32_t *sums, const size_t *columnStarts, size_t targetWidth, size_t lineCount, DPXComponentFormat format, size_t y, bool swap, void *target);
+
+// Instruction sets
+//
+// Every kernel with a SIMD implementation has a plain C twin that gives the
+// same results, see dpxcheck. Each instruction set includes the ones before it.
+
+typedef enum _dpxInstructionSet {
+  DPXInstructionSetScalar,  // plain C
+  DPXInstructionSetSSE41,   // SSE4.1, and F16C for half floats where the CPU has it
+  DPXInstructionSetAVX2
+} DPXInstructionSet;
+
+// DPXInstructionSet DPXhostInstructionSet(void)
+// returns the best instruction set of the host CPU the kernels have an implementation for
+DPXInstructionSet DPXhostInstructionSet(void);
+
+// void DPXlimitInstructionSet(DPXInstructionSet)
+// selects the kernels again, with instruction sets up to the given one.
+// DPXInstructionSetAVX2 is the default and leaves the choice to the host CPU.
+// It must not be called while lines are being decoded.
+void DPXlimitInstructionSet(DPXInstructionSet instructionSet);
+
+#endif  // QLDPX_DPXUNPACK_H_
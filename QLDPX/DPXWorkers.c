@@ -0,0 +1,83 @@
+//
+//  DPXWorkers.c
+//  QLDPX
+//
+//  Copyright © 2019 Thomas Angarano. All rights reserved.
+//
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#if __has_include(<dispatch/dispatch.h>)
+#include <dispatch/dispatch.h>
+#define DPX_WORKERS_DISPATCH 1
+#endif
+
+#include "DPXWorkers.h"
+
+// the number of workers a single DPXapply spreads its items over, 0 for no limit
+static size_t workerLimit = 0;
+
+// the items of a DPXapply, which the workers take in turn
+typedef struct _dpxWork {
+  DPXWorkFunction function;
+  void *context;
+  size_t count;
+  size_t next;  // the next item to be taken
+} DPXWork;
+
+static void DPXrunWorker(void *context, size_t worker) {
+  DPXWork *work = context;
+  for (size_t index = __atomic_fetch_add(&work->next, 1, __ATOMIC_RELAXED); index < work->count; index = __atomic_fetch_add(&work->next, 1, __ATOMIC_RELAXED)) {
+    work->function(work->context, index);
+  }
+}
+
+#if !DPX_WORKERS_DISPATCH
+static void *DPXrunWorkerThread(void *context) {
+  DPXrunWorker(context, 0);
+  return NULL;
+}
+#endif
+
+void DPXapply(size_t count, void *context, DPXWorkFunction function) {
+  const size_t limit = __atomic_load_n(&workerLimit, __ATOMIC_RELAXED);
+#if DPX_WORKERS_DISPATCH
+  if ((limit == 0) || (limit >= count)) {
+    dispatch_apply_f(count, DISPATCH_APPLY_AUTO, context, function);
+    return;
+  }
+#endif
+
+  const long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  size_t workers = (limit > 0) ? limit : ((cores > 0) ? (size_t)cores : 1);
+  workers = (workers < count) ? workers : count;
+  if (workers <= 1) {
+    for (size_t index = 0; index < count; index++) {
+      function(context, index);
+    }
+    return;
+  }
+
+  DPXWork work = { function, context, count, 0 };
+#if DPX_WORKERS_DISPATCH
+  dispatch_apply_f(workers, DISPATCH_APPLY_AUTO, &work, DPXrunWorker);
+#else
+  // the calling thread is one of the workers, and takes over the items of threads that couldn't be started
+  pthread_t *threads = malloc((workers - 1) * sizeof(pthread_t));
+  size_t started = 0;
+  while (threads && (started < workers - 1) && (pthread_create(&threads[started], NULL, DPXrunWorkerThread, &work) == 0)) {
+    started++;
+  }
+  DPXrunWorker(&work, 0);
+  for (size_t thread = 0; thread < started; thread++) {
+    pthread_join(threads[thread], NULL);
+  }
+  free(threads);
+#endif
+}
+
+void DPXsetWorkerLimit(size_t workers) {
+  __atomic_store_n(&workerLimit, workers, __ATOMIC_RELAXED);
+}
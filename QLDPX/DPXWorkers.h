@@ -0,0 +1,36 @@
+//
+//  DPXWorkers.h
+//  QLDPX
+//
+//  Copyright © 2019 Thomas Angarano. All rights reserved.
+//
+
+#ifndef QLDPX_DPXWORKERS_H_
+#define QLDPX_DPXWORKERS_H_
+
+#include <stddef.h>
+
+// Workers
+//
+// The decoders spread the bands of an image over worker threads. Where GCD
+// is available they are handed to its shared pool with dispatch_apply_f,
+// elsewhere, e.g. on Linux without libdispatch, to one thread per core
+// started for the call.
+// All functions are thread-safe.
+
+// void (*DPXWorkFunction)(void *, size_t)
+// does item index of the work, with the context given to DPXapply
+typedef void (*DPXWorkFunction)(void *context, size_t index);
+
+// void DPXapply(size_t, void *, DPXWorkFunction)
+// calls function for every index from 0 up to count, spread over the workers,
+// and returns once all calls have returned
+void DPXapply(size_t count, void *context, DPXWorkFunction function);
+
+// void DPXsetWorkerLimit(size_t)
+// limits the number of workers a single DPXapply spreads its items over,
+// 0 for as many as there are cores (the default). Meant for measuring how
+// decoding scales with the number of cores.
+void DPXsetWorkerLimit(size_t workers);
+
+#endif  // QLDPX_DPXWORKERS_H_
@@ -3,10 +3,46 @@
 #include <QuickLook/QuickLook.h>
 
 #include "DPXImage.h"
+#include "DPXImageCache.h"
+#include "DPXMetrics.h"
+#include "DPXRequests.h"
+
+// previews are drawn on screen, so the precision of 10 to 16-bit images is dithered away
+#define kDPXPreviewFormat DPXComponentFormat8Dithered
+
+// the largest size of the coarse stage of the preview, see decodeCGImagesProgressivelyFromDPX
+#define kDPXPreviewCoarseSize CGSizeMake(512, 512)
 
 OSStatus GeneratePreviewForURL(void *thisInterface, QLPreviewRequestRef preview, CFURLRef url, CFStringRef contentTypeUTI, CFDictionaryRef options);
 void CancelPreviewGeneration(void *thisInterface, QLPreviewRequestRef preview);
 
+typedef struct _dpxPreviewStages {
+  QLPreviewRequestRef preview;
+  DPXImage image;
+  CGSize size;
+  CGContextRef context;  // created for the first stage
+} DPXPreviewStages;
+
+// draws every stage of the preview as it arrives, the coarse stage scaled up to the size of
+// the image and the full size image over it. If the full size image can't be decoded, e.g.
+// because there isn't enough memory for it, the coarse stage is what's flushed.
+static void DPXdrawPreviewStage(CGImageRef image, bool final, void *info) {
+  DPXPreviewStages *stages = info;
+  if (final) {
+    cacheCGImage(stages->image, kDPXFullSize, kDPXPreviewFormat, image);
+  }
+  if (QLPreviewRequestIsCancelled(stages->preview)) {
+    return;
+  }
+
+  if (stages->context == NULL) {
+    stages->context = QLPreviewRequestCreateContext(stages->preview, stages->size, true, NULL);
+  }
+  if (stages->context) {
+    CGContextDrawImage(stages->context, CGRectMake(0.0, 0.0, stages->size.width, stages->size.height), image);
+  }
+}
+
 /* -----------------------------------------------------------------------------
    Generate a preview for file
 
@@ -15,46 +51,70 @@ void CancelPreviewGeneration(void *thisInterface, QLPreviewRequestRef preview);
 
 OSStatus GeneratePreviewForURL(void *thisInterface, QLPreviewRequestRef preview, CFURLRef url, CFStringRef contentTypeUTI, CFDictionaryRef options)
 {
-  // Is the URL's file extension '.dpx'?
-  CFStringRef urlString = CFURLCopyFileSystemPath(url, kCFURLPOSIXPathStyle);
-  if (CFStringCompareWithOptions(urlString, CFSTR(".dpx"), CFRangeMake(CFStringGetLength(urlString) - 4, 4), kCFCompareCaseInsensitive) != kCFCompareEqualTo) {
-    CFRelease(urlString);
-   return noErr;
-  };
-  CFRelease(urlString);
-
-  DPXImage img = readDPXImage(url);
-  if (!img) {
-    return noErr;
+  // a full size image cached by an earlier request saves reading the file again
+  CGImageRef cgDPX = createCachedCGImage(url, kDPXFullSize, kDPXPreviewFormat);
+  CGSize size = (cgDPX != NULL) ? CGSizeMake(CGImageGetWidth(cgDPX), CGImageGetHeight(cgDPX)) : CGSizeZero;
+  if (cgDPX == NULL) {
+    DPXCancellation cancellation = DPXbeginRequest(preview);
+    if (QLPreviewRequestIsCancelled(preview)) {
+      DPXendRequest(preview);
+      return noErr;
+    }
+
+    DPXImage img = readDPXImageWithCancellation(url, cancellation);
+    if (!img) {
+      DPXendRequest(preview);
+      return noErr;
+    }
+
+    // The above might have taken some time, so before proceeding make sure the user didn't cancel the request
+    if (QLPreviewRequestIsCancelled(preview)) {
+      releaseDPXImage(img);
+      DPXendRequest(preview);
+      return noErr;
+    }
+
+    // images without a supported layout aren't decoded in stages, they are drawn black
+    DPXPreviewStages stages = { preview, img, DPXsize(img), NULL };
+    if (!decodeCGImagesProgressivelyFromDPX(img, kDPXPreviewCoarseSize, kDPXPreviewFormat, DPXdrawPreviewStage, &stages) &&
+        (stages.context == NULL) && !QLPreviewRequestIsCancelled(preview)) {
+      cgDPX = createCGImageFromDPX(img, kDPXPreviewFormat);
+    }
+    size = stages.size;
+    releaseDPXImage(img);
+    DPXendRequest(preview);
+
+    DPXwriteMetrics();
+
+    if (stages.context != NULL) {
+      if (!QLPreviewRequestIsCancelled(preview)) {
+        QLPreviewRequestFlushContext(preview, stages.context);
+      }
+      CFRelease(stages.context);
+      return noErr;
+    }
+    if (cgDPX == NULL) {
+      return noErr;
+    }
   }
 
-  // The above might have taken some time, so before proceeding make sure the user didn't cancel the request
   if (QLPreviewRequestIsCancelled(preview)) {
-    releaseDPXImage(img);
+    CGImageRelease(cgDPX);
     return noErr;
   }
-  
-  CGSize size = DPXsize(img);
 
   CGContextRef cgContext = QLPreviewRequestCreateContext(preview, size, true, NULL);
   if (cgContext) {
-
-    CGImageRef cgDPX = createCGImageFromDPX(img);
-    if (cgDPX != NULL) {
-      CGContextDrawImage(cgContext, CGRectMake(0.0, 0.0, size.width, size.height), cgDPX);
-    }
-
+    CGContextDrawImage(cgContext, CGRectMake(0.0, 0.0, size.width, size.height), cgDPX);
     QLPreviewRequestFlushContext(preview, cgContext);
-
-    CGImageRelease(cgDPX);
     CFRelease(cgContext);
   }
 
-  releaseDPXImage(img);
+  CGImageRelease(cgDPX);
   return noErr;
 }
 
 void CancelPreviewGeneration(void *thisInterface, QLPreviewRequestRef preview)
 {
-    // Implement only if supported
+  DPXcancelRequest(preview);
 }
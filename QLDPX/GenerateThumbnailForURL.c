@@ -3,6 +3,13 @@
 #include <QuickLook/QuickLook.h>
 
 #include "DPXImage.h"
+#include "DPXImageCache.h"
+#include "DPXMetrics.h"
+#include "DPXRequests.h"
+#include "DPXThumbnailCache.h"
+
+// the precision of 10 to 16-bit images is dithered away, as for previews
+#define kDPXThumbnailFormat DPXComponentFormat8Dithered
 
 OSStatus GenerateThumbnailForURL(void *thisInterface, QLThumbnailRequestRef thumbnail, CFURLRef url, CFStringRef contentTypeUTI, CFDictionaryRef options, CGSize maxSize);
 void CancelThumbnailGeneration(void *thisInterface, QLThumbnailRequestRef thumbnail);
@@ -15,25 +22,44 @@ void CancelThumbnailGeneration(void *thisInterface, QLThumbnailRequestRef thumbn
 
 OSStatus GenerateThumbnailForURL(void *thisInterface, QLThumbnailRequestRef thumbnail, CFURLRef url, CFStringRef contentTypeUTI, CFDictionaryRef options, CGSize maxSize)
 {
-  // Is the URL's file extension '.dpx'?
-  CFStringRef urlString = CFURLCopyFileSystemPath(url, kCFURLPOSIXPathStyle);
-  if (CFStringCompareWithOptions(urlString, CFSTR(".dpx"), CFRangeMake(CFStringGetLength(urlString) - 4, 4), kCFCompareCaseInsensitive) != kCFCompareEqualTo) {
-    CFRelease(urlString);
+  CGSize thumbnailSize = QLThumbnailRequestGetMaximumSize(thumbnail);
+
+  // files that haven't changed since their thumbnail (or a larger image of them)
+  // was created are not read at all
+  CGImageRef cachedDPX = createCachedCGImage(url, thumbnailSize, kDPXThumbnailFormat);
+  if (cachedDPX == NULL) {
+    cachedDPX = createCachedThumbnailCGImage(url, thumbnailSize, kDPXThumbnailFormat);
+  }
+  if (cachedDPX != NULL) {
+    if (!QLThumbnailRequestIsCancelled(thumbnail)) {
+      QLThumbnailRequestSetImage(thumbnail, cachedDPX, NULL);
+    }
+    CGImageRelease(cachedDPX);
     return noErr;
-  };
-  CFRelease(urlString);
-  
-  DPXImage img = readDPXImage(url);
+  }
+
+  DPXCancellation cancellation = DPXbeginRequest(thumbnail);
+  if (QLThumbnailRequestIsCancelled(thumbnail)) {
+    DPXendRequest(thumbnail);
+    return noErr;
+  }
+
+  DPXImage img = readDPXImageWithCancellation(url, cancellation);
   if (!img) {
+    DPXendRequest(thumbnail);
     return noErr;
   }
   
   if (QLThumbnailRequestIsCancelled(thumbnail)) {
     releaseDPXImage(img);
+    DPXendRequest(thumbnail);
     return noErr;
   }
 
-  CGImageRef cgDPX = createThumbnailCGImageWithSizeFromDPX(img, QLThumbnailRequestGetMaximumSize(thumbnail));
+  CGImageRef cgDPX = createThumbnailCGImageWithSizeFromDPX(img, thumbnailSize, kDPXThumbnailFormat);
+  DPXendRequest(thumbnail);
+
+  DPXwriteMetrics();
  
   if (QLThumbnailRequestIsCancelled(thumbnail)) {
     CGImageRelease(cgDPX);
@@ -44,6 +70,8 @@ OSStatus GenerateThumbnailForURL(void *thisInterface, QLThumbnailRequestRef thum
   if (cgDPX != NULL) {
     CFDictionaryRef properties = NULL;
     QLThumbnailRequestSetImage(thumbnail, cgDPX, properties);
+    cacheCGImage(img, thumbnailSize, kDPXThumbnailFormat, cgDPX);
+    cacheThumbnailCGImage(img, thumbnailSize, kDPXThumbnailFormat, cgDPX);
   }
   
   CGImageRelease(cgDPX);
@@ -53,5 +81,5 @@ OSStatus GenerateThumbnailForURL(void *thisInterface, QLThumbnailRequestRef thum
 
 void CancelThumbnailGeneration(void *thisInterface, QLThumbnailRequestRef thumbnail)
 {
-    // Implement only if supported
+  DPXcancelRequest(thumbnail);
 }
@@ -0,0 +1,728 @@
+//
+//  main.c
+//  dpxbench
+//
+//  Copyright © 2019 Thomas Angarano. All rights reserved.
+//
+//  Measures the decoder on synthetic DPX files of every layout, resolution
+//  and byte order, and prints the results as CSV.
+//
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "DPXDecoder.h"
+#include "DPXUnpack.h"
+#include "DPXWorkers.h"
+
+#define kDefaultFrames 5
+#define kDefaultThumbnailSize 256
+
+// the most worker counts that can be given with -w
+#define kMaxWorkerCounts 16
+
+// the number of lines decoded at a time by the stream operation
+#define kStreamLines 64
+
+// the time the cancel operation decodes before cancelling, in nanoseconds
+#define kCancelDelay 2000000
+
+// the number of times every file of the reject operation is checked per frame
+#define kChecksPerFrame 1000
+
+// the size of the generic and industry headers in front of the image data
+#define kDPXHeaderSize 2048
+
+// the reference black and white code values of the 10-bit printing density files written with -l
+#define kLogBlack 95
+#define kLogWhite 685
+
+typedef struct _dpxResolution {
+  const char *name;
+  uint32_t width;
+  uint32_t height;
+} DPXResolution;
+
+typedef struct _dpxLayout {
+  uint8_t bitSize;
+  uint16_t packing;
+  uint8_t descriptor;
+} DPXLayout;
+
+static const DPXResolution resolutions[] = {
+  { "2k", 2048, 1080 },
+  { "4k", 4096, 2160 },
+  { "8k", 8192, 4320 },
+};
+
+// every layout of image_element[0] the decoder knows about, and some it doesn't yet:
+// those are still timed, but reported as unsupported
+static const DPXLayout layouts[] = {
+  { 8, 0, 6 }, { 8, 0, 50 }, { 8, 0, 51 }, { 8, 0, 52 },
+  { 10, 0, 6 }, { 10, 0, 50 }, { 10, 0, 51 },
+  { 10, 1, 6 }, { 10, 1, 50 }, { 10, 1, 51 }, { 10, 1, 52 },
+  { 10, 2, 50 }, { 10, 2, 51 },
+  { 12, 0, 50 },
+  { 12, 1, 50 }, { 12, 1, 51 },
+  { 16, 0, 6 }, { 16, 0, 50 }, { 16, 0, 51 }, { 16, 0, 52 },
+  { 32, 0, 6 }, { 32, 0, 50 }, { 32, 0, 51 },
+};
+
+typedef enum {
+  DPXOperationHeader,     // open the file and read the header fields
+  DPXOperationKernel,     // unpack every line with the line kernel, from memory
+  DPXOperationStream,     // decode the full size image kStreamLines at a time into the same buffer
+  DPXOperationFull,         // decode the full size image at once
+  DPXOperationProgressive,  // decode with DPXdecodeProgressively, a thumbnail first
+  DPXOperationThumbnail,    // decode a thumbnail
+  DPXOperationCancel,       // decode the full size image on another thread and cancel it after kCancelDelay
+  DPXOperationReject        // check the magic number of files of other kinds, see rejectFiles
+} DPXOperation;
+
+static const char *operationNames[] = { "header", "kernel", "stream", "full", "progressive", "thumbnail", "cancel", "reject" };
+
+// a file of the reject operation: it starts with magic and is size bytes long,
+// the rest being a hole, or a DPX file if magicLength is 0
+typedef struct _dpxRejectFile {
+  const char *name;
+  const uint8_t *magic;
+  size_t magicLength;
+  off_t size;
+  bool accepted;  // whether it should be taken for a DPX file
+} DPXRejectFile;
+
+static const uint8_t jpegMagic[] = { 0xFF, 0xD8, 0xFF, 0xE0 };
+static const uint8_t movMagic[] = { 0x00, 0x00, 0x00, 0x14, 'f', 't', 'y', 'p', 'q', 't' };
+static const uint8_t exrMagic[] = { 0x76, 0x2F, 0x31, 0x01 };
+static const uint8_t textMagic[] = { 'n', 'o', 't', 'e', 's', '\n' };
+static const uint8_t shortMagic[] = { 'S', 'D', 'P' };
+
+static const DPXRejectFile rejectFiles[] = {
+  { "notes.txt", textMagic, sizeof(textMagic), 4096, false },
+  { "empty", NULL, 0, 0, false },
+  { "short.dpx", shortMagic, sizeof(shortMagic), sizeof(shortMagic), false },  // too short for the magic number
+  { "photo.jpg", jpegMagic, sizeof(jpegMagic), 4 << 20, false },
+  { "render.exr", exrMagic, sizeof(exrMagic), 64 << 20, false },
+  { "movie.mov", movMagic, sizeof(movMagic), (off_t)4 << 30, false },
+  { "frame.0001", NULL, 0, -1, true },                                 // a DPX file without extension
+};
+
+// returns true if the operation decodes to a component format, and is timed once for every format
+static bool hasComponentFormat(DPXOperation operation) {
+  return (operation != DPXOperationHeader) && (operation != DPXOperationKernel) && (operation != DPXOperationReject);
+}
+
+// returns true if the operation spreads its work over the workers, and is timed once for every worker count
+static bool usesWorkers(DPXOperation operation) {
+  return hasComponentFormat(operation);
+}
+
+// the names of the component formats, in the order of DPXComponentFormat
+static const char *componentFormatNames[] = { "8", "8d", "16", "half" };
+
+static size_t DPXcomponents(uint8_t descriptor) {
+  if (descriptor >= 1 && descriptor <= 8) {
+    return 1;
+  }
+  return (descriptor == 51 || descriptor == 52) ? 4 : 3;
+}
+
+// returns the length of one line in bytes, the same way the decoder computes it
+static size_t DPXlineLength(const DPXLayout *layout, size_t width) {
+  const size_t componentsPerLine = width * DPXcomponents(layout->descriptor);
+
+  size_t words = 0;
+  if (layout->bitSize == 10 && layout->packing != 0) {
+    words = (componentsPerLine + 2) / 3;
+  } else if (layout->bitSize == 12 && layout->packing != 0) {
+    words = (componentsPerLine + 1) / 2;
+  } else {
+    words = (componentsPerLine * layout->bitSize + 31) / 32;
+  }
+
+  return words * 4;
+}
+
+static void put16(uint8_t *header, size_t offset, uint16_t value, bool swap) {
+  value = swap ? __builtin_bswap16(value) : value;
+  memcpy(header + offset, &value, sizeof(value));
+}
+
+static void put32(uint8_t *header, size_t offset, uint32_t value, bool swap) {
+  value = swap ? __builtin_bswap32(value) : value;
+  memcpy(header + offset, &value, sizeof(value));
+}
+
+static uint32_t nextRandom(uint32_t *state) {
+  *state ^= *state << 13;
+  *state ^= *state >> 17;
+  *state ^= *state << 5;
+  return *state;
+}
+
+// writes a DPX file with the given layout and size in the host's byte order, or the
+// opposite one if swap is true. The pixels are noise, so nothing can be skipped. If log
+// is true the data is printing density with the reference black and white of Cineon.
+static bool writeSyntheticDPX(const char *path, const DPXLayout *layout, const DPXResolution *resolution, bool swap, bool log) {
+  const size_t lineLength = DPXlineLength(layout, resolution->width);
+  const size_t fileSize = kDPXHeaderSize + lineLength * resolution->height;
+
+  uint8_t header[kDPXHeaderSize];
+  memset(header, 0, sizeof(header));
+  put32(header, 0, 0x53445058, swap);                 // magic_num
+  put32(header, 4, kDPXHeaderSize, swap);             // offset
+  memcpy(header + 8, "V2.0", 4);                      // vers
+  put32(header, 16, (uint32_t)fileSize, swap);          // file_size
+  put32(header, 24, 1664, swap);                      // gen_hdr_size
+  put32(header, 28, 384, swap);                       // ind_hdr_size
+  memcpy(header + 160, "dpxbench", 8);                // creator
+  put32(header, 660, 0xFFFFFFFF, swap);               // key
+  put16(header, 768, 0, swap);                        // orientation
+  put16(header, 770, 1, swap);                        // element_number
+  put32(header, 772, resolution->width, swap);        // pixels_per_line
+  put32(header, 776, resolution->height, swap);       // lines_per_image_ele
+
+  // image_element[0]
+  if (log) {
+    put32(header, 780 + 4, kLogBlack, swap);          // ref_low_data
+    put32(header, 780 + 12, kLogWhite, swap);         // ref_high_data
+  } else if (layout->bitSize < 32) {
+    put32(header, 780 + 12, (1u << layout->bitSize) - 1, swap);  // ref_high_data
+  }
+  header[780 + 20] = layout->descriptor;
+  header[780 + 21] = log ? 1 : 2;                     // transfer: printing density or linear
+  header[780 + 22] = 2;                               // colorimetric: linear
+  header[780 + 23] = layout->bitSize;
+  put16(header, 780 + 24, layout->packing, swap);
+  put32(header, 780 + 28, kDPXHeaderSize, swap);      // data_offset
+
+  FILE *file = fopen(path, "wb");
+  if (!file) {
+    return false;
+  }
+
+  uint8_t *line = malloc(lineLength);
+  bool written = (line != NULL) && (fwrite(header, 1, sizeof(header), file) == sizeof(header));
+  uint32_t state = 0x2545F491;
+  for (size_t y = 0; written && (y < resolution->height); y++) {
+    for (size_t i = 0; i + 4 <= lineLength; i += 4) {
+      uint32_t word = nextRandom(&state);
+      if (layout->bitSize == 32) {
+        // floats between 0 and 2
+        float value = (float)(word >> 8) / (float)(1 << 23);
+        memcpy(&word, &value, sizeof(word));
+        word = swap ? __builtin_bswap32(word) : word;
+      }
+      memcpy(line + i, &word, sizeof(word));
+    }
+    written = (fwrite(line, 1, lineLength, file) == lineLength);
+  }
+
+  free(line);
+  written = (fclose(file) == 0) && written;
+  if (!written) {
+    unlink(path);
+  }
+  return written;
+}
+
+// writes the file of the reject operation to path, see DPXRejectFile
+static bool writeRejectFile(const char *path, const DPXRejectFile *rejectFile) {
+  if (rejectFile->size < 0) {
+    static const DPXLayout layout = { 10, 1, 50 };
+    return writeSyntheticDPX(path, &layout, &resolutions[0], false, false);
+  }
+
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    return false;
+  }
+  bool written = (write(fd, rejectFile->magic, rejectFile->magicLength) == (ssize_t)rejectFile->magicLength) &&
+                 (ftruncate(fd, rejectFile->size) == 0);
+  written = (close(fd) == 0) && written;
+  if (!written) {
+    unlink(path);
+  }
+  return written;
+}
+
+static double now(void) {
+  struct timespec time;
+  clock_gettime(CLOCK_MONOTONIC, &time);
+  return (double)time.tv_sec + (double)time.tv_nsec / 1e9;
+}
+
+// returns the largest resident set size of the process so far, in kilobytes
+static long peakResidentSize(void) {
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) {
+    return -1;
+  }
+#ifdef __APPLE__
+  return usage.ru_maxrss / 1024;  // bytes on macOS
+#else
+  return usage.ru_maxrss;         // kilobytes elsewhere
+#endif
+}
+
+// decodes the image to a thumbnail no larger than thumbnailSize x thumbnailSize pixels
+static bool decodeThumbnail(DPXImage image, DPXComponentFormat format, size_t thumbnailSize) {
+  size_t thumbwidth, thumbheight;
+  DPXthumbnailDimensions(DPXwidth(image), DPXheight(image), thumbnailSize, thumbnailSize, &thumbwidth, &thumbheight);
+
+  // room for the widest pixels of any format
+  void *pixels = malloc(thumbwidth * thumbheight * 8);
+  const bool decoded = pixels && DPXdecodeThumbnail(image, thumbwidth, thumbheight, format, pixels, thumbwidth * 8);
+  free(pixels);
+  return decoded;
+}
+
+// decodes lines lines of the image at a time into a buffer for that many, which
+// are all lines of the image unless lines is smaller than its height
+static bool decodeFullSize(DPXImage image, DPXComponentFormat format, size_t lines) {
+  size_t bitsPerComponent, bitsPerPixel;
+  if (!DPXgetLineFormat(image, format, &bitsPerComponent, &bitsPerPixel)) {
+    return false;
+  }
+
+  const size_t height = DPXheight(image);
+  const size_t bytesPerRow = bitsPerPixel / 8 * DPXwidth(image);
+  lines = (lines < height) ? lines : height;
+  void *buffer = malloc(bytesPerRow * lines);
+  bool decoded = (buffer != NULL);
+  for (size_t y = 0; decoded && (y < height); y += lines) {
+    const size_t count = (height - y < lines) ? height - y : lines;
+    decoded = DPXdecodeLines(image, y, count, format, buffer, bytesPerRow);
+  }
+  free(buffer);
+  return decoded;
+}
+
+// stores the time the first stage of DPXdecodeProgressively arrived in info
+static void recordFirstStage(const DPXProgressiveStage *stage, void *info) {
+  double *arrival = info;
+  *arrival = (*arrival == 0) ? now() : *arrival;
+}
+
+// decodes the image with DPXdecodeProgressively, a thumbnail of the given size first,
+// and stores the seconds until the first stage arrived in firstStageSeconds
+static bool decodeProgressively(DPXImage image, DPXComponentFormat format, size_t thumbnailSize, double *firstStageSeconds) {
+  size_t bitsPerComponent, bitsPerPixel;
+  if (!DPXgetLineFormat(image, format, &bitsPerComponent, &bitsPerPixel)) {
+    return false;
+  }
+
+  const size_t bytesPerRow = bitsPerPixel / 8 * DPXwidth(image);
+  void *buffer = malloc(bytesPerRow * DPXheight(image));
+  const double start = now();
+  double arrival = 0;
+  const bool decoded = buffer && DPXdecodeProgressively(image, thumbnailSize, thumbnailSize, format, buffer, bytesPerRow, recordFirstStage, &arrival);
+  *firstStageSeconds = (arrival > 0) ? arrival - start : 0;
+  free(buffer);
+  return decoded;
+}
+
+// runs the operation on the file frames times and returns the seconds per frame, or a
+// negative number if the file couldn't be read. For the progressive operation, the
+// seconds per frame until its first stage arrived are stored in firstStageSeconds.
+static double timeOperation(const char *path, DPXOperation operation, DPXComponentFormat format, size_t frames, size_t thumbnailSize, double *firstStageSeconds) {
+  const double start = now();
+  double firstStage = 0;
+
+  for (size_t frame = 0; frame < frames; frame++) {
+    DPXImage image = readDPXImageAtPath(path, NULL);
+    if (!image) {
+      return -1.0;
+    }
+
+    switch (operation) {
+      case DPXOperationHeader: {
+        const char *creator = DPXcreator(image);
+        if ((DPXwidth(image) == 0) || !creator) {
+          releaseDPXImage(image);
+          return -1.0;
+        }
+        break;
+      }
+      case DPXOperationKernel:
+      case DPXOperationCancel:
+      case DPXOperationReject:
+        // timed by timeKernel, timeCancel and timeReject
+        break;
+      case DPXOperationStream:
+        decodeFullSize(image, format, kStreamLines);
+        break;
+      case DPXOperationFull:
+        decodeFullSize(image, format, SIZE_MAX);
+        break;
+      case DPXOperationProgressive: {
+        double stageSeconds = 0;
+        decodeProgressively(image, format, thumbnailSize, &stageSeconds);
+        firstStage += stageSeconds;
+        break;
+      }
+      case DPXOperationThumbnail:
+        decodeThumbnail(image, format, thumbnailSize);
+        break;
+    }
+
+    releaseDPXImage(image);
+  }
+
+  *firstStageSeconds = firstStage / (double)frames;
+  return (now() - start) / (double)frames;
+}
+
+// unpacks every line of the file's image data frames times with the layout's line
+// kernel, from a copy of the file in memory, so only the kernel is timed
+// returns the seconds per frame, or a negative number if the file couldn't be read
+static double timeKernel(const char *path, const DPXLayout *layout, const DPXResolution *resolution, bool swap, size_t frames) {
+  DPXLineKernels kernels;
+  if (!DPXfindLineKernels(layout->bitSize, layout->packing, layout->descriptor, swap, &kernels) || !kernels.line) {
+    return 0;
+  }
+  const DPXToneMapping toneMapping = { 0, DPXToneCurveLinear };
+  kernels.context = (layout->bitSize == 32) ? &toneMapping : NULL;
+
+  const size_t lineLength = DPXlineLength(layout, resolution->width);
+  uint8_t *data = malloc(lineLength * resolution->height);
+  // room for 4 components of 16 bits
+  void *line = malloc(resolution->width * 8);
+  FILE *file = fopen(path, "rb");
+  const bool read = data && line && file && (fseek(file, kDPXHeaderSize, SEEK_SET) == 0) &&
+                    (fread(data, 1, lineLength * resolution->height, file) == lineLength * resolution->height);
+  if (file) {
+    fclose(file);
+  }
+  if (!read) {
+    free(data);
+    free(line);
+    return -1.0;
+  }
+
+  const double start = now();
+  for (size_t frame = 0; frame < frames; frame++) {
+    for (size_t y = 0; y < resolution->height; y++) {
+      kernels.line(data + y * lineLength, line, resolution->width, kernels.context);
+    }
+  }
+  const double seconds = (now() - start) / (double)frames;
+
+  free(data);
+  free(line);
+  return seconds;
+}
+
+// a decode of the cancel operation
+typedef struct _dpxCancelRun {
+  const char *path;
+  DPXComponentFormat format;
+  DPXCancellation cancellation;
+  bool opened;
+  bool decoded;
+  double returned;  // when the decode returned
+} DPXCancelRun;
+
+static void *decodeCancelRun(void *context) {
+  DPXCancelRun *run = context;
+  DPXImage image = readDPXImageAtPath(run->path, run->cancellation);
+  run->opened = (image != NULL);
+  run->decoded = run->opened && decodeFullSize(image, run->format, SIZE_MAX);
+  run->returned = now();
+  releaseDPXImage(image);
+  return NULL;
+}
+
+// decodes the full size image frames times on another thread, cancelling each decode
+// kCancelDelay after it started, and stores the mean seconds from cancelling to returning
+// in cancelSeconds
+// returns the seconds per frame, or a negative number if the file couldn't be read
+static double timeCancel(const char *path, DPXComponentFormat format, size_t frames, double *cancelSeconds) {
+  const double start = now();
+  double cancelTotal = 0;
+  size_t cancelled = 0;
+
+  for (size_t frame = 0; frame < frames; frame++) {
+    DPXCancelRun run = { path, format, DPXcreateCancellation(), false, false, 0 };
+    pthread_t thread;
+    if (!run.cancellation || (pthread_create(&thread, NULL, decodeCancelRun, &run) != 0)) {
+      releaseDPXCancellation(run.cancellation);
+      return -1.0;
+    }
+
+    const struct timespec delay = { 0, kCancelDelay };
+    nanosleep(&delay, NULL);
+    const double cancel = now();
+    DPXcancel(run.cancellation);
+    pthread_join(thread, NULL);
+    releaseDPXCancellation(run.cancellation);
+    if (!run.opened) {
+      return -1.0;
+    }
+
+    if (!run.decoded && (run.returned > cancel)) {
+      cancelTotal += run.returned - cancel;
+      cancelled++;
+    }
+  }
+
+  *cancelSeconds = (cancelled > 0) ? cancelTotal / (double)cancelled : 0;
+  return (now() - start) / (double)frames;
+}
+
+// checks the file kChecksPerFrame times per frame with isDPXFileAtPath and stores the
+// longest check in longestSeconds
+// returns the seconds per check, or a negative number if the file was taken for the wrong kind
+static double timeReject(const char *path, bool accepted, size_t frames, double *longestSeconds) {
+  const size_t checks = frames * kChecksPerFrame;
+  double longest = 0;
+  double total = 0;
+
+  for (size_t check = 0; check < checks; check++) {
+    const double start = now();
+    const bool isDPX = isDPXFileAtPath(path);
+    const double seconds = now() - start;
+    if (isDPX != accepted) {
+      return -1.0;
+    }
+    total += seconds;
+    longest = (seconds > longest) ? seconds : longest;
+  }
+
+  *longestSeconds = longest;
+  return total / (double)checks;
+}
+
+static bool isSelected(const char *list, const char *name) {
+  if (!list) {
+    return true;
+  }
+
+  const size_t length = strlen(name);
+  for (const char *item = list; item; item = strchr(item, ',')) {
+    item += (*item == ',');
+    if ((strncmp(item, name, length) == 0) && ((item[length] == ',') || (item[length] == '\0'))) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static void usage(const char *name) {
+  fprintf(stderr, "usage: %s [-o operations] [-r 2k,4k,8k] [-b 8,10,12,16,32] [-c 8,8d,16,half] [-w 1,2,4,...] [-n frames] [-s size] [-d directory] [-k] [-l]\n", name);
+  fprintf(stderr, "  -o operations   operations to time: header, kernel, stream, full, progressive, thumbnail, cancel, reject (default all)\n");
+  fprintf(stderr, "  -r resolutions  resolutions to measure (default all)\n");
+  fprintf(stderr, "  -b bit sizes    bit sizes to measure (default all)\n");
+  fprintf(stderr, "  -c formats      component formats to decode to (default 8d)\n");
+  fprintf(stderr, "  -w workers      numbers of workers to decode with, 0 for one per core (default 0)\n");
+  fprintf(stderr, "  -n frames       number of times every operation is repeated (default %d)\n", kDefaultFrames);
+  fprintf(stderr, "  -s size         maximum width and height of the thumbnails (default %d)\n", kDefaultThumbnailSize);
+  fprintf(stderr, "  -d directory    directory the synthetic files are written to (default $TMPDIR)\n");
+  fprintf(stderr, "  -k              keep the synthetic files\n");
+  fprintf(stderr, "  -l              write 10-bit files as printing density instead of linear data\n");
+}
+
+int main(int argc, char *argv[]) {
+  const char *operationList = NULL;
+  const char *resolutionList = NULL;
+  const char *bitSizeList = NULL;
+  const char *formatList = "8d";
+  const char *directory = getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp";
+  size_t frames = kDefaultFrames;
+  size_t thumbnailSize = kDefaultThumbnailSize;
+  bool keepFiles = false;
+  bool logData = false;
+  size_t workerCounts[kMaxWorkerCounts] = { 0 };
+  size_t workerCountCount = 1;
+
+  int option;
+  while ((option = getopt(argc, argv, "o:r:b:c:w:n:s:d:klh")) != -1) {
+    switch (option) {
+      case 'o':
+        operationList = optarg;
+        break;
+      case 'r':
+        resolutionList = optarg;
+        break;
+      case 'b':
+        bitSizeList = optarg;
+        break;
+      case 'c':
+        formatList = optarg;
+        break;
+      case 'w': {
+        workerCountCount = 0;
+        for (const char *item = optarg; item; item = strchr(item, ',')) {
+          item += (*item == ',');
+          char *end;
+          const long value = strtol(item, &end, 10);
+          if ((value < 0) || (end == item) || ((*end != ',') && (*end != '\0')) || (workerCountCount == kMaxWorkerCounts)) {
+            fprintf(stderr, "invalid workers: %s\n", optarg);
+            return EXIT_FAILURE;
+          }
+          workerCounts[workerCountCount++] = (size_t)value;
+        }
+        break;
+      }
+      case 'n': {
+        const long value = strtol(optarg, NULL, 10);
+        if (value <= 0) {
+          fprintf(stderr, "invalid number of frames: %s\n", optarg);
+          return EXIT_FAILURE;
+        }
+        frames = (size_t)value;
+        break;
+      }
+      case 's': {
+        const long value = strtol(optarg, NULL, 10);
+        if (value <= 0) {
+          fprintf(stderr, "invalid size: %s\n", optarg);
+          return EXIT_FAILURE;
+        }
+        thumbnailSize = (size_t)value;
+        break;
+      }
+      case 'd':
+        directory = optarg;
+        break;
+      case 'k':
+        keepFiles = true;
+        break;
+      case 'l':
+        logData = true;
+        break;
+      default:
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+  }
+
+  printf("file,resolution,width,height,bit_size,packing,descriptor,byte_order,operation,format,workers,frames,ms_per_frame,latency_ms,mb_per_s,peak_rss_kb,status\n");
+  bool failed = false;
+
+  for (size_t r = 0; r < sizeof(resolutions) / sizeof(resolutions[0]); r++) {
+    const DPXResolution *resolution = &resolutions[r];
+    if (!isSelected(resolutionList, resolution->name)) {
+      continue;
+    }
+
+    for (size_t l = 0; l < sizeof(layouts) / sizeof(layouts[0]); l++) {
+      const DPXLayout *layout = &layouts[l];
+      char bitSizeName[4];
+      snprintf(bitSizeName, sizeof(bitSizeName), "%u", layout->bitSize);
+      if (!isSelected(bitSizeList, bitSizeName)) {
+        continue;
+      }
+
+      for (int swap = 0; swap <= 1; swap++) {
+        const bool bigEndian = (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__) != swap;
+        const bool log = logData && (layout->bitSize == 10);
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/dpxbench-%s-%u-%u-%u-%s%s.dpx", directory, resolution->name, layout->bitSize, layout->packing, layout->descriptor,
+                 bigEndian ? "be" : "le", log ? "-log" : "");
+        if (!writeSyntheticDPX(path, layout, resolution, swap, log)) {
+          fprintf(stderr, "%s: %s\n", path, strerror(errno));
+          failed = true;
+          continue;
+        }
+
+        DPXLineKernels kernels;
+        const bool supported = DPXfindLineKernels(layout->bitSize, layout->packing, layout->descriptor, swap, &kernels);
+        const double megabytes = (double)(kDPXHeaderSize + DPXlineLength(layout, resolution->width) * resolution->height) / 1e6;
+
+        for (DPXOperation operation = DPXOperationHeader; operation < DPXOperationReject; operation++) {
+          if (!isSelected(operationList, operationNames[operation])) {
+            continue;
+          }
+
+          // operations without a format or workers are timed once
+          for (DPXComponentFormat format = DPXComponentFormat8; format <= DPXComponentFormatHalf; format++) {
+            const bool timed = hasComponentFormat(operation) ? isSelected(formatList, componentFormatNames[format]) : (format == DPXComponentFormat8);
+            if (!timed) {
+              continue;
+            }
+
+            for (size_t w = 0; w < (usesWorkers(operation) ? workerCountCount : 1); w++) {
+              char workers[24] = "";
+              if (usesWorkers(operation)) {
+                DPXsetWorkerLimit(workerCounts[w]);
+                snprintf(workers, sizeof(workers), (workerCounts[w] == 0) ? "all" : "%zu", workerCounts[w]);
+              }
+
+              double latencySeconds = 0;
+              double seconds;
+              if (operation == DPXOperationKernel) {
+                seconds = timeKernel(path, layout, resolution, swap, frames);
+              } else if (operation == DPXOperationCancel) {
+                seconds = timeCancel(path, format, frames, &latencySeconds);
+              } else {
+                seconds = timeOperation(path, operation, format, frames, thumbnailSize, &latencySeconds);
+              }
+              const char *status = (seconds < 0) ? "failed" : (supported ? "ok" : "unsupported");
+              failed = failed || (seconds < 0);
+
+              // the header is all that is read for the header operation, the cancel operation
+              // stops decoding, and unsupported layouts aren't decoded at all, so their
+              // throughput isn't reported
+              char throughput[32] = "";
+              if ((operation != DPXOperationHeader) && (operation != DPXOperationCancel) && supported && (seconds > 0)) {
+                snprintf(throughput, sizeof(throughput), "%.1f", megabytes / seconds);
+              }
+
+              // the latency of the progressive operation is the time until its first stage was
+              // ready, that of the cancel operation the time from cancelling until the decode returned
+              char latency[32] = "";
+              if (((operation == DPXOperationProgressive) || (operation == DPXOperationCancel)) && (latencySeconds > 0)) {
+                snprintf(latency, sizeof(latency), "%.3f", latencySeconds * 1e3);
+              }
+
+              printf("%s,%s,%u,%u,%u,%u,%u,%s,%s,%s,%s,%zu,%.3f,%s,%s,%ld,%s\n", strrchr(path, '/') + 1, resolution->name, resolution->width, resolution->height,
+                     layout->bitSize, layout->packing, layout->descriptor, bigEndian ? "be" : "le", operationNames[operation],
+                     hasComponentFormat(operation) ? componentFormatNames[format] : "", workers, frames,
+                     (seconds < 0) ? 0.0 : seconds * 1e3, latency, throughput, peakResidentSize(), status);
+              fflush(stdout);
+            }
+          }
+        }
+        if (!keepFiles) {
+          unlink(path);
+        }
+      }
+    }
+  }
+
+  // the latency of the reject operation is its longest check
+  for (size_t f = 0; isSelected(operationList, operationNames[DPXOperationReject]) && (f < sizeof(rejectFiles) / sizeof(rejectFiles[0])); f++) {
+    const DPXRejectFile *rejectFile = &rejectFiles[f];
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/dpxbench-%s", directory, rejectFile->name);
+    if (!writeRejectFile(path, rejectFile)) {
+      fprintf(stderr, "%s: %s\n", path, strerror(errno));
+      failed = true;
+      continue;
+    }
+
+    double longestSeconds = 0;
+    const double seconds = timeReject(path, rejectFile->accepted, frames, &longestSeconds);
+    failed = failed || (seconds < 0);
+    printf("%s,,,,,,,,%s,,,%zu,%.4f,%.4f,,%ld,%s\n", strrchr(path, '/') + 1, operationNames[DPXOperationReject], frames * kChecksPerFrame,
+           (seconds < 0) ? 0.0 : seconds * 1e3, longestSeconds * 1e3, peakResidentSize(),
+           (seconds < 0) ? "failed" : (rejectFile->accepted ? "accepted" : "rejected"));
+    fflush(stdout);
+    if (!keepFiles) {
+      unlink(path);
+    }
+  }
+
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
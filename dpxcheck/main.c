@@ -0,0 +1,629 @@
+//
+//  main.c
+//  dpxcheck
+//
+//  Copyright © 2019 Thomas Angarano. All rights reserved.
+//
+//  Checks that the SIMD kernels give the same bytes as the plain C ones, that
+//  the 10-bit filled kernels match the original per-pixel decoder, and that
+//  frames decoded in stages match frames decoded in one go.
+//
+
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "DPXDecoder.h"
+#include "DPXUnpack.h"
+
+#define kDefaultRuns 16
+
+// the widest line checked, in pixels; the widths are random, so the
+// SIMD kernels' tails are checked as well as their main loops
+#define kMaxWidth 1100
+
+// bytes of the largest line or output buffer: 4 components of 32 bits,
+// and room behind it to notice kernels writing past the end of a line
+#define kBufferSize (kMaxWidth * 16 + 256)
+
+typedef enum {
+  DPXCheckLine,        // a line kernel
+  DPXCheckAccumulate,  // an accumulating kernel
+  DPXCheckConvert,     // DPXconvertLine
+  DPXCheckReduce       // DPXreduceLine
+} DPXCheckKind;
+
+// the number of random lines of every layout compared with the original decoder
+#define kBaselineLines 64
+
+// the size of the frames decoded in stages, odd so that neither the thumbnails
+// nor the windows divide it evenly
+#define kFrameWidth 333
+#define kFrameHeight 157
+#define kFrameThumbnailSize 64
+#define kFrameWindowLines 16
+
+// the byte the full size image of a progressive decode is filled with before it
+#define kUntouched 0xA5
+
+// the size of the generic and industry headers in front of the image data
+#define kDPXHeaderSize 2048
+
+typedef struct _dpxLayout {
+  uint8_t bitSize;
+  uint16_t packing;
+  uint8_t descriptor;
+} DPXLayout;
+
+static const DPXLayout frameLayouts[] = {
+  { 8, 0, 50 }, { 10, 1, 50 }, { 10, 2, 51 }, { 10, 0, 6 }, { 12, 1, 50 }, { 16, 0, 51 }, { 32, 0, 50 },
+};
+
+static const char *kindNames[] = { "line", "accumulate", "convert", "reduce" };
+
+static const char *instructionSetNames[] = { "plain C", "SSE4.1", "AVX2" };
+
+// a kernel and the random line it is run on, described by seed
+typedef struct _dpxCheck {
+  DPXCheckKind kind;
+  uint8_t bitSize;
+  uint16_t packing;
+  uint8_t descriptor;
+  bool swap;
+  bool table;             // table kernels instead of the plain ones
+  DPXToneCurve curve;     // for 32-bit float data
+  DPXComponentFormat format;
+  uint8_t components;     // for DPXconvertLine
+  uint8_t precision;      // for DPXconvertLine
+  uint32_t seed;
+} DPXCheck;
+
+static uint32_t nextRandom(uint32_t *state) {
+  *state ^= *state << 13;
+  *state ^= *state >> 17;
+  *state ^= *state << 5;
+  return *state;
+}
+
+static void fillRandom(uint8_t *bytes, size_t length, uint32_t *state) {
+  for (size_t i = 0; i < length; i++) {
+    bytes[i] = (uint8_t)nextRandom(state);
+  }
+}
+
+// fills the buffer with floats around 0.0 to 1.0, some out of range, and a few NaNs and infinities
+static void fillRandomFloats(uint32_t *words, size_t count, bool swap, uint32_t *state) {
+  static const float specials[] = { -1.0f, 0.0f, -0.0f, 1.0f, 65504.0f, 1e30f, __builtin_inff(), -__builtin_inff(), __builtin_nanf("") };
+  for (size_t i = 0; i < count; i++) {
+    const uint32_t random = nextRandom(state);
+    float value = ((float)(random >> 8) / (float)(1 << 24)) * 2.5f - 0.25f;
+    if ((random & 0xFF) == 0) {
+      value = specials[(random >> 8) % (sizeof(specials) / sizeof(specials[0]))];
+    }
+    uint32_t word;
+    memcpy(&word, &value, sizeof(word));
+    words[i] = swap ? __builtin_bswap32(word) : word;
+  }
+}
+
+static uint64_t hashBytes(const uint8_t *bytes, size_t length) {
+  uint64_t hash = 1469598103934665603ull;
+  for (size_t i = 0; i < length; i++) {
+    hash = (hash ^ bytes[i]) * 1099511628211ull;
+  }
+  return hash;
+}
+
+static bool findKernels(const DPXCheck *check, DPXLineKernels *kernels) {
+  if (check->table) {
+    return DPXfindTableLineKernels(check->packing, check->descriptor, check->swap, kernels);
+  }
+  return DPXfindLineKernels(check->bitSize, check->packing, check->descriptor, check->swap, kernels);
+}
+
+// runs the check with the kernels currently selected and returns the hash of its output
+static uint64_t runCheck(const DPXCheck *check, uint16_t *table) {
+  static uint32_t source[kBufferSize / 4];
+  static uint8_t target[kBufferSize];
+  static uint32_t sums[kBufferSize / 4];
+  static size_t columnStarts[kMaxWidth + 1];
+
+  uint32_t state = check->seed;
+  const size_t width = 1 + nextRandom(&state) % kMaxWidth;
+  memset(target, 0xA5, sizeof(target));
+
+  DPXLineKernels kernels;
+  if (check->kind != DPXCheckConvert) {
+    findKernels(check, &kernels);
+  }
+  DPXToneMapping toneMapping = { (float)(nextRandom(&state) % 9) * 0.5f - 2.0f, check->curve };
+  kernels.context = check->table ? (const void *)table : ((check->bitSize == 32) ? (const void *)&toneMapping : NULL);
+
+  if ((check->bitSize == 32) && (check->kind != DPXCheckConvert) && (check->kind != DPXCheckReduce)) {
+    fillRandomFloats(source, sizeof(source) / 4, check->swap, &state);
+  } else {
+    fillRandom((uint8_t *)source, sizeof(source), &state);
+  }
+
+  switch (check->kind) {
+    case DPXCheckLine:
+      kernels.line(source, target, width, kernels.context);
+      return hashBytes(target, sizeof(target));
+    case DPXCheckAccumulate:
+      // the sums are added to, so they start out random, but small enough not to overflow
+      for (size_t i = 0; i < sizeof(sums) / 4; i++) {
+        sums[i] = nextRandom(&state) >> 8;
+      }
+      kernels.accumulateLine(source, sums, width, kernels.context);
+      return hashBytes((const uint8_t *)sums, sizeof(sums));
+    case DPXCheckConvert: {
+      const uint32_t maximum = (1u << check->precision) - 1;
+      for (size_t i = 0; i < sizeof(source) / 4; i++) {
+        source[i] &= maximum;
+      }
+      DPXconvertLine(source, width, check->components, check->precision, check->format, nextRandom(&state) % 16, target);
+      return hashBytes(target, sizeof(target));
+    }
+    case DPXCheckReduce: {
+      // sums of up to lineCount lines, over source pixels of one to six columns per target pixel
+      const size_t lineCount = 1 + nextRandom(&state) % 4;
+      const uint32_t maximum = (uint32_t)(lineCount << kernels.precision) - 1;
+      size_t targetWidth = 0;
+      columnStarts[0] = 0;
+      while ((targetWidth < width) && (columnStarts[targetWidth] + 6 <= kMaxWidth)) {
+        columnStarts[targetWidth + 1] = columnStarts[targetWidth] + 1 + nextRandom(&state) % 6;
+        targetWidth++;
+      }
+      for (size_t i = 0; i < sizeof(sums) / 4; i++) {
+        sums[i] = nextRandom(&state) % (maximum + 1);
+      }
+      DPXreduceLine(&kernels, sums, columnStarts, targetWidth, lineCount, check->format, nextRandom(&state) % 16, check->swap, target);
+      return hashBytes(target, sizeof(target));
+    }
+  }
+  return 0;
+}
+
+static void describeCheck(const DPXCheck *check, char *description, size_t length) {
+  if (check->kind == DPXCheckConvert) {
+    snprintf(description, length, "convert %u components of %u bits to format %d, seed %u", check->components, check->precision, check->format, check->seed);
+    return;
+  }
+  snprintf(description, length, "%s%s %u-bit packing %u descriptor %u%s, format %d, curve %d, seed %u", check->table ? "table " : "",
+           kindNames[check->kind], check->bitSize, check->packing, check->descriptor, check->swap ? " swapped" : "",
+           check->format, check->curve, check->seed);
+}
+
+// adds the check to checks if its kernels exist, growing the array as needed
+static void addCheck(DPXCheck **checks, size_t *count, size_t *capacity, const DPXCheck *check) {
+  if (check->kind != DPXCheckConvert) {
+    DPXLineKernels kernels;
+    if (!findKernels(check, &kernels) || ((check->kind == DPXCheckLine) && !kernels.line) || !kernels.accumulateLine) {
+      return;
+    }
+  }
+
+  if (*count == *capacity) {
+    const size_t newCapacity = *capacity ? *capacity * 2 : 1024;
+    DPXCheck *grown = realloc(*checks, newCapacity * sizeof(DPXCheck));
+    if (!grown) {
+      fprintf(stderr, "out of memory\n");
+      exit(EXIT_FAILURE);
+    }
+    *checks = grown;
+    *capacity = newCapacity;
+  }
+  (*checks)[(*count)++] = *check;
+}
+
+// lists runs checks of every kernel, with seeds from state
+static DPXCheck *listChecks(size_t runs, uint32_t state, size_t *count) {
+  static const uint8_t bitSizes[] = { 8, 10, 12, 16, 32 };
+  static const uint8_t descriptors[] = { 4, 6, 50, 51, 52, 100 };
+  static const uint8_t precisions[] = { 8, 10, 12, 16 };
+
+  DPXCheck *checks = NULL;
+  size_t capacity = 0;
+  *count = 0;
+
+  for (size_t run = 0; run < runs; run++) {
+    for (size_t b = 0; b < sizeof(bitSizes) / sizeof(bitSizes[0]); b++) {
+      // only 10 and 12-bit data has packings, and 8-bit data has no byte order
+      const bool packed = (bitSizes[b] == 10) || (bitSizes[b] == 12);
+      for (uint16_t packing = 0; packing <= (packed ? 2 : 0); packing++) {
+        for (size_t d = 0; d < sizeof(descriptors) / sizeof(descriptors[0]); d++) {
+          for (int swap = 0; swap <= (bitSizes[b] != 8); swap++) {
+            for (int table = 0; table <= (bitSizes[b] == 10); table++) {
+              for (DPXToneCurve curve = DPXToneCurveLinear; curve <= ((bitSizes[b] == 32) ? DPXToneCurveReinhard : DPXToneCurveLinear); curve++) {
+                DPXCheck check = { DPXCheckLine, bitSizes[b], packing, descriptors[d], swap, table, curve, DPXComponentFormat8, 0, 0, 0 };
+                for (DPXCheckKind kind = DPXCheckLine; kind <= DPXCheckAccumulate; kind++) {
+                  check.kind = kind;
+                  check.seed = nextRandom(&state);
+                  addCheck(&checks, count, &capacity, &check);
+                }
+                for (DPXComponentFormat format = DPXComponentFormat8; format <= DPXComponentFormatHalf; format++) {
+                  check.kind = DPXCheckReduce;
+                  check.format = format;
+                  check.seed = nextRandom(&state);
+                  addCheck(&checks, count, &capacity, &check);
+                }
+              }
+            }
+          }
+        }
+      }
+    }
+
+    for (DPXComponentFormat format = DPXComponentFormat8; format <= DPXComponentFormatHalf; format++) {
+      for (uint8_t components = 1; components <= 4; components++) {
+        for (size_t p = 0; p < sizeof(precisions) / sizeof(precisions[0]); p++) {
+          const DPXCheck check = { DPXCheckConvert, 0, 0, 0, false, false, DPXToneCurveLinear, format, components, precisions[p], nextRandom(&state) };
+          addCheck(&checks, count, &capacity, &check);
+        }
+      }
+    }
+  }
+  return checks;
+}
+
+// unpacks a line of 10-bit filled RGB (descriptor 50) or RGBA (51) into 8-bit RGB with the
+// per-pixel expressions of the original createCGImageFromDPX, which only read method A;
+// method B words are shifted up by their padding to the method A layout first
+static void unpackBaselineLine(const uint32_t *sourceData, uint8_t *data, size_t width, uint8_t descriptor, uint16_t packing, bool swap) {
+  const unsigned padding = (packing == 2) ? 2 : 0;
+  for (size_t x = 0; x < width; x++) {
+    if (descriptor == 50) {  // RGB source image
+      uint32_t sourcePixel = sourceData[x];
+      if (swap) {
+        sourcePixel = __builtin_bswap32(sourcePixel);
+      }
+      sourcePixel <<= padding;
+      data[x * 3 + 0] = sourcePixel >> 24;
+      data[x * 3 + 1] = sourcePixel >> 14;
+      data[x * 3 + 2] = sourcePixel >> 4;
+    } else {  // RGBA
+      const size_t targetIndex = x * 3;
+
+      // calculate the index of this pixel's R component in the source data
+      const size_t componentBaseIndex = x * 4;  // 4 components per source pixel
+
+      for (size_t component = 0; component < 3; component++) {
+        const size_t sourceIndex = (componentBaseIndex + component) / 3;  // 1 32bit source pixel holds 3 10bit components
+        const size_t shift = 24 - ((componentBaseIndex + component) % 3) * 10;
+
+        uint32_t sourceWord = sourceData[sourceIndex];
+        if (swap) {
+          sourceWord = __builtin_bswap32(sourceWord);
+        }
+        sourceWord <<= padding;
+
+        data[targetIndex + component] = sourceWord >> shift;
+      }
+    }
+  }
+}
+
+// compares DPXunpack10FilledRGBLine and DPXunpack10FilledRGBALine with every instruction
+// set of the host against unpackBaselineLine, on kBaselineLines random lines of both
+// packings and byte orders
+// returns the number of lines that differ
+static size_t checkBaseline(uint32_t seed) {
+  static uint32_t source[kBufferSize / 4];
+  static uint8_t target[kBufferSize];
+  static uint8_t baseline[kBufferSize];
+  uint32_t state = seed;
+  size_t failures = 0;
+  size_t count = 0;
+
+  for (DPXInstructionSet instructionSet = DPXInstructionSetScalar; instructionSet <= DPXhostInstructionSet(); instructionSet++) {
+    DPXlimitInstructionSet(instructionSet);
+    for (uint8_t descriptor = 50; descriptor <= 51; descriptor++) {
+      for (uint16_t packing = 1; packing <= 2; packing++) {
+        for (int swap = 0; swap <= 1; swap++) {
+          for (size_t line = 0; line < kBaselineLines; line++) {
+            const size_t width = 1 + nextRandom(&state) % kMaxWidth;
+            fillRandom((uint8_t *)source, sizeof(source), &state);
+            memset(target, 0xA5, sizeof(target));
+            memset(baseline, 0xA5, sizeof(baseline));
+            unpackBaselineLine(source, baseline, width, descriptor, packing, swap);
+            if (descriptor == 50) {
+              DPXunpack10FilledRGBLine(source, target, width, packing, swap);
+            } else {
+              DPXunpack10FilledRGBALine(source, target, width, packing, swap);
+            }
+
+            count++;
+            if (memcmp(target, baseline, sizeof(target)) != 0) {
+              fprintf(stderr, "%s differs from the original decoder: 10-bit packing %u descriptor %u%s, width %zu\n",
+                      instructionSetNames[instructionSet], packing, descriptor, swap ? " swapped" : "", width);
+              failures++;
+            }
+          }
+        }
+      }
+    }
+  }
+
+  printf("%zu of %zu lines match the original decoder\n", count - failures, count);
+  return failures;
+}
+
+static void put16(uint8_t *header, size_t offset, uint16_t value, bool swap) {
+  value = swap ? __builtin_bswap16(value) : value;
+  memcpy(header + offset, &value, sizeof(value));
+}
+
+static void put32(uint8_t *header, size_t offset, uint32_t value, bool swap) {
+  value = swap ? __builtin_bswap32(value) : value;
+  memcpy(header + offset, &value, sizeof(value));
+}
+
+// writes a kFrameWidth x kFrameHeight frame of random pixels with the given layout, in the
+// host's byte order or the opposite one if swap is true
+static bool writeFrame(const char *path, const DPXLayout *layout, bool swap, uint32_t *state) {
+  const size_t components = kFrameWidth * ((layout->descriptor == 6) ? 1 : ((layout->descriptor == 51) ? 4 : 3));
+  size_t words;
+  if (layout->bitSize == 10 && layout->packing != 0) {
+    words = (components + 2) / 3;
+  } else if (layout->bitSize == 12 && layout->packing != 0) {
+    words = (components + 1) / 2;
+  } else {
+    words = (components * layout->bitSize + 31) / 32;
+  }
+  const size_t dataSize = words * 4 * kFrameHeight;
+
+  uint8_t header[kDPXHeaderSize];
+  memset(header, 0, sizeof(header));
+  put32(header, 0, 0x53445058, swap);                 // magic_num
+  put32(header, 4, kDPXHeaderSize, swap);             // offset
+  memcpy(header + 8, "V2.0", 4);                      // vers
+  put32(header, 16, (uint32_t)(kDPXHeaderSize + dataSize), swap);  // file_size
+  put32(header, 24, 1664, swap);                      // gen_hdr_size
+  put32(header, 28, 384, swap);                       // ind_hdr_size
+  put32(header, 660, 0xFFFFFFFF, swap);               // key
+  put16(header, 770, 1, swap);                        // element_number
+  put32(header, 772, kFrameWidth, swap);              // pixels_per_line
+  put32(header, 776, kFrameHeight, swap);             // lines_per_image_ele
+  if (layout->bitSize < 32) {
+    put32(header, 780 + 12, (1u << layout->bitSize) - 1, swap);  // ref_high_data
+  }
+  header[780 + 20] = layout->descriptor;
+  header[780 + 21] = 2;                               // transfer: linear
+  header[780 + 22] = 2;                               // colorimetric: linear
+  header[780 + 23] = layout->bitSize;
+  put16(header, 780 + 24, layout->packing, swap);
+  put32(header, 780 + 28, kDPXHeaderSize, swap);      // data_offset
+
+  uint8_t *data = malloc(dataSize);
+  FILE *file = fopen(path, "wb");
+  bool written = data && file;
+  if (written) {
+    if (layout->bitSize == 32) {
+      fillRandomFloats((uint32_t *)data, dataSize / 4, swap, state);
+    } else {
+      fillRandom(data, dataSize, state);
+    }
+    written = (fwrite(header, 1, sizeof(header), file) == sizeof(header)) && (fwrite(data, 1, dataSize, file) == dataSize);
+  }
+  if (file) {
+    written = (fclose(file) == 0) && written;
+  }
+  free(data);
+  return written;
+}
+
+// the stages of a progressive decode, checked by checkStage as they arrive
+typedef struct _dpxStageCheck {
+  const uint8_t *thumbnail;  // the thumbnail the coarse stage has to match
+  size_t thumbwidth;
+  size_t thumbheight;
+  const uint8_t *target;     // the full size image, kUntouched until it is decoded
+  size_t targetLength;
+  DPXCancellation cancellation;  // cancelled by the coarse stage if not NULL
+  size_t count;
+  bool same;
+} DPXStageCheck;
+
+// checks that the coarse stage arrives first, while the full size image hasn't been
+// decoded yet, with the pixels of the thumbnail, and the full size stage second,
+// unless the coarse stage cancelled the decode
+static void checkStage(const DPXProgressiveStage *stage, void *info) {
+  DPXStageCheck *check = info;
+  if (stage->final) {
+    check->same = check->same && (check->count == 1) && !check->cancellation && (stage->pixels == check->target);
+  } else {
+    bool untouched = (check->count == 0);
+    for (size_t i = 0; untouched && (i < check->targetLength); i++) {
+      untouched = (check->target[i] == kUntouched);
+    }
+    check->same = check->same && untouched && (stage->width == check->thumbwidth) && (stage->height == check->thumbheight) &&
+                  (memcmp(stage->pixels, check->thumbnail, stage->bytesPerRow * stage->height) == 0);
+    if (check->cancellation) {
+      DPXcancel(check->cancellation);
+    }
+  }
+  check->count++;
+}
+
+// decodes the frame at path in one go, in kFrameWindowLines windows before and
+// after a thumbnail, and with DPXdecodeProgressively
+// returns true if all stages give the same pixels as the frame decoded in one go
+static bool checkFrame(const char *path, DPXComponentFormat format) {
+  DPXImage whole = readDPXImageAtPath(path, NULL);
+  DPXImage staged = readDPXImageAtPath(path, NULL);
+  size_t bitsPerComponent, bitsPerPixel;
+  if (!whole || !staged || !DPXgetLineFormat(whole, format, &bitsPerComponent, &bitsPerPixel)) {
+    releaseDPXImage(whole);
+    releaseDPXImage(staged);
+    return false;
+  }
+
+  size_t thumbwidth, thumbheight;
+  DPXthumbnailDimensions(kFrameWidth, kFrameHeight, kFrameThumbnailSize, kFrameThumbnailSize, &thumbwidth, &thumbheight);
+  const size_t bytesPerRow = bitsPerPixel / 8 * kFrameWidth;
+  const size_t thumbnailBytesPerRow = bitsPerPixel / 8 * thumbwidth;
+  uint8_t *lines = malloc(bytesPerRow * kFrameHeight);
+  uint8_t *window = malloc(bytesPerRow * kFrameWindowLines);
+  uint8_t *thumbnail = malloc(thumbnailBytesPerRow * thumbheight);
+  uint8_t *stagedThumbnail = malloc(thumbnailBytesPerRow * thumbheight);
+
+  bool same = lines && window && thumbnail && stagedThumbnail &&
+              DPXdecodeLines(whole, 0, kFrameHeight, format, lines, bytesPerRow) &&
+              DPXdecodeThumbnail(whole, thumbwidth, thumbheight, format, thumbnail, thumbnailBytesPerRow) &&
+              DPXdecodeThumbnail(staged, thumbwidth, thumbheight, format, stagedThumbnail, thumbnailBytesPerRow) &&
+              (memcmp(thumbnail, stagedThumbnail, thumbnailBytesPerRow * thumbheight) == 0);
+  for (size_t y = 0; same && (y < kFrameHeight); y += kFrameWindowLines) {
+    const size_t count = (kFrameHeight - y < kFrameWindowLines) ? kFrameHeight - y : kFrameWindowLines;
+    same = DPXdecodeLines(staged, y, count, format, window, bytesPerRow) &&
+           (memcmp(window, lines + y * bytesPerRow, bytesPerRow * count) == 0);
+  }
+
+  // DPXdecodeProgressively, a coarse stage of the thumbnail's size first, once cancelled
+  // by its coarse stage, which leaves out the full size stage
+  DPXCancellation cancellation = DPXcreateCancellation();
+  DPXImage progressive = same ? readDPXImageAtPath(path, NULL) : NULL;
+  DPXImage cancelled = same ? readDPXImageAtPath(path, cancellation) : NULL;
+  uint8_t *target = malloc(bytesPerRow * kFrameHeight);
+  DPXStageCheck check = { thumbnail, thumbwidth, thumbheight, target, bytesPerRow * kFrameHeight, NULL, 0, true };
+  DPXStageCheck cancelledCheck = { thumbnail, thumbwidth, thumbheight, target, bytesPerRow * kFrameHeight, cancellation, 0, true };
+  if (target) {
+    memset(target, kUntouched, bytesPerRow * kFrameHeight);
+  }
+  same = same && progressive && cancelled && target &&
+         !DPXdecodeProgressively(cancelled, kFrameThumbnailSize, kFrameThumbnailSize, format, target, bytesPerRow, checkStage, &cancelledCheck) &&
+         cancelledCheck.same && (cancelledCheck.count == 1) &&
+         DPXdecodeProgressively(progressive, kFrameThumbnailSize, kFrameThumbnailSize, format, target, bytesPerRow, checkStage, &check) &&
+         check.same && (check.count == 2) && (memcmp(target, lines, bytesPerRow * kFrameHeight) == 0);
+
+  free(lines);
+  free(window);
+  free(thumbnail);
+  free(stagedThumbnail);
+  free(target);
+  releaseDPXImage(whole);
+  releaseDPXImage(staged);
+  releaseDPXImage(progressive);
+  releaseDPXImage(cancelled);
+  releaseDPXCancellation(cancellation);
+  return same;
+}
+
+// checks frames of every layout of frameLayouts in both byte orders and every
+// component format, written to directory
+// returns the number of frames that didn't decode the same in stages
+static size_t checkFrames(const char *directory, uint32_t seed) {
+  static const char *formatNames[] = { "8", "8d", "16", "half" };
+  uint32_t state = seed;
+  size_t failures = 0;
+  size_t count = 0;
+
+  for (size_t l = 0; l < sizeof(frameLayouts) / sizeof(frameLayouts[0]); l++) {
+    const DPXLayout *layout = &frameLayouts[l];
+    for (int swap = 0; swap <= 1; swap++) {
+      char path[PATH_MAX];
+      snprintf(path, sizeof(path), "%s/dpxcheck-%u-%u-%u%s.dpx", directory, layout->bitSize, layout->packing, layout->descriptor, swap ? "-swapped" : "");
+      if (!writeFrame(path, layout, swap, &state)) {
+        fprintf(stderr, "couldn't write %s\n", path);
+        failures++;
+        continue;
+      }
+
+      for (DPXComponentFormat format = DPXComponentFormat8; format <= DPXComponentFormatHalf; format++) {
+        count++;
+        if (!checkFrame(path, format)) {
+          fprintf(stderr, "stages differ from the whole frame: %u-bit packing %u descriptor %u%s, format %s\n", layout->bitSize,
+                  layout->packing, layout->descriptor, swap ? " swapped" : "", formatNames[format]);
+          failures++;
+        }
+      }
+      unlink(path);
+    }
+  }
+
+  printf("%zu of %zu frames decode the same in stages\n", count - failures, count);
+  return failures;
+}
+
+static void usage(const char *name) {
+  fprintf(stderr, "usage: %s [-n runs] [-s seed] [-d dir]\n", name);
+  fprintf(stderr, "  -n runs  number of random lines per kernel and format (default %d)\n", kDefaultRuns);
+  fprintf(stderr, "  -s seed  seed of the random lines (default 1)\n");
+  fprintf(stderr, "  -d dir   directory the frames are written to (default $TMPDIR)\n");
+}
+
+int main(int argc, char *argv[]) {
+  size_t runs = kDefaultRuns;
+  uint32_t seed = 1;
+  const char *directory = getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp";
+
+  int option;
+  while ((option = getopt(argc, argv, "n:s:d:h")) != -1) {
+    switch (option) {
+      case 'n': {
+        const long value = strtol(optarg, NULL, 10);
+        if (value <= 0) {
+          fprintf(stderr, "invalid number of runs: %s\n", optarg);
+          return EXIT_FAILURE;
+        }
+        runs = (size_t)value;
+        break;
+      }
+      case 's':
+        seed = (uint32_t)strtoul(optarg, NULL, 10);
+        seed = seed ? seed : 1;
+        break;
+      case 'd':
+        directory = optarg;
+        break;
+      default:
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+  }
+
+  size_t count;
+  DPXCheck *checks = listChecks(runs, seed, &count);
+  uint64_t *expected = malloc(count * sizeof(uint64_t));
+  uint16_t *table = malloc(kDPXTableSize * sizeof(uint16_t));
+  if (!checks || !expected || !table) {
+    fprintf(stderr, "out of memory\n");
+    return EXIT_FAILURE;
+  }
+  DPXbuildLogTable(95, 685, table);
+
+  DPXlimitInstructionSet(DPXInstructionSetScalar);
+  for (size_t i = 0; i < count; i++) {
+    expected[i] = runCheck(&checks[i], table);
+  }
+
+  const DPXInstructionSet hostInstructionSet = DPXhostInstructionSet();
+  size_t failures = 0;
+  for (DPXInstructionSet instructionSet = DPXInstructionSetSSE41; instructionSet <= hostInstructionSet; instructionSet++) {
+    DPXlimitInstructionSet(instructionSet);
+    size_t instructionSetFailures = 0;
+    for (size_t i = 0; i < count; i++) {
+      if (runCheck(&checks[i], table) != expected[i]) {
+        char description[160];
+        describeCheck(&checks[i], description, sizeof(description));
+        fprintf(stderr, "%s differs from plain C: %s\n", instructionSetNames[instructionSet], description);
+        instructionSetFailures++;
+      }
+    }
+    printf("%s: %zu of %zu checks match plain C\n", instructionSetNames[instructionSet], count - instructionSetFailures, count);
+    failures += instructionSetFailures;
+  }
+  if (hostInstructionSet == DPXInstructionSetScalar) {
+    printf("no SIMD kernels for this CPU, %zu checks of plain C only\n", count);
+  }
+
+  failures += checkBaseline(seed);
+  DPXlimitInstructionSet(DPXInstructionSetAVX2);
+  failures += checkFrames(directory, seed);
+  free(checks);
+  free(expected);
+  free(table);
+  return (failures > 0) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,488 @@
+//
+//  main.c
+//  dpxthumbs
+//
+//  Copyright © 2019 Thomas Angarano. All rights reserved.
+//
+//  Creates thumbnails for whole directories of DPX frames with the
+//  decoder of the QuickLook plugin, one frame per task.
+//
+
+#include <dirent.h>
+#include <glob.h>
+#include <libgen.h>
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <CoreFoundation/CoreFoundation.h>
+#include <CoreGraphics/CoreGraphics.h>
+#include <ImageIO/ImageIO.h>
+#include <dispatch/dispatch.h>
+
+#include "DPXImage.h"
+
+#define kDefaultThumbnailSize 256
+
+typedef enum {
+  DPXOutputFormatPNG,
+  DPXOutputFormatPPM,
+  DPXOutputFormatRaw,
+  DPXOutputFormatProxy  // embedded into the frame itself, see DPXwriteProxy
+} DPXOutputFormat;
+
+typedef struct _dpxBatch {
+  CGSize size;
+  DPXOutputFormat format;
+  DPXComponentFormat componentFormat;
+  DPXToneMapping toneMapping;  // for 32-bit float frames, see DPXsetToneMapping
+  const char *outputDirectory;
+  dispatch_semaphore_t framesInFlight;  // limits the number of frames read and decoded at the same time
+} DPXBatch;
+
+typedef struct _dpxFrame {
+  const DPXBatch *batch;
+  char *path;
+  off_t bytes;     // the size of the DPX file
+  bool written;    // true once the thumbnail has been written
+} DPXFrame;
+
+typedef struct _dpxFrameList {
+  DPXFrame *frames;
+  size_t count;
+  size_t capacity;
+} DPXFrameList;
+
+static void usage(const char *name) {
+  fprintf(stderr, "usage: %s [-s size] [-f png|ppm|raw|proxy] [-c 8|8d|16|half] [-e stops] [-t linear|srgb|reinhard] [-o directory] [-j frames] file|directory|pattern ...\n", name);
+  fprintf(stderr, "  -s size       maximum width and height of the thumbnails (default %d)\n", kDefaultThumbnailSize);
+  fprintf(stderr, "  -f format     file format of the thumbnails, or proxy to embed them into the frames (default png)\n");
+  fprintf(stderr, "  -c format     component format of the thumbnails: 8-bit, dithered 8-bit, 16-bit or\n");
+  fprintf(stderr, "                half float, which can't be written as ppm; proxies are 8-bit (default 8d)\n");
+  fprintf(stderr, "  -e stops      exposure of 32-bit float frames (default 0)\n");
+  fprintf(stderr, "  -t curve      tone curve of 32-bit float frames: clipped, clipped and sRGB encoded, or\n");
+  fprintf(stderr, "                compressed with x / (1 + x) and sRGB encoded (default linear);\n");
+  fprintf(stderr, "                proxies are always embedded with the defaults QuickLook decodes with\n");
+  fprintf(stderr, "  -o directory  directory the thumbnails are written to (default .)\n");
+  fprintf(stderr, "  -j frames     number of frames processed at the same time (default twice the number of cores)\n");
+}
+
+static bool addFrame(DPXFrameList *list, const char *path) {
+  if (list->count == list->capacity) {
+    list->capacity = list->capacity ? list->capacity * 2 : 256;
+    DPXFrame *grownFrames = realloc(list->frames, list->capacity * sizeof(DPXFrame));
+    if (!grownFrames) {
+      return false;
+    }
+    list->frames = grownFrames;
+  }
+
+  DPXFrame *frame = &list->frames[list->count];
+  memset(frame, 0, sizeof(DPXFrame));
+  frame->path = strdup(path);
+  if (!frame->path) {
+    return false;
+  }
+  list->count++;
+  return true;
+}
+
+static int compareNames(const void *a, const void *b) {
+  return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+// adds the regular files in the directory, sorted by name so the frames of a sequence
+// are processed in order. Hidden files are skipped, files other than DPX files are
+// rejected later when they are read.
+static bool addDirectory(DPXFrameList *list, const char *path) {
+  DIR *directory = opendir(path);
+  if (!directory) {
+    perror(path);
+    return false;
+  }
+
+  char **names = NULL;
+  size_t nameCount = 0;
+  size_t nameCapacity = 0;
+  bool added = true;
+
+  struct dirent *entry;
+  while (added && (entry = readdir(directory)) != NULL) {
+    if (entry->d_name[0] == '.') {
+      continue;
+    }
+
+    char entryPath[PATH_MAX];
+    struct stat entryStatus;
+    snprintf(entryPath, sizeof(entryPath), "%s/%s", path, entry->d_name);
+    if ((stat(entryPath, &entryStatus) != 0) || !S_ISREG(entryStatus.st_mode)) {
+      continue;
+    }
+
+    if (nameCount == nameCapacity) {
+      nameCapacity = nameCapacity ? nameCapacity * 2 : 256;
+      char **grownNames = realloc(names, nameCapacity * sizeof(char *));
+      if (!grownNames) {
+        added = false;
+        break;
+      }
+      names = grownNames;
+    }
+    names[nameCount] = strdup(entryPath);
+    added = (names[nameCount] != NULL);
+    nameCount += added;
+  }
+  closedir(directory);
+
+  qsort(names, nameCount, sizeof(char *), compareNames);
+  for (size_t i = 0; i < nameCount; i++) {
+    added = added && addFrame(list, names[i]);
+    free(names[i]);
+  }
+  free(names);
+
+  return added;
+}
+
+static bool addArgument(DPXFrameList *list, const char *argument) {
+  struct stat status;
+  if (stat(argument, &status) == 0) {
+    return S_ISDIR(status.st_mode) ? addDirectory(list, argument) : addFrame(list, argument);
+  }
+
+  // patterns are expanded here as well, so they can be quoted when a shell's
+  // command line would be too long for all the frames of a shot
+  if (strpbrk(argument, "*?[") == NULL) {
+    perror(argument);
+    return false;
+  }
+
+  glob_t matches;
+  if (glob(argument, 0, NULL, &matches) != 0) {
+    fprintf(stderr, "%s: no matches\n", argument);
+    return false;
+  }
+
+  bool added = true;
+  for (size_t i = 0; added && (i < matches.gl_pathc); i++) {
+    added = addFrame(list, matches.gl_pathv[i]);
+  }
+  globfree(&matches);
+  return added;
+}
+
+// writes the path of the thumbnail of the frame at framePath to thumbnailPath:
+// the frame's file name with the extension of the format, in the output directory
+static bool thumbnailPath(const DPXBatch *batch, const char *framePath, char *thumbnailPath, size_t length) {
+  static const char *extensions[] = { "png", "ppm", "raw" };
+
+  char name[PATH_MAX];
+  strlcpy(name, framePath, sizeof(name));
+  char *fileName = basename(name);
+  char *extension = strrchr(fileName, '.');
+  if (extension && (extension != fileName)) {
+    *extension = '\0';
+  }
+
+  const int pathLength = snprintf(thumbnailPath, length, "%s/%s.%s", batch->outputDirectory, fileName, extensions[batch->format]);
+  return (pathLength > 0) && ((size_t)pathLength < length);
+}
+
+static bool writePNG(CGImageRef image, const char *path) {
+  CFURLRef url = CFURLCreateFromFileSystemRepresentation(NULL, (const UInt8 *)path, (CFIndex)strlen(path), false);
+  if (!url) {
+    return false;
+  }
+
+  CGImageDestinationRef destination = CGImageDestinationCreateWithURL(url, CFSTR("public.png"), 1, NULL);
+  CFRelease(url);
+  if (!destination) {
+    return false;
+  }
+
+  CGImageDestinationAddImage(destination, image, NULL);
+  const bool written = CGImageDestinationFinalize(destination);
+  CFRelease(destination);
+  return written;
+}
+
+// writes the thumbnail as a binary PGM (grey) or PPM (RGB) file. Alpha is dropped,
+// 16-bit samples are written in big-endian byte order as the format requires.
+static bool writePPM(CGImageRef image, const char *path) {
+  const size_t width = CGImageGetWidth(image);
+  const size_t height = CGImageGetHeight(image);
+  const size_t bytesPerRow = CGImageGetBytesPerRow(image);
+  const size_t bytesPerComponent = CGImageGetBitsPerComponent(image) / 8;
+  if (((bytesPerComponent != 1) && (bytesPerComponent != 2)) || (CGImageGetBitmapInfo(image) & kCGBitmapFloatComponents)) {
+    return false;
+  }
+  const size_t components = CGImageGetBitsPerPixel(image) / 8 / bytesPerComponent;
+  const CGImageAlphaInfo alphaInfo = CGImageGetAlphaInfo(image);
+  if ((components == 0) || (components > 4)) {
+    return false;
+  }
+
+  const size_t outputComponents = (components < 3) ? 1 : 3;
+  const size_t firstComponent = ((alphaInfo == kCGImageAlphaFirst) || (alphaInfo == kCGImageAlphaPremultipliedFirst)) ? 1 : 0;
+  // 16-bit thumbnails of 16-bit images keep the file's byte order
+  const bool bigEndian = (CGImageGetBitmapInfo(image) & kCGBitmapByteOrderMask) == kCGBitmapByteOrder16Big;
+
+  CFDataRef pixels = CGDataProviderCopyData(CGImageGetDataProvider(image));
+  if (!pixels) {
+    return false;
+  }
+  UInt8 *line = malloc(width * outputComponents * bytesPerComponent);
+  FILE *file = line ? fopen(path, "wb") : NULL;
+  if (!file) {
+    free(line);
+    CFRelease(pixels);
+    return false;
+  }
+
+  bool written = fprintf(file, "P%c\n%zu %zu\n%u\n", (outputComponents == 1) ? '5' : '6', width, height, (bytesPerComponent == 1) ? 255u : 65535u) > 0;
+  for (size_t y = 0; written && (y < height); y++) {
+    const UInt8 *source = CFDataGetBytePtr(pixels) + y * bytesPerRow;
+    UInt8 *target = line;
+    for (size_t x = 0; x < width; x++) {
+      const UInt8 *pixel = source + (x * components + firstComponent) * bytesPerComponent;
+      for (size_t c = 0; c < outputComponents * bytesPerComponent; c += bytesPerComponent) {
+        if (bytesPerComponent == 1) {
+          *target++ = pixel[c];
+        } else if (bigEndian) {
+          *target++ = pixel[c];
+          *target++ = pixel[c + 1];
+        } else {
+          *target++ = pixel[c + 1];
+          *target++ = pixel[c];
+        }
+      }
+    }
+    written = fwrite(line, 1, (size_t)(target - line), file) == (size_t)(target - line);
+  }
+
+  written = (fclose(file) == 0) && written;
+  free(line);
+  CFRelease(pixels);
+  return written;
+}
+
+// writes the pixels exactly as CoreGraphics describes them, without a header
+static bool writeRaw(CGImageRef image, const char *path) {
+  CFDataRef pixels = CGDataProviderCopyData(CGImageGetDataProvider(image));
+  if (!pixels) {
+    return false;
+  }
+
+  FILE *file = fopen(path, "wb");
+  bool written = false;
+  if (file) {
+    const size_t length = (size_t)CFDataGetLength(pixels);
+    written = fwrite(CFDataGetBytePtr(pixels), 1, length, file) == length;
+    written = (fclose(file) == 0) && written;
+  }
+  CFRelease(pixels);
+  return written;
+}
+
+// reads, decodes and writes one frame.
+// Twice as many frames as there are cores are in flight, so while some tasks are
+// blocked paging in their files, the others keep the cores busy decoding.
+static void processFrame(void *context) {
+  DPXFrame *frame = context;
+  const DPXBatch *batch = frame->batch;
+
+  CFURLRef url = CFURLCreateFromFileSystemRepresentation(NULL, (const UInt8 *)frame->path, (CFIndex)strlen(frame->path), false);
+  DPXImage image = url ? readDPXImage(url) : NULL;
+  if (!image) {
+    fprintf(stderr, "%s: not a DPX file\n", frame->path);
+    if (url) {
+      CFRelease(url);
+    }
+    dispatch_semaphore_signal(batch->framesInFlight);
+    return;
+  }
+
+  struct stat status;
+  if (stat(frame->path, &status) == 0) {
+    frame->bytes = status.st_size;
+  }
+
+  // proxies are decoded from the frame and written into it by DPXwriteProxy
+  if (batch->format == DPXOutputFormatProxy) {
+    releaseDPXImage(image);
+    frame->written = DPXwriteProxy(url, batch->size, batch->componentFormat);
+    if (!frame->written) {
+      fprintf(stderr, "%s: couldn't embed the proxy\n", frame->path);
+    }
+    CFRelease(url);
+    dispatch_semaphore_signal(batch->framesInFlight);
+    return;
+  }
+  CFRelease(url);
+
+  DPXsetToneMapping(image, batch->toneMapping);
+  CGImageRef thumbnail = createThumbnailCGImageWithSizeFromDPX(image, batch->size, batch->componentFormat);
+  char path[PATH_MAX];
+  if (thumbnail && thumbnailPath(batch, frame->path, path, sizeof(path))) {
+    switch (batch->format) {
+      case DPXOutputFormatPNG:
+        frame->written = writePNG(thumbnail, path);
+        break;
+      case DPXOutputFormatPPM:
+        frame->written = writePPM(thumbnail, path);
+        break;
+      case DPXOutputFormatRaw:
+        frame->written = writeRaw(thumbnail, path);
+        break;
+      case DPXOutputFormatProxy:
+        break;
+    }
+  }
+  if (!frame->written) {
+    fprintf(stderr, "%s: couldn't create the thumbnail\n", frame->path);
+  }
+
+  CGImageRelease(thumbnail);
+  releaseDPXImage(image);
+  dispatch_semaphore_signal(batch->framesInFlight);
+}
+
+int main(int argc, char *argv[]) {
+  DPXBatch batch = { CGSizeMake(kDefaultThumbnailSize, kDefaultThumbnailSize), DPXOutputFormatPNG, DPXComponentFormat8Dithered, { 0.0f, DPXToneCurveLinear }, ".", NULL };
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  long framesInFlight = 2 * ((cores > 0) ? cores : 1);
+
+  int option;
+  while ((option = getopt(argc, argv, "s:f:c:e:t:o:j:h")) != -1) {
+    switch (option) {
+      case 's': {
+        const long size = strtol(optarg, NULL, 10);
+        if (size <= 0) {
+          fprintf(stderr, "invalid size: %s\n", optarg);
+          return EXIT_FAILURE;
+        }
+        batch.size = CGSizeMake(size, size);
+        break;
+      }
+      case 'f':
+        if (strcmp(optarg, "png") == 0) {
+          batch.format = DPXOutputFormatPNG;
+        } else if (strcmp(optarg, "ppm") == 0) {
+          batch.format = DPXOutputFormatPPM;
+        } else if (strcmp(optarg, "raw") == 0) {
+          batch.format = DPXOutputFormatRaw;
+        } else if (strcmp(optarg, "proxy") == 0) {
+          batch.format = DPXOutputFormatProxy;
+        } else {
+          fprintf(stderr, "unknown format: %s\n", optarg);
+          return EXIT_FAILURE;
+        }
+        break;
+      case 'c':
+        if (strcmp(optarg, "8") == 0) {
+          batch.componentFormat = DPXComponentFormat8;
+        } else if (strcmp(optarg, "8d") == 0) {
+          batch.componentFormat = DPXComponentFormat8Dithered;
+        } else if (strcmp(optarg, "16") == 0) {
+          batch.componentFormat = DPXComponentFormat16;
+        } else if (strcmp(optarg, "half") == 0) {
+          batch.componentFormat = DPXComponentFormatHalf;
+        } else {
+          fprintf(stderr, "unknown component format: %s\n", optarg);
+          return EXIT_FAILURE;
+        }
+        break;
+      case 'e': {
+        char *end = NULL;
+        batch.toneMapping.exposure = strtof(optarg, &end);
+        if ((end == optarg) || (*end != '\0') || !isfinite(batch.toneMapping.exposure)) {
+          fprintf(stderr, "invalid exposure: %s\n", optarg);
+          return EXIT_FAILURE;
+        }
+        break;
+      }
+      case 't':
+        if (strcmp(optarg, "linear") == 0) {
+          batch.toneMapping.curve = DPXToneCurveLinear;
+        } else if (strcmp(optarg, "srgb") == 0) {
+          batch.toneMapping.curve = DPXToneCurveSRGB;
+        } else if (strcmp(optarg, "reinhard") == 0) {
+          batch.toneMapping.curve = DPXToneCurveReinhard;
+        } else {
+          fprintf(stderr, "unknown tone curve: %s\n", optarg);
+          return EXIT_FAILURE;
+        }
+        break;
+      case 'o':
+        batch.outputDirectory = optarg;
+        break;
+      case 'j':
+        framesInFlight = strtol(optarg, NULL, 10);
+        if (framesInFlight <= 0) {
+          fprintf(stderr, "invalid number of frames: %s\n", optarg);
+          return EXIT_FAILURE;
+        }
+        break;
+      default:
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+  }
+  if (optind == argc) {
+    usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+  if ((batch.format == DPXOutputFormatPPM) && (batch.componentFormat == DPXComponentFormatHalf)) {
+    fprintf(stderr, "half float thumbnails can't be written as ppm\n");
+    return EXIT_FAILURE;
+  }
+  if ((batch.format == DPXOutputFormatProxy) && (batch.componentFormat != DPXComponentFormat8) && (batch.componentFormat != DPXComponentFormat8Dithered)) {
+    fprintf(stderr, "proxies have 8-bit components\n");
+    return EXIT_FAILURE;
+  }
+
+  // arguments that can't be read are reported, the frames of the others are still processed
+  DPXFrameList list = { NULL, 0, 0 };
+  bool argumentsRead = true;
+  for (int i = optind; i < argc; i++) {
+    argumentsRead = addArgument(&list, argv[i]) && argumentsRead;
+  }
+
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  // the frames are handed to the global concurrent queue one by one, GCD's worker
+  // threads pick up the next frame as soon as they are done with their last one.
+  // The semaphore keeps the frames from being opened all at once.
+  batch.framesInFlight = dispatch_semaphore_create(framesInFlight);
+  dispatch_group_t group = dispatch_group_create();
+  dispatch_queue_t queue = dispatch_get_global_queue(QOS_CLASS_USER_INITIATED, 0);
+  for (size_t i = 0; i < list.count; i++) {
+    list.frames[i].batch = &batch;
+    dispatch_semaphore_wait(batch.framesInFlight, DISPATCH_TIME_FOREVER);
+    dispatch_group_async_f(group, queue, &list.frames[i], processFrame);
+  }
+  dispatch_group_wait(group, DISPATCH_TIME_FOREVER);
+  dispatch_release(group);
+  dispatch_release(batch.framesInFlight);
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  const double seconds = (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+
+  size_t written = 0;
+  off_t bytes = 0;
+  for (size_t i = 0; i < list.count; i++) {
+    written += list.frames[i].written;
+    bytes += list.frames[i].bytes;
+    free(list.frames[i].path);
+  }
+  free(list.frames);
+
+  printf("%zu of %zu frames in %.2f s: %.1f frames/s, %.1f MB/s\n", written, list.count, seconds,
+         (seconds > 0) ? (double)written / seconds : 0.0, (seconds > 0) ? (double)bytes / seconds / 1e6 : 0.0);
+  return (argumentsRead && (written == list.count)) ? EXIT_SUCCESS : EXIT_FAILURE;
+}